@@ -20,14 +20,18 @@
 #include "neigh_request.h"
 #include "error.h"
 #include "force.h"
+#include "pair.h"
 #include "memory.h"
 #include "atom.h"
 #include "domain.h"
+#include "comm.h"
 
 using namespace LAMMPS_NS;
 
 enum{SINGLE,GROUP,GROUPSHAPE};
 
+#define DELTA 1024
+
 /* ---------------------------------------------------------------------- */
 
 ComputeCOMLocal::ComputeCOMLocal(LAMMPS *lmp, int narg, char **arg) :
@@ -55,33 +59,31 @@ ComputeCOMLocal::ComputeCOMLocal(LAMMPS *lmp, int narg, char **arg) :
     error->all(FLERR,"Radius larger then maximum neighbor cutoff!\n");
   }
   
+  // a dynamic group may change the number of centers between invocations
+  if (mode == SINGLE && group->dynamic[igroup]) {
+    dynamic_group_allow = 1;
+    size_vector_variable = 1;
+  }
+
   // determine group members
+  pos_group_loc = pos_group_glo = com_loc = com_glo = NULL;
+  count_loc = count_glo = NULL;
+  indices_group = NULL;
+  maxgroup_loc = maxgroup_glo = 0;
+  ngroup_loc = ngroup_scan = 0;
   if (mode == SINGLE) {
-    int i;
-    int nlocal = atom->nlocal;
-    int *mask = atom->mask;
-    ngroup_loc = ngroup_glo = ngroup_scan = 0;
-    for (i=0; i<nlocal; i++) {
-      if(mask[i] & groupbit) {
-	ngroup_loc++;
-      }
-    }
-    MPI_Allreduce(&ngroup_loc, &ngroup_glo, 1, MPI_INT, MPI_SUM, world);
-    if ( ngroup_glo == 0 ) error->all(FLERR,"Illegal compute com_local command: No group members");
+    find_members();
+    if (ngroup_glo == 0 && !group->dynamic[igroup])
+      error->all(FLERR,"Illegal compute com_local command: No group members");
   } else {
     ngroup_glo = 1;
+    grow_centers();
   }
-  
-  // allocate memory
-  size_vector = 4*ngroup_glo;
-  memory->create(pos_group_loc,ngroup_glo*3,"com_local/atom:x_group_loc");
-  memory->create(pos_group_glo,ngroup_glo*3,"com_local/atom:x_group_glo");
-  memory->create(com_loc,ngroup_glo*4,"com_local/atom:com_loc");
-  memory->create(com_glo,ngroup_glo*4,"com_local/atom:com_glo");
-  memory->create(count_loc,ngroup_glo,"com_local/atom:count_loc");
-  memory->create(count_glo,ngroup_glo,"com_local/atom:count_glo");
-  vector = com_glo;
- 
+
+  // member index of local and ghost atoms for the neighbor list path
+  nmax = 0;
+  member = NULL;
+  if (mode == SINGLE) comm_forward = 1;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -94,20 +96,29 @@ ComputeCOMLocal::~ComputeCOMLocal()
   memory->destroy(com_glo);
   memory->destroy(count_loc);
   memory->destroy(count_glo);
+  memory->destroy(member);
+  memory->destroy(indices_group);
 }
 
 /* ---------------------------------------------------------------------- */
 
 void ComputeCOMLocal::init()
 {
-  if (mode == GROUPSHAPE) {
+  // the centers are only searched in the neighbor list if it
+  // holds every pair within radius, see use_list()
+  listflag = (mode == SINGLE) && use_list();
+
+  if (mode == GROUPSHAPE || listflag) {
     // need a full neighbor list, built whenever re-neighboring occurs
-    irequest = neighbor->request(this);
+    irequest = neighbor->request(this,instance_me);
     neighbor->requests[irequest]->pair = 0;
-    neighbor->requests[irequest]->fix = 1;
+    neighbor->requests[irequest]->compute = 1;
     neighbor->requests[irequest]->half = 0;
     neighbor->requests[irequest]->full = 1;
   }
+
+  // atoms may have been added, removed or sorted between runs
+  lastbuild = -1;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -118,7 +129,6 @@ void ComputeCOMLocal::compute_vector()
   int i,j;
   double massone;
   double xtmp, ytmp, ztmp, delx, dely, delz, rsq;
-  int *indices_group;
   int nlocal = atom->nlocal;
   int *mask = atom->mask;
   double **x = atom->x;
@@ -127,24 +137,15 @@ void ComputeCOMLocal::compute_vector()
   double *rmass = atom->rmass;
   double *mass = atom->mass;
   
-  // determine group members (dynamically)
-  if (mode == SINGLE) {
-    ngroup_loc = ngroup_scan = 0;
-    memory->grow(indices_group,ngroup_loc,"com_local/atom:indices_group");
-    for (i=0; i<nlocal; i++) {
-      if(mask[i] & groupbit) {
-	ngroup_loc++;
-	memory->grow(indices_group,ngroup_loc,"com_local/atom:indices_group");
-	indices_group[ngroup_loc-1]=i;
-      }
-    }
-    MPI_Exscan(&ngroup_loc,&ngroup_scan,1,MPI_INT, MPI_SUM, world);
-  } else {
-    ngroup_glo = 1;
-  }
+  // local indices only change on reneighboring (exchange, sorting),
+  // members of a dynamic group may change on any step
+  if (mode == SINGLE &&
+      (group->dynamic[igroup] || neighbor->lastcall != lastbuild))
+    find_members();
   
   // scatter particle information to all processors
-  for (i=0; i< ngroup_glo; i++) {
+  // entries beyond the current centers stay zero for locked readers
+  for (i=0; i< maxgroup_glo; i++) {
     pos_group_loc[3*i] = pos_group_glo[3*i] = com_loc[4*i] =  com_glo[4*i] = 0.0;
     pos_group_loc[3*i+1] = pos_group_glo[3*i+1] = com_loc[4*i+1] = com_glo[4*i+1] = 0.0;
     pos_group_loc[3*i+2] = pos_group_glo[3*i+2] = com_loc[4*i+2]= com_glo[4*i+2] = 0.0;
@@ -153,7 +154,17 @@ void ComputeCOMLocal::compute_vector()
     count_glo[i] = 0.0;
   }
   // determine center of mass of the particles
-  if (mode == SINGLE) {
+  // with the neighbor list the centers are only needed as ghosts
+  if (listflag) {
+    if (atom->nmax > nmax) {
+      memory->destroy(member);
+      nmax = atom->nmax;
+      memory->create(member,nmax,"com_local/atom:member");
+    }
+    for (i=0; i<nlocal; i++) member[i] = -1.0;
+    for (i=0; i< ngroup_loc; i++) member[indices_group[i]] = i+ngroup_scan;
+    comm->forward_comm_compute(this);
+  } else if (mode == SINGLE) {
     for (i=0; i< ngroup_loc; i++) {
       pos_group_loc[3*(i+ngroup_scan)]=x[indices_group[i]][0];
       pos_group_loc[3*(i+ngroup_scan)+1]=x[indices_group[i]][1];
@@ -246,6 +257,50 @@ void ComputeCOMLocal::compute_vector()
       }
     }
     
+  } else if (listflag) {
+    // only the centers within the neighbor cutoff of a jgroup atom are tested,
+    // the ghost images already carry the minimum image displacement
+    int ii,jj,inum,jnum,icenter;
+    int *ilist,*jlist,*numneigh,**firstneigh;
+
+    list = neighbor->lists[irequest];
+    inum = list->inum;
+    ilist = list->ilist;
+    numneigh = list->numneigh;
+    firstneigh = list->firstneigh;
+
+    for (ii = 0; ii < inum; ii++) {
+      j = ilist[ii];
+      if (!(mask[j] & jgroupbit)) continue;
+      massone = 0.0;
+      if (rmass) massone = rmass[j];
+      else massone = mass[type[j]];
+      xtmp = x[j][0];
+      ytmp = x[j][1];
+      ztmp = x[j][2];
+
+      // a center in jgroup is part of its own neighbourhood
+      icenter = static_cast<int> (member[j]);
+      if (icenter >= 0) count_loc[icenter] += massone;
+
+      jlist = firstneigh[j];
+      jnum = numneigh[j];
+      for (jj = 0; jj < jnum; jj++) {
+        i = jlist[jj] & NEIGHMASK;
+        icenter = static_cast<int> (member[i]);
+        if (icenter < 0) continue;
+        delx = xtmp - x[i][0];
+        dely = ytmp - x[i][1];
+        delz = ztmp - x[i][2];
+        rsq = delx*delx + dely*dely + delz*delz;
+        if (rsq < r2) {
+          count_loc[icenter] += massone;
+          com_loc[4*icenter] += delx * massone;
+          com_loc[4*icenter+1] += dely * massone;
+          com_loc[4*icenter+2] += delz * massone;
+        }
+      }
+    }
   } else {
     for (j = 0; j < nlocal; j++) {
       if (mask[j] & jgroupbit) {
@@ -285,7 +340,149 @@ void ComputeCOMLocal::compute_vector()
     }
   }
   
-  if (mode == SINGLE) memory->destroy(indices_group);
-  
-  
+}
+
+/* ----------------------------------------------------------------------
+   collect the local members and their offset in the global center list
+   the capacity only grows, so rebuilds do not reallocate
+------------------------------------------------------------------------- */
+
+void ComputeCOMLocal::find_members()
+{
+  int nlocal = atom->nlocal;
+  int *mask = atom->mask;
+
+  ngroup_loc = 0;
+  for (int i = 0; i < nlocal; i++) {
+    if (mask[i] & groupbit) {
+      if (ngroup_loc == maxgroup_loc) {
+        maxgroup_loc += DELTA;
+        memory->grow(indices_group,maxgroup_loc,"com_local/atom:indices_group");
+      }
+      indices_group[ngroup_loc++] = i;
+    }
+  }
+
+  MPI_Allreduce(&ngroup_loc,&ngroup_glo,1,MPI_INT,MPI_SUM,world);
+  MPI_Exscan(&ngroup_loc,&ngroup_scan,1,MPI_INT,MPI_SUM,world);
+  if (comm->me == 0) ngroup_scan = 0;
+
+  grow_centers();
+  lastbuild = neighbor->lastcall;
+}
+
+/* ----------------------------------------------------------------------
+   (re)allocate per-center arrays if the number of centers grew
+------------------------------------------------------------------------- */
+
+void ComputeCOMLocal::grow_centers()
+{
+  size_vector = 4*ngroup_glo;
+  if (ngroup_glo <= maxgroup_glo) return;
+
+  maxgroup_glo = ngroup_glo;
+  memory->destroy(pos_group_loc);
+  memory->destroy(pos_group_glo);
+  memory->destroy(com_loc);
+  memory->destroy(com_glo);
+  memory->destroy(count_loc);
+  memory->destroy(count_glo);
+  memory->create(pos_group_loc,maxgroup_glo*3,"com_local/atom:x_group_loc");
+  memory->create(pos_group_glo,maxgroup_glo*3,"com_local/atom:x_group_glo");
+  memory->create(com_loc,maxgroup_glo*4,"com_local/atom:com_loc");
+  memory->create(com_glo,maxgroup_glo*4,"com_local/atom:com_glo");
+  memory->create(count_loc,maxgroup_glo,"com_local/atom:count_loc");
+  memory->create(count_glo,maxgroup_glo,"com_local/atom:count_glo");
+  for (int i = 0; i < 4*maxgroup_glo; i++) com_glo[i] = 0.0;
+  vector = com_glo;
+}
+
+/* ----------------------------------------------------------------------
+   current vector length, so fix ave/time can size its columns
+------------------------------------------------------------------------- */
+
+int ComputeCOMLocal::lock_length()
+{
+  if (mode == SINGLE && group->dynamic[igroup]) find_members();
+  return size_vector;
+}
+
+/* ----------------------------------------------------------------------
+   the neighbor list holds every pair within radius if radius does not
+   exceed the pair cutoff of any type pair of a jgroup atom and a center
+   and no special pairs are excluded from it, otherwise fall back to the
+   all-to-all test, pair cutsq is final before the computes are initialized
+------------------------------------------------------------------------- */
+
+int ComputeCOMLocal::use_list()
+{
+  if (!force->pair || !force->pair->cutsq) return 0;
+  if (atom->molecular)
+    for (int m = 1; m < 4; m++)
+      if (force->special_lj[m] == 0.0 && force->special_coul[m] == 0.0) return 0;
+
+  // atom types in jgroup and among the centers, all types for a dynamic group
+
+  int i,j;
+  int ntypes = atom->ntypes;
+  int nlocal = atom->nlocal;
+  int *mask = atom->mask;
+  int *type = atom->type;
+  int *present_loc,*present_glo;
+
+  memory->create(present_loc,2*(ntypes+1),"com_local/atom:present_loc");
+  memory->create(present_glo,2*(ntypes+1),"com_local/atom:present_glo");
+  for (i = 0; i < 2*(ntypes+1); i++) present_loc[i] = 0;
+  for (i = 0; i < nlocal; i++) {
+    if (group->dynamic[jgroup] || (mask[i] & jgroupbit))
+      present_loc[type[i]] = 1;
+    if (group->dynamic[igroup] || (mask[i] & groupbit))
+      present_loc[ntypes+1+type[i]] = 1;
+  }
+  MPI_Allreduce(present_loc,present_glo,2*(ntypes+1),MPI_INT,MPI_MAX,world);
+
+  double **cutsq = force->pair->cutsq;
+  int flag = 1;
+  for (i = 1; i <= ntypes; i++) {
+    if (!present_glo[i]) continue;
+    for (j = 1; j <= ntypes; j++)
+      if (present_glo[ntypes+1+j] && r2 > cutsq[i][j]) flag = 0;
+  }
+
+  memory->destroy(present_loc);
+  memory->destroy(present_glo);
+  return flag;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int ComputeCOMLocal::pack_forward_comm(int n, int *list, double *buf,
+                                       int pbc_flag, int *pbc)
+{
+  int i,m;
+
+  m = 0;
+  for (i = 0; i < n; i++) buf[m++] = member[list[i]];
+  return m;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void ComputeCOMLocal::unpack_forward_comm(int n, int first, double *buf)
+{
+  int i,m,last;
+
+  m = 0;
+  last = first + n;
+  for (i = first; i < last; i++) member[i] = buf[m++];
+}
+
+/* ---------------------------------------------------------------------- */
+
+double ComputeCOMLocal::memory_usage()
+{
+  double bytes = (double) maxgroup_glo * 16 * sizeof(double);
+  bytes += (double) maxgroup_loc * sizeof(int);
+  bytes += (double) nmax * sizeof(double);
+  return bytes;
 }
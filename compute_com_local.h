@@ -30,6 +30,10 @@ class ComputeCOMLocal : public Compute {
   ~ComputeCOMLocal();
   void init();
   void compute_vector();
+  int pack_forward_comm(int, int *, double *, int, int *);
+  void unpack_forward_comm(int, int, double *);
+  int lock_length();
+  double memory_usage();
 
  private:
    int mode;
@@ -45,9 +49,22 @@ class ComputeCOMLocal : public Compute {
   
   // neighbor list
   int irequest;
+  int listflag;           // centers are found through the neighbor list
   NeighList *list;
+  int use_list();
+
+  // index of the group member, -1 for other atoms (local and ghost)
+  double *member;
   
   int ngroup_loc, ngroup_glo,ngroup_scan;
+
+  // local member indices, kept until the next reneighboring
+  int *indices_group;
+  int maxgroup_loc;       // capacity of indices_group
+  int maxgroup_glo;       // capacity of the per-center arrays
+  bigint lastbuild;       // neighbor->lastcall of the current indices
+  void find_members();
+  void grow_centers();
 };
 
 }
@@ -33,18 +33,19 @@ class ComputeMemoryVolterra : public Compute {
   
  protected:
   char *id_fix;
-  class FixAveCorrelatePeratom *fix;
+  class FixAveCorrelateMemory *fix;
 
  private:
   int memory_switch;
   int ngroup_glo;
   char **groups;
   int nvalues;
-  char **values;
   int nevery,nrepeat,nfreq,nevery_corr;
   int me;
   
   int ncorr,nmem;
+  double *count;
+  double **corr;
   
   double mass;
 };
@@ -0,0 +1,341 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* Reconstructs the distance-dependent memory kernels used by fix gle/pair.
+ * For every distance bin the parallel components of a particle pair obey
+ * the matrix-valued Volterra equation
+ *   C_FF(t) = m K(t) C_VV(0) + int_0^t K(s) C_FV(t-s) ds
+ * with 2x2 matrices over the two particles. The diagonal of K minus the
+ * single-particle kernel gives the distance-dependent self kernel, the
+ * off-diagonal the cross kernel. The output (array or file) has the table
+ * layout read by FixGLEPair::read_input(). */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compute_memory_volterra_pair.h"
+#include "fix_ave_correlate_memory_pair.h"
+#include "update.h"
+#include "modify.h"
+#include "group.h"
+#include "memory.h"
+#include "error.h"
+#include "force.h"
+#include "atom.h"
+#include "comm.h"
+
+using namespace LAMMPS_NS;
+
+/* ---------------------------------------------------------------------- */
+
+ComputeMemoryVolterraPair::ComputeMemoryVolterraPair(LAMMPS * lmp, int narg, char **arg):
+  Compute (lmp, narg, arg)
+{
+  if (narg < 8) error->all(FLERR,"Illegal compute memory/volterra/pair command");
+
+  nevery_corr = force->inumeric(FLERR,arg[3]);
+  nrepeat = force->inumeric(FLERR,arg[4]);
+  dstart = force->numeric(FLERR,arg[5]);
+  dstep = force->numeric(FLERR,arg[6]);
+  dstop = force->numeric(FLERR,arg[7]);
+
+  MPI_Comm_rank(world,&me);
+
+  warn_flag = 0;
+  filename = NULL;
+  keyword = NULL;
+  int iarg = 8;
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"file") == 0) {
+      if (iarg+3 > narg) error->all(FLERR,"Illegal compute memory/volterra/pair command");
+      int n = strlen(arg[iarg+1]) + 1;
+      filename = new char[n];
+      strcpy(filename,arg[iarg+1]);
+      n = strlen(arg[iarg+2]) + 1;
+      keyword = new char[n];
+      strcpy(keyword,arg[iarg+2]);
+      iarg += 3;
+    } else error->all(FLERR,"Illegal compute memory/volterra/pair command");
+  }
+
+  // correlations are accumulated by an internal ave/correlate/memory/pair fix
+  // id = compute-ID + COMPUTE_CORRELATE, fix group = compute group
+  int n = strlen(id) + strlen("_COMPUTE_CORRELATE") + 1;
+  id_fix = new char[n];
+  strcpy(id_fix,id);
+  strcat(id_fix,"_COMPUTE_CORRELATE");
+
+  char **newarg = new char*[9];
+  newarg[0] = id_fix;
+  newarg[1] = group->names[igroup];
+  newarg[2] = (char *) "ave/correlate/memory/pair";
+  newarg[3] = arg[3];
+  newarg[4] = arg[4];
+  newarg[5] = arg[5];
+  newarg[6] = arg[6];
+  newarg[7] = arg[7];
+  newarg[8] = (char *) "restart";
+  modify->add_fix(9,newarg);
+  fix = (FixAveCorrelateMemoryPair *) modify->fix[modify->nfix-1];
+  delete [] newarg;
+
+  nbin = fix->nbin;
+
+  // this compute produces a global array in the fix gle/pair table layout
+  // first nrepeat rows: single-particle kernel (0, t, K_s, 0)
+  // then nrepeat rows per distance bin: (d, t, K_cross, K_self_dist)
+  array_flag = 1;
+  size_array_rows = nrepeat*(nbin+1);
+  size_array_cols = 4;
+  extarray = 0;
+
+  // determine mass of the particles
+  int nlocal = atom->nlocal;
+  int *mask = atom->mask;
+  int *type = atom->type;
+  double *rmass = atom->rmass;
+  double mass_loc = 0.0;
+  for (int i = 0; i < nlocal; i++)
+    if (mask[i] & groupbit)
+      mass_loc = MAX(mass_loc, rmass ? rmass[i] : atom->mass[type[i]]);
+  MPI_Allreduce(&mass_loc,&mass,1,MPI_DOUBLE,MPI_MAX,world);
+
+  // allocate memory
+  memory->create(array,size_array_rows,size_array_cols,"memory/volterra/pair:array");
+  memory->create(sum,fix->nsum,"memory/volterra/pair:sum");
+  memory->create(kernel_self,nrepeat,"memory/volterra/pair:kernel_self");
+  memory->create(kernel_pair,nbin,2*nrepeat,"memory/volterra/pair:kernel_pair");
+  for (int i = 0; i < size_array_rows; i++)
+    for (int j = 0; j < size_array_cols; j++)
+      array[i][j] = 0.0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+ComputeMemoryVolterraPair::~ComputeMemoryVolterraPair()
+{
+  // check nfix in case all fixes have already been deleted
+  if (modify->nfix) modify->delete_fix(id_fix);
+  delete [] id_fix;
+  delete [] filename;
+  delete [] keyword;
+  memory->destroy(array);
+  memory->destroy(sum);
+  memory->destroy(kernel_self);
+  memory->destroy(kernel_pair);
+}
+
+/* ---------------------------------------------------------------------- */
+
+void ComputeMemoryVolterraPair::init()
+{
+  int ifix = modify->find_fix(id_fix);
+  if (ifix < 0) error->all(FLERR,"Could not find compute memory/volterra/pair fix ID");
+  fix = (FixAveCorrelateMemoryPair *) modify->fix[ifix];
+}
+
+/* ----------------------------------------------------------------------
+   compute array value
+------------------------------------------------------------------------- */
+
+void ComputeMemoryVolterraPair::compute_array()
+{
+  int i,k,l;
+  invoked_array = update->ntimestep;
+
+  fix->reduce_correlation(sum);
+
+  const double dt_corr = update->dt*nevery_corr;
+
+  // single-particle kernel, scalar Volterra equation
+
+  double *vv = new double[nrepeat];
+  double *fv = new double[nrepeat];
+  double *ff = new double[nrepeat];
+  int nlag = 0;
+  for (k = 0; k < nrepeat; k++) {
+    const double *s = &sum[fix->self_offset(k)];
+    if (s[0] == 0.0) break;
+    vv[k] = s[1]/s[0];
+    fv[k] = s[2]/s[0];
+    ff[k] = s[3]/s[0];
+    nlag++;
+  }
+  // a singular equation leaves a partial kernel, it is zeroed and counted
+  int nsingular = 0;
+  for (k = 0; k < nrepeat; k++) kernel_self[k] = 0.0;
+  if (nlag && !volterra(1,nlag,dt_corr,mass,vv,fv,ff,kernel_self)) {
+    for (k = 0; k < nrepeat; k++) kernel_self[k] = 0.0;
+    nsingular++;
+  }
+  delete [] vv;
+  delete [] fv;
+  delete [] ff;
+
+  // pair kernels, 2x2 Volterra equation per distance bin
+  // bins are independent, so they are distributed over the threads
+
+#if defined(_OPENMP)
+#pragma omp parallel for private(l,k) schedule(dynamic) reduction(+:nsingular)
+#endif
+  for (l = 0; l < nbin; l++) {
+    double *cvv = new double[4*nrepeat];
+    double *cfv = new double[4*nrepeat];
+    double *cff = new double[4*nrepeat];
+    double *kern = new double[4*nrepeat];
+    int nlag_bin = 0;
+    for (k = 0; k < nrepeat; k++) {
+      const double *s = &sum[fix->pair_offset(l,k)];
+      if (s[0] == 0.0) break;
+      double norm = 1.0/s[0];
+      cvv[4*k] = cvv[4*k+3] = s[1]*norm;
+      cvv[4*k+1] = cvv[4*k+2] = s[2]*norm;
+      cfv[4*k] = cfv[4*k+3] = s[3]*norm;
+      cfv[4*k+1] = cfv[4*k+2] = s[4]*norm;
+      cff[4*k] = cff[4*k+3] = s[5]*norm;
+      cff[4*k+1] = cff[4*k+2] = s[6]*norm;
+      nlag_bin++;
+    }
+    for (k = 0; k < 4*nrepeat; k++) kern[k] = 0.0;
+    if (nlag_bin && !volterra(2,nlag_bin,dt_corr,mass,cvv,cfv,cff,kern)) {
+      for (k = 0; k < 4*nrepeat; k++) kern[k] = 0.0;
+      nlag_bin = 0;
+      nsingular++;
+    }
+    for (k = 0; k < nrepeat; k++) {
+      kernel_pair[l][2*k] = 0.5*(kern[4*k+1] + kern[4*k+2]);
+      if (k < nlag_bin)
+        kernel_pair[l][2*k+1] = 0.5*(kern[4*k] + kern[4*k+3]) - kernel_self[k];
+      else kernel_pair[l][2*k+1] = 0.0;
+    }
+    delete [] cvv;
+    delete [] cfv;
+    delete [] cff;
+    delete [] kern;
+  }
+
+  // fill array
+
+  for (k = 0; k < nrepeat; k++) {
+    array[k][0] = 0.0;
+    array[k][1] = k*dt_corr;
+    array[k][2] = kernel_self[k];
+    array[k][3] = 0.0;
+  }
+  for (l = 0; l < nbin; l++) {
+    for (k = 0; k < nrepeat; k++) {
+      i = nrepeat*(l+1) + k;
+      array[i][0] = dstart + l*dstep;
+      array[i][1] = k*dt_corr;
+      array[i][2] = kernel_pair[l][2*k];
+      array[i][3] = kernel_pair[l][2*k+1];
+    }
+  }
+
+  // singular kernels are not written as a fix gle/pair table
+
+  if (nsingular && me == 0 && !warn_flag) {
+    char str[128];
+    snprintf(str,128,"Compute memory/volterra/pair has %d singular "
+             "kernels, they are zero and no table is written",nsingular);
+    error->warning(FLERR,str);
+    warn_flag = 1;
+  }
+  if (filename && me == 0 && !nsingular) write_table();
+}
+
+/* ----------------------------------------------------------------------
+   write the kernels as a fix gle/pair input table
+------------------------------------------------------------------------- */
+
+void ComputeMemoryVolterraPair::write_table()
+{
+  FILE *fp = fopen(filename,"w");
+  if (fp == NULL) {
+    char str[128];
+    snprintf(str,128,"Cannot open compute memory/volterra/pair file %s",filename);
+    error->one(FLERR,str);
+  }
+
+  double dt_corr = update->dt*nevery_corr;
+  fprintf(fp,"# Memory kernels from compute memory/volterra/pair %s, timestep "
+          BIGINT_FORMAT "\n",id,update->ntimestep);
+  fprintf(fp,"\n%s\n",keyword);
+  fprintf(fp,"dStart %g dStep %g dStop %g tStart 0.0 tStep %g tStop %g\n",
+          dstart,dstep,dstop,dt_corr,(nrepeat-1)*dt_corr);
+  for (int i = 0; i < size_array_rows; i++) {
+    if (i < nrepeat) fprintf(fp,"%g %g %.10g\n",array[i][0],array[i][1],array[i][2]);
+    else fprintf(fp,"%g %g %.10g %.10g\n",array[i][0],array[i][1],array[i][2],array[i][3]);
+  }
+  fclose(fp);
+}
+
+/* ----------------------------------------------------------------------
+   solve the discretized Volterra equation (trapezoidal rule)
+     C_FF(i) = m K(i) C_VV(0) + dt sum_ip w_ip K(ip) C_FV(i-ip)
+   for dim x dim matrices (dim = 1 or 2), stored row-major per lag
+   returns 0 if the equation is singular, kernel is then partly filled
+------------------------------------------------------------------------- */
+
+int ComputeMemoryVolterraPair::volterra(int dim, int nlag, double dt, double mass,
+                                        const double *vv, const double *fv,
+                                        const double *ff, double *kernel)
+{
+  const int d2 = dim*dim;
+  int i,ip,a,b,c;
+  double lhs[4],inv[4],rhs[4];
+
+  // K(0) = C_FF(0) (m C_VV(0))^-1, afterwards the matrix multiplying K(i)
+  for (int pass = 0; pass < 2; pass++) {
+    for (a = 0; a < d2; a++) lhs[a] = mass*vv[a];
+    if (pass) for (a = 0; a < d2; a++) lhs[a] += 0.5*dt*fv[a];
+
+    double det = (dim == 1) ? lhs[0] : lhs[0]*lhs[3] - lhs[1]*lhs[2];
+    if (det == 0.0) return 0;
+    if (dim == 1) inv[0] = 1.0/det;
+    else {
+      inv[0] = lhs[3]/det;
+      inv[1] = -lhs[1]/det;
+      inv[2] = -lhs[2]/det;
+      inv[3] = lhs[0]/det;
+    }
+
+    if (pass == 0) {
+      for (a = 0; a < dim; a++)
+        for (b = 0; b < dim; b++) {
+          kernel[a*dim+b] = 0.0;
+          for (c = 0; c < dim; c++) kernel[a*dim+b] += ff[a*dim+c]*inv[c*dim+b];
+        }
+    }
+  }
+
+  for (i = 1; i < nlag; i++) {
+    for (a = 0; a < d2; a++) rhs[a] = ff[i*d2+a];
+    for (ip = 0; ip < i; ip++) {
+      double w = (ip == 0) ? 0.5*dt : dt;
+      const double *kp = &kernel[ip*d2];
+      const double *cp = &fv[(i-ip)*d2];
+      for (a = 0; a < dim; a++)
+        for (b = 0; b < dim; b++)
+          for (c = 0; c < dim; c++)
+            rhs[a*dim+b] -= w*kp[a*dim+c]*cp[c*dim+b];
+    }
+    double *ki = &kernel[i*d2];
+    for (a = 0; a < dim; a++)
+      for (b = 0; b < dim; b++) {
+        ki[a*dim+b] = 0.0;
+        for (c = 0; c < dim; c++) ki[a*dim+b] += rhs[a*dim+c]*inv[c*dim+b];
+      }
+  }
+  return 1;
+}
@@ -0,0 +1,86 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+#ifdef COMPUTE_CLASS
+
+ComputeStyle(memory/volterra/pair,ComputeMemoryVolterraPair)
+
+#else
+
+#ifndef LMP_COMPUTE_MEMORY_VOLTERRA_PAIR_H
+#define LMP_COMPUTE_MEMORY_VOLTERRA_PAIR_H
+
+#include "compute.h"
+
+namespace LAMMPS_NS {
+
+class ComputeMemoryVolterraPair : public Compute {
+ public:
+  ComputeMemoryVolterraPair(class LAMMPS *, int, char **);
+  ~ComputeMemoryVolterraPair();
+  void init();
+  void compute_array();
+
+ protected:
+  char *id_fix;
+  class FixAveCorrelateMemoryPair *fix;
+
+ private:
+  int nevery_corr,nrepeat,nbin;
+  double dstart,dstep,dstop;
+  int me;
+  int warn_flag;             // singular kernels were reported
+
+  double mass;
+  double *sum;
+  double *kernel_self;
+  double **kernel_pair;      // per bin: nrepeat x (cross, distance-dependent self)
+
+  char *filename,*keyword;
+
+  void write_table();
+  static int volterra(int, int, double, double, const double *, const double *,
+                      const double *, double *);
+};
+
+}
+
+#endif
+#endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal ... command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.  You can use -echo screen as a
+command-line option when running LAMMPS to see the offending line.
+
+E: Could not find compute memory/volterra/pair fix ID
+
+The internal correlation fix was deleted.
+
+E: Cannot open compute memory/volterra/pair file %s
+
+The specified file cannot be opened.  Check that the path and name are
+correct.
+
+W: Compute memory/volterra/pair has %d singular kernels, they are zero and no table is written
+
+The Volterra equation of the single-particle kernel or of some distance
+bins could not be solved, because m C_VV(0) or the matrix of the
+discretized equation is singular.  Their rows of the output array are
+zero and the kernel table file is not written.  Usually the correlation
+has not been sampled long enough.
+
+*/
@@ -0,0 +1,173 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include "fix_abp.h"
+#include "atom.h"
+#include "random_mars.h"
+#include "update.h"
+#include "domain.h"
+#include "comm.h"
+#include "memory.h"
+#include "error.h"
+#include "force.h"
+#include "thr_omp.h"
+
+using namespace LAMMPS_NS;
+using namespace FixConst;
+
+/* ----------------------------------------------------------------------
+   overdamped active Brownian particles in one pass per step:
+   position    dx  = D/kT (f + Fact e) dt + sqrt(2 D dt) xi
+   orientation e rotated by the angle vector sqrt(2 Dr dt) eta,
+               Dr = 3/4 D / radius^2 as in fix addactivity
+   e = mu/|mu|, the rotation keeps |mu|
+------------------------------------------------------------------------- */
+
+FixABP::FixABP(LAMMPS *lmp, int narg, char **arg) :
+  Fix(lmp, narg, arg)
+{
+  if (narg != 7) error->all(FLERR,"Illegal fix abp command");
+
+  if (!atom->mu_flag || !atom->radius_flag)
+    error->all(FLERR,"Fix abp requires atom attributes mu and radius");
+
+  time_integrate = 1;
+
+  Fact = utils::numeric(FLERR,arg[3],false,lmp);
+  D = utils::numeric(FLERR,arg[4],false,lmp);
+  temp = utils::numeric(FLERR,arg[5],false,lmp);
+  seed = utils::inumeric(FLERR,arg[6],false,lmp);
+  if (D <= 0.0 || temp <= 0.0 || seed <= 0)
+    error->all(FLERR,"Illegal fix abp command");
+
+  random = NULL;
+  nrandom = 0;
+  create_random();
+}
+
+/* ---------------------------------------------------------------------- */
+
+FixABP::~FixABP()
+{
+  for (int tid = 0; tid < nrandom; tid++) delete random[tid];
+  delete [] random;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixABP::setmask()
+{
+  int mask = 0;
+  mask |= INITIAL_INTEGRATE;
+  return mask;
+}
+
+/* ----------------------------------------------------------------------
+   one generator per thread, thread 0 of every proc uses seed + me
+------------------------------------------------------------------------- */
+
+void FixABP::create_random()
+{
+  for (int tid = 0; tid < nrandom; tid++) delete random[tid];
+  delete [] random;
+
+  nrandom = comm->nthreads;
+  random = new RanMars*[nrandom];
+  for (int tid = 0; tid < nrandom; tid++)
+    random[tid] = new RanMars(lmp,seed + comm->me + comm->nprocs*tid);
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixABP::init()
+{
+  if (nrandom != comm->nthreads) create_random();
+
+  double *radius = atom->radius;
+  int *mask = atom->mask;
+  int nlocal = atom->nlocal;
+  int flag = 0;
+  for (int i = 0; i < nlocal; i++)
+    if ((mask[i] & groupbit) && radius[i] <= 0.0) flag = 1;
+  int flagall;
+  MPI_Allreduce(&flag,&flagall,1,MPI_INT,MPI_MAX,world);
+  if (flagall) error->all(FLERR,"Fix abp requires atoms with positive radius");
+
+  dtfD = update->dt * D / (force->boltz * temp);
+  sigma = sqrt(2.0 * D * update->dt);
+  dtDr = 2.0 * 0.75 * D * update->dt;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixABP::initial_integrate(int vflag)
+{
+  double **x = atom->x;
+  double **f = atom->f;
+  double **mu = atom->mu;
+  double *radius = atom->radius;
+  int *mask = atom->mask;
+  int nlocal = atom->nlocal;
+  const int nthreads = nrandom;
+
+  // in 2d the particles move in the plane and rotate about z only
+  const int dim3 = (domain->dimension == 3);
+
+#if defined(_OPENMP)
+#pragma omp parallel default(shared)
+#endif
+  {
+    int ifrom,ito,tid;
+    loop_setup_thr(ifrom,ito,tid,nlocal,nthreads);
+    RanMars *rng = random[tid];
+
+    for (int i = ifrom; i < ito; i++) {
+      if (!(mask[i] & groupbit)) continue;
+
+      // self-propulsion along the current orientation
+      double e0 = 0.0, e1 = 0.0, e2 = 0.0;
+      if (mu[i][3] > 0.0) {
+        double muinv = 1.0/mu[i][3];
+        e0 = mu[i][0]*muinv;
+        e1 = mu[i][1]*muinv;
+        e2 = mu[i][2]*muinv;
+      }
+
+      x[i][0] += dtfD*(f[i][0] + Fact*e0) + sigma*rng->gaussian();
+      x[i][1] += dtfD*(f[i][1] + Fact*e1) + sigma*rng->gaussian();
+      if (dim3) x[i][2] += dtfD*(f[i][2] + Fact*e2) + sigma*rng->gaussian();
+
+      // random rotation angle vector, Rodrigues rotation of mu about it
+      double sigr = sqrt(dtDr/(radius[i]*radius[i]));
+      double t0 = 0.0, t1 = 0.0, t2;
+      if (dim3) {
+        t0 = sigr*rng->gaussian();
+        t1 = sigr*rng->gaussian();
+      }
+      t2 = sigr*rng->gaussian();
+
+      double phi = sqrt(t0*t0 + t1*t1 + t2*t2);
+      if (phi == 0.0) continue;
+      double k0 = t0/phi, k1 = t1/phi, k2 = t2/phi;
+      double c = cos(phi), s = sin(phi);
+      double m0 = mu[i][0], m1 = mu[i][1], m2 = mu[i][2];
+      double kdotm = (k0*m0 + k1*m1 + k2*m2)*(1.0-c);
+      mu[i][0] = m0*c + (k1*m2 - k2*m1)*s + k0*kdotm;
+      mu[i][1] = m1*c + (k2*m0 - k0*m2)*s + k1*kdotm;
+      mu[i][2] = m2*c + (k0*m1 - k1*m0)*s + k2*kdotm;
+    }
+  }
+}
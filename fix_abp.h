@@ -0,0 +1,69 @@
+/* -*- c++ -*- ----------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+#ifdef FIX_CLASS
+
+FixStyle(abp,FixABP)
+
+#else
+
+#ifndef LMP_FIX_ABP_H
+#define LMP_FIX_ABP_H
+
+#include "fix.h"
+
+namespace LAMMPS_NS {
+
+class FixABP : public Fix {
+ public:
+  FixABP(class LAMMPS *, int, char **);
+  ~FixABP();
+  int setmask();
+  void init();
+  void initial_integrate(int);
+
+ private:
+  double Fact, D, temp;
+  double dtfD, sigma;       // drift per force and translational noise per step
+  double dtDr;              // 2 Dr dt per 1/radius^2
+  int seed;
+
+  class RanMars **random;   // one generator per thread
+  int nrandom;
+
+  void create_random();
+};
+
+}
+
+#endif
+#endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal ... command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.  You can use -echo screen as a
+command-line option when running LAMMPS to see the offending line.
+
+E: Fix abp requires atom attributes mu and radius
+
+The orientation is the dipole direction, the rotational diffusion
+coefficient follows from the radius.
+
+E: Fix abp requires atoms with positive radius
+
+Rotational diffusion is undefined for point particles.
+
+*/
@@ -11,6 +11,7 @@
    See the README file in the top-level LAMMPS directory.
 ------------------------------------------------------------------------- */
 
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include "fix_addactivity.h"
@@ -28,6 +29,7 @@
 #include "memory.h"
 #include "error.h"
 #include "force.h"
+#include "comm.h"
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
@@ -56,7 +58,7 @@ FixAddActivity::FixAddActivity(LAMMPS *lmp, int narg, char **arg) :
       if (iarg+4 > narg) error->all(FLERR,"Illegal fix addactivity command");
       style = ABP;
       Fact = utils::numeric(FLERR,arg[iarg+2],false,lmp);
-      D = utils::numeric(FLERR,arg[iarg+2],false,lmp);
+      D = utils::numeric(FLERR,arg[iarg+3],false,lmp);
     } else error->all(FLERR,"Illegal fix addactivity command");
     iarg += 4;
   } else error->all(FLERR,"Illegal fix addactivity command");
@@ -81,15 +83,17 @@ FixAddActivity::FixAddActivity(LAMMPS *lmp, int narg, char **arg) :
   // initialize Marsaglia RNG with processor-unique seed
   random = new RanMars(lmp,seed + comm->me);
   
-  memory->create(sforce,maxatom,4,"addactivity:sforce");
-
+  // sforce is allocated on first use
+  maxatom = 0;
+  sforce = NULL;
 }
 
 /* ---------------------------------------------------------------------- */
 
 FixAddActivity::~FixAddActivity()
 {
-
+  delete random;
+  memory->destroy(sforce);
 }
 
 /* ---------------------------------------------------------------------- */
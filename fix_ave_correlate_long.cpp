@@ -193,7 +193,6 @@ FixAveCorrelateLong::FixAveCorrelateLong(LAMMPS * lmp, int narg, char **arg):
   dmin = p/m;
   length = numcorrelators*p;
   npcorr = 0;
-  kmax = 0;
 
   // setup and error check
   // for fix inputs, check that fix frequency is acceptable
@@ -290,37 +289,15 @@ FixAveCorrelateLong::FixAveCorrelateLong(LAMMPS * lmp, int narg, char **arg):
   // allocate and initialize memory for calculated values and correlators
 
   memory->create(values,nvalues,"correlator:values");
-  memory->create(shift,npair,numcorrelators,p,"correlator:shift");
-  memory->create(shift2,npair,numcorrelators,p,"correlator:shift2"); //NOT OPTMAL
-  memory->create(correlation,npair,numcorrelators,p,"correlator:correlation");
-  memory->create(dcorrelation,npair,numcorrelators,p,"correlator:dcorrelation");
-  memory->create(accumulator,npair,numcorrelators,"correlator:accumulator");
-  memory->create(accumulator2,npair,numcorrelators,"correlator:accumulator2"); // NOT OPTIMAL
-
-  memory->create(ncorrelation,numcorrelators,p,"correlator:ncorrelation");
-  memory->create(naccumulator,numcorrelators,"correlator:naccumulator");
-  memory->create(insertindex,numcorrelators,"correlator:insertindex");
+  memory->create(valA,npair,"correlator:valA");
+  memory->create(valB,npair,"correlator:valB");
   memory->create(t,length,"correlator:t");
   memory->create(f,npair,length,"correlator:f");
   memory->create(df,npair,length,"correlator:df");
 
-  for (int i=0;i<npair;i++)
-    for (int j=0;j<numcorrelators;j++) {
-      for (int k=0;k<p;k++) {
-        shift[i][j][k]=-2E10;
-        shift2[i][j][k]=0.0;
-        correlation[i][j][k]=0.0;
-	dcorrelation[i][j][k]=0.0;
-      }
-      accumulator[i][j]=0.0;
-      accumulator2[i][j]=0.0;
-    }
-
-  for (int i=0;i<numcorrelators;i++) {
-    for (int j=0;j<p;j++) ncorrelation[i][j]=0;
-    naccumulator[i]=0;
-    insertindex[i]=0;
-  }
+  int flags = MultiTau<double>::VARIANCE;
+  if (type != AUTO) flags |= MultiTau<double>::CROSS;
+  correlator = new MultiTau<double>(lmp,numcorrelators,p,m,dmin,npair,0,NULL,flags);
 
   for (int i=0;i<length;i++) t[i]=0.0;
   for (int i=0;i<npair;i++)
@@ -351,15 +328,9 @@ FixAveCorrelateLong::~FixAveCorrelateLong()
   delete [] ids;
 
   memory->destroy(values);
-  memory->destroy(shift);
-  memory->destroy(shift2);
-  memory->destroy(correlation);
-  memory->destroy(dcorrelation);
-  memory->destroy(accumulator);
-  memory->destroy(accumulator2);
-  memory->destroy(ncorrelation);
-  memory->destroy(naccumulator);
-  memory->destroy(insertindex);
+  memory->destroy(valA);
+  memory->destroy(valB);
+  delete correlator;
   memory->destroy(t);
   memory->destroy(f);
   memory->destroy(df);
@@ -516,14 +487,18 @@ void FixAveCorrelateLong::end_of_step()
 
 void FixAveCorrelateLong::evaluate() {
   unsigned int jm=0;
+  int kmax = correlator->max_level();
 
   // First correlator
   for (unsigned int j=0;j<p;++j) {
-    if (ncorrelation[0][j] > 0) {
+    bigint n = correlator->count(0,j);
+    if (n > 0) {
       t[jm] = j;
+      const double *c = correlator->correlation(0,j);
+      const double *dc = correlator->variance(0,j);
       for (int i=0;i<npair;++i){
-	f[i][jm] = correlation[i][0][j]/ncorrelation[0][j];
-        df[i][jm] = dcorrelation[i][0][j]/ncorrelation[0][j];
+        f[i][jm] = c[i]/n;
+        df[i][jm] = dc[i]/n;
       }
       ++jm;
     }
@@ -532,12 +507,15 @@ void FixAveCorrelateLong::evaluate() {
   // Subsequent correlators
   for (int k=1;k<kmax;++k) {
     for (int j=dmin;j<p;++j) {
-      if (ncorrelation[k][j]>0) {
+      bigint n = correlator->count(k,j);
+      if (n > 0) {
         t[jm] = j * pow((double)m, k);
+        const double *c = correlator->correlation(k,j);
+        const double *dc = correlator->variance(k,j);
         for (int i=0;i<npair;++i){
-          f[i][jm] = correlation[i][k][j] / ncorrelation[k][j];
-	  df[i][jm] = dcorrelation[i][k][j] / ncorrelation[k][j];
-	}
+          f[i][jm] = c[i] / n;
+          df[i][jm] = dc[i] / n;
+        }
         ++jm;
       }
     }
@@ -555,151 +533,49 @@ void FixAveCorrelateLong::accumulate()
 {
   int i,j,ipair;
 
-  //printf("DEBUG %i %i\n", nvalues, npair);
+  // pair ipair correlates valA(t) with valB(t-tau),
+  // autocorrelations within a cross type get valB = valA
 
   if (type == AUTO) {
-    for (i=0; i<nvalues;i++) add(i,values[i]);
+    for (i=0; i<nvalues;i++) valA[i] = values[i];
   } else if (type == UPPER) {
     ipair = 0;
     for (i=0;i<nvalues;i++)
-      for (j=i+1;j<nvalues;j++) add(ipair++,values[i],values[j]);
+      for (j=i+1;j<nvalues;j++) {
+        valA[ipair] = values[i];
+        valB[ipair++] = values[j];
+      }
   } else if (type == LOWER) {
     ipair = 0;
     for (i=0;i<nvalues;i++)
-      for (j=0;j<i;j++) add(ipair++,values[i],values[j]);
+      for (j=0;j<i;j++) {
+        valA[ipair] = values[i];
+        valB[ipair++] = values[j];
+      }
   } else if (type == AUTOUPPER) {
     ipair = 0;
     for (i=0;i<nvalues;i++)
       for (j=i;j<nvalues;j++) {
-        if (i==j) add(ipair++,values[i]);
-        else add(ipair++,values[i],values[j]);
+        valA[ipair] = values[i];
+        valB[ipair++] = values[j];
       }
   } else if (type == AUTOLOWER) {
     ipair = 0;
     for (i=0;i<nvalues;i++)
       for (j=0;j<=i;j++) {
-        if (i==j) add(ipair++,values[i]);
-        else add(ipair++,values[i],values[j]);
+        valA[ipair] = values[i];
+        valB[ipair++] = values[j];
       }
   } else if (type == FULL) {
     ipair = 0;
     for (i=0;i<nvalues;i++)
       for (j=0;j<nvalues;j++) {
-        if (i==j) add(ipair++,values[i]);
-        else add(ipair++,values[i],values[j]);
-      }
-  }
-}
-
-
-/* ----------------------------------------------------------------------
-   Add a scalar value to the autocorrelator k of pair i
-------------------------------------------------------------------------- */
-void FixAveCorrelateLong::add(const int i, const double w, const unsigned int k){
-  // If we exceed the correlator side, the value is discarded
-  if (k == numcorrelators) return;
-  if (k > kmax) kmax=k;
-
-  // Insert new value in shift array
-  shift[i][k][insertindex[k]] = w;
-
-  // Add to accumulator and, if needed, add to next correlator
-  accumulator[i][k] += w;
-  if (i==0) ++naccumulator[k];
-  if (naccumulator[k]==m) {
-    add(i,accumulator[i][k]/m, k+1);
-    accumulator[i][k]=0;
-    if (i==npair-1) naccumulator[k]=0;
-  }
-
-  // Calculate correlation function
-  unsigned int ind1=insertindex[k];
-  if (k==0) { // First correlator is different
-    int ind2=ind1;
-    for (unsigned int j=0;j<p;++j) {
-      if (shift[i][k][ind2] > -1e10) {
-	//printf("%d %f\n",k,shift[i][k][ind1]*shift[i][k][ind2]);
-        correlation[i][k][j]+= shift[i][k][ind1]*shift[i][k][ind2];
-	dcorrelation[i][k][j]+= shift[i][k][ind1]*shift[i][k][ind2]*shift[i][k][ind1]*shift[i][k][ind2];
-        if (i==0) ++ncorrelation[k][j];
-      }
-      --ind2;
-      if (ind2<0) ind2+=p;
-    }
-  } else {
-    int ind2=ind1-dmin;
-    for (unsigned int j=dmin;j<p;++j) {
-      if (ind2<0) ind2+=p;
-      if (shift[i][k][ind2] > -1e10) {
-	//printf("%d %f\n",k,shift[i][k][ind1]*shift[i][k][ind2]);
-        correlation[i][k][j]+= shift[i][k][ind1]*shift[i][k][ind2];
-	dcorrelation[i][k][j]+= shift[i][k][ind1]*shift[i][k][ind2]*shift[i][k][ind1]*shift[i][k][ind2];
-        if (i==0) ++ncorrelation[k][j];
-      }
-      --ind2;
-    }
-  }
-
-  if (i==npair-1) {
-    ++insertindex[k];
-    if (insertindex[k]==p) insertindex[k]=0;
-  }
-}
-
-
-/* ----------------------------------------------------------------------
-   Add 2 scalar values to the cross-correlator k of pair i
-------------------------------------------------------------------------- */
-void FixAveCorrelateLong::add(const int i, const double wA, const double wB,
-                        const unsigned int k) {
-  if (k == numcorrelators) return;
-  if (k > kmax) kmax=k;
-
-  shift[i][k][insertindex[k]] = wA;
-  shift2[i][k][insertindex[k]] = wB;
-
-  accumulator[i][k] += wA;
-  accumulator2[i][k] += wB;
-  if (i==0) ++naccumulator[k];
-  if (naccumulator[k]==m) {
-    add(i,accumulator[i][k]/m, accumulator2[i][k]/m,k+1);
-    accumulator[i][k]=0;
-    accumulator2[i][k]=0;
-    if (i==npair-1) naccumulator[k]=0;
-  }
-
-  unsigned int ind1=insertindex[k];
-  if (k==0) {
-    int ind2=ind1;
-    for (unsigned int j=0;j<p;++j) {
-      if (shift[i][k][ind2] > -1e10) {
-	//printf("%d %f %f\n",j,shift[i][k][ind1],shift2[i][k][ind2]);
-        correlation[i][k][j]+= shift[i][k][ind1]*shift2[i][k][ind2];
-	dcorrelation[i][k][j]+= shift[i][k][ind1]*shift2[i][k][ind2]*shift[i][k][ind1]*shift2[i][k][ind2];
-        if (i==0) ++ncorrelation[k][j];
-      }
-      --ind2;
-      if (ind2<0) ind2+=p;
-    }
-  }
-  else {
-    int ind2=ind1-dmin;
-    for (unsigned int j=dmin;j<p;++j) {
-      if (ind2<0) ind2+=p;
-      if (shift[i][k][ind2] > -1e10) {
-	//printf("%d %f %f\n",j,shift[i][k][ind1],shift2[i][k][ind2]);
-        correlation[i][k][j]+= shift[i][k][ind1]*shift2[i][k][ind2];
-	dcorrelation[i][k][j]+= shift[i][k][ind1]*shift2[i][k][ind2]*shift[i][k][ind1]*shift2[i][k][ind2];
-        if (i==0) ++ncorrelation[k][j];
+        valA[ipair] = values[i];
+        valB[ipair++] = values[j];
       }
-      --ind2;
-    }
   }
 
-  if (i==npair-1) {
-    ++insertindex[k];
-    if (insertindex[k]==p) insertindex[k]=0;
-  }
+  correlator->add(valA,valB);
 }
 
 
@@ -722,22 +598,13 @@ bigint FixAveCorrelateLong::nextvalid()
    memory_usage
 ------------------------------------------------------------------------- */
 double FixAveCorrelateLong::memory_usage() {
-  //    shift:            npair x numcorrelators x p
-  //    shift2:           npair x numcorrelators x p
-  //    correlation:      npair x numcorrelators x p
-  //    dcorrelation:      npair x numcorrelators x p
-  //    accumulator:      npair x numcorrelators
-  //    accumulator2:     npair x numcorrelators
-  //    ncorrelation:     numcorrelators x p
-  //    naccumulator:     numcorrelators
-  //    insertindex:      numcorrelators
+  //    correlator:       see MultiTau::memory_usage()
+  //    valA, valB:       npair
   //    t:		numcorrelators x p
   //    f:		npair x numcorrelators x p
   //    df:		npair x numcorrelators x p
-  double bytes = (6*npair*numcorrelators*p + 2*npair*numcorrelators
-                  + numcorrelators*p)*sizeof(double)
-    + numcorrelators*p*sizeof(unsigned long int)
-    + 2*numcorrelators*sizeof(unsigned int);
+  double bytes = correlator->memory_usage()
+    + (2*npair + numcorrelators*p + 2*npair*numcorrelators*p)*sizeof(double);
   return bytes;
 }
 
@@ -747,8 +614,7 @@ double FixAveCorrelateLong::memory_usage() {
 // Save everything except t and f
 void FixAveCorrelateLong::write_restart(FILE *fp) {
   if (me == 0) {
-    int nsize = 4*npair*numcorrelators*p + 2*npair*numcorrelators
-                + numcorrelators*p + 2*numcorrelators + 6;
+    int nsize = correlator->size_restart() + 6;
     int n=0;
     double *list;
     memory->create(list,nsize,"correlator:list");
@@ -758,22 +624,7 @@ void FixAveCorrelateLong::write_restart(FILE *fp) {
     list[n++]=m;
     list[n++]=nvalid;
     list[n++]=nvalid_last;
-    for (int i=0;i<npair;i++)
-      for (int j=0;j<numcorrelators;j++) {
-        for (int k=0;k<p;k++) {
-          list[n++]=shift[i][j][k];
-          list[n++]=shift2[i][j][k];
-          list[n++]=correlation[i][j][k];
-	  list[n++]=dcorrelation[i][j][k];
-        }
-        list[n++]=accumulator[i][j];
-        list[n++]=accumulator2[i][j];
-      }
-    for (int i=0;i<numcorrelators;i++) {
-      for (int j=0;j<p;j++) list[n++]=ncorrelation[i][j];
-      list[n++]=naccumulator[i];
-      list[n++]=insertindex[i];
-    }
+    n += correlator->pack_restart(&list[n]);
 
     int size = n*sizeof(double);
     fwrite(&size,sizeof(int),1,fp);
@@ -798,24 +649,6 @@ void FixAveCorrelateLong::restart(char *buf)
   nvalid_last = static_cast<int> (list[n++]);
 
   if ((npairin!=npair) || (numcorrelatorsin!=numcorrelators)
-      || (pin!=p) || (min!=m))
+      || (pin!=p) || (min!=m) || correlator->unpack_restart(&list[n]) < 0)
     error->all(FLERR,"Fix ave/correlate/long: restart and input data are different");
-
-  for (int i=0;i<npair;i++)
-    for (int j=0;j<numcorrelators;j++) {
-      for (int k=0;k<p;k++) {
-        shift[i][j][k] = list[n++];
-        shift2[i][j][k] = list[n++];
-        correlation[i][j][k] = list[n++];
-	dcorrelation[i][j][k] = list[n++];
-      }
-      accumulator[i][j] = list[n++];
-      accumulator2[i][j] = list[n++];
-    }
-  for (int i=0;i<numcorrelators;i++) {
-    for (int j=0;j<p;j++)
-      ncorrelation[i][j] = static_cast<unsigned long int>(list[n++]);
-    naccumulator[i] = static_cast<unsigned int> (list[n++]);
-    insertindex[i] = static_cast<unsigned int> (list[n++]);
-  }
 }
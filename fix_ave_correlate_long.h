@@ -22,6 +22,7 @@ FixStyle(ave/correlate/long,FixAveCorrelateLong)
 
 #include <stdio.h>
 #include "fix.h"
+#include "multi_tau.h"
 
 namespace LAMMPS_NS {
 
@@ -44,14 +45,8 @@ class FixAveCorrelateLong : public Fix {
   unsigned int npcorr;
 
  private:
-  // NOT OPTIMAL: shift2 and accumulator2 only needed in cross-correlations
-  double ***shift, *** shift2;
-  double ***correlation;
-  double ***dcorrelation;
-  double **accumulator, **accumulator2;
-  unsigned long int **ncorrelation;
-  unsigned int *naccumulator;
-  unsigned int *insertindex;
+  // one channel per pair, B channels only stored for cross-correlations
+  MultiTau<double> *correlator;
 
   unsigned int numcorrelators; // Recommended 20
   unsigned int p; // Points per correlator (recommended 16)
@@ -59,7 +54,6 @@ class FixAveCorrelateLong : public Fix {
   unsigned int dmin; // Min distance between ponts for correlators k>0; dmin=p/m
 
   unsigned int length; // Length of result arrays
-  unsigned int kmax; // Maximum correlator attained during simulation
 
   int me,nvalues;
   int nfreq;
@@ -73,6 +67,7 @@ class FixAveCorrelateLong : public Fix {
 
   int npair;           // number of correlation pairs to calculate
   double *values;
+  double *valA,*valB;  // pair values handed to the correlator
   
   int bins;
   double rmin,rmax;
@@ -80,10 +75,6 @@ class FixAveCorrelateLong : public Fix {
   void accumulate();
   void evaluate();
   bigint nextvalid();
-
-  void add(const int i, const double w, const unsigned int k = 0);
-  void add(const int i, const double wA, const double wB, const unsigned int k = 0);
-
 };
 
 }
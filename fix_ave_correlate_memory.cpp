@@ -0,0 +1,443 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* Incremental estimator for the velocity/force correlations needed by
+ * compute memory/volterra. Only the 18 correlations entering the Volterra
+ * equation are accumulated. Every new sample is correlated with the stored
+ * history immediately, so the running sums are valid at any timestep and
+ * can be reduced on demand without replaying the ring buffer. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "fix_ave_correlate_memory.h"
+#include "update.h"
+#include "group.h"
+#include "memory.h"
+#include "error.h"
+#include "force.h"
+#include "atom.h"
+#include "comm.h"
+
+using namespace LAMMPS_NS;
+using namespace FixConst;
+
+enum{PERATOM,GROUP};
+
+// (older sample, latest sample) for every accumulated correlation
+// sample order is vx,vy,vz,fx,fy,fz; triplets are vv, vf, ff of the
+// tensor components xx,xy,xz,yy,yz,zz
+
+static const int corr_pair[18][2] = {
+  {0,0},{0,3},{3,3}, {0,1},{0,4},{3,4}, {0,2},{0,5},{3,5},
+  {1,1},{1,4},{4,4}, {1,2},{1,5},{4,5}, {2,2},{2,5},{5,5}};
+
+/* ---------------------------------------------------------------------- */
+
+FixAveCorrelateMemory::FixAveCorrelateMemory(LAMMPS * lmp, int narg, char **arg):
+  Fix (lmp, narg, arg)
+{
+  if (narg < 5) error->all(FLERR,"Illegal fix ave/correlate/memory command");
+
+  MPI_Comm_rank(world,&me);
+  MPI_Comm_size(world,&nprocs);
+
+  nevery = force->inumeric(FLERR,arg[3]);
+  nrepeat = force->inumeric(FLERR,arg[4]);
+
+  global_freq = nevery;
+  restart_global = 0;
+
+  // optional args
+
+  memory_switch = PERATOM;
+  startstep = 0;
+  ngroup_glo = 0;
+  cor_groupbit = NULL;
+
+  int iarg = 5;
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"switch") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix ave/correlate/memory command");
+      if (strcmp(arg[iarg+1],"peratom") == 0) {
+        memory_switch = PERATOM;
+        iarg += 2;
+      } else if (strcmp(arg[iarg+1],"group") == 0) {
+        memory_switch = GROUP;
+        if (iarg+3 > narg) error->all(FLERR,"Illegal fix ave/correlate/memory command");
+        ngroup_glo = force->inumeric(FLERR,arg[iarg+2]);
+        if (ngroup_glo <= 0 || iarg+3+ngroup_glo > narg)
+          error->all(FLERR,"Illegal fix ave/correlate/memory command");
+        cor_groupbit = new int[ngroup_glo];
+        for (int i = 0; i < ngroup_glo; i++) {
+          int jgroup = group->find(arg[iarg+3+i]);
+          if (jgroup == -1)
+            error->all(FLERR,"Could not find fix ave/correlate/memory group ID");
+          cor_groupbit[i] = group->bitmask[jgroup];
+        }
+        iarg += 3 + ngroup_glo;
+      } else error->all(FLERR,"Illegal fix ave/correlate/memory command");
+    } else if (strcmp(arg[iarg],"start") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix ave/correlate/memory command");
+      startstep = force->inumeric(FLERR,arg[iarg+1]);
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"restart") == 0) {
+      restart_global = 1;
+      iarg += 1;
+    } else error->all(FLERR,"Illegal fix ave/correlate/memory command");
+  }
+
+  if (nevery <= 0 || nrepeat <= 0)
+    error->all(FLERR,"Illegal fix ave/correlate/memory command");
+
+  nsave = nrepeat;
+
+  // allocate and zero the running sums
+
+  memory->create(local_count,nrepeat,"ave/correlate/memory:local_count");
+  memory->create(local_corr,nrepeat,NCORR,"ave/correlate/memory:local_corr");
+  for (int i = 0; i < nrepeat; i++) {
+    local_count[i] = 0.0;
+    for (int j = 0; j < NCORR; j++) local_corr[i][j] = 0.0;
+  }
+
+  // history of the sampled values
+  // per-atom rows migrate with the atoms, group rows are replicated
+  // atoms created later start with an empty history, see set_arrays()
+
+  store = NULL;
+  group_mass = NULL;
+  group_store = group_data_loc = group_data = NULL;
+
+  if (memory_switch == PERATOM) {
+    maxexchange = 6*nsave;
+    grow_arrays(atom->nmax);
+    atom->add_callback(0);
+    create_attribute = 1;
+    for (int i = 0; i < atom->nlocal; i++)
+      for (int k = 0; k < 6*nsave; k++) store[i][k] = 0.0;
+  } else {
+    memory->create(group_store,ngroup_glo,6*nsave,"ave/correlate/memory:group_store");
+    memory->create(group_data_loc,ngroup_glo,6,"ave/correlate/memory:group_data_loc");
+    memory->create(group_data,ngroup_glo,6,"ave/correlate/memory:group_data");
+    memory->create(group_mass,ngroup_glo,"ave/correlate/memory:group_mass");
+
+    int *mask = atom->mask;
+    int *type = atom->type;
+    double *mass = atom->mass;
+    double *rmass = atom->rmass;
+    double *group_mass_loc = new double[ngroup_glo];
+    for (int j = 0; j < ngroup_glo; j++) group_mass_loc[j] = 0.0;
+    for (int i = 0; i < atom->nlocal; i++)
+      for (int j = 0; j < ngroup_glo; j++)
+        if (mask[i] & cor_groupbit[j])
+          group_mass_loc[j] += rmass ? rmass[i] : mass[type[i]];
+    MPI_Allreduce(group_mass_loc,group_mass,ngroup_glo,MPI_DOUBLE,MPI_SUM,world);
+    delete [] group_mass_loc;
+
+    for (int j = 0; j < ngroup_glo; j++) {
+      if (group_mass[j] == 0.0)
+        error->all(FLERR,"Fix ave/correlate/memory group has no atoms");
+      for (int k = 0; k < 6*nsave; k++) group_store[j][k] = 0.0;
+    }
+  }
+
+  // nvalid = next step on which end_of_step does something
+
+  lastindex = -1;
+  nsample = 0;
+  nvalid = nextvalid();
+}
+
+/* ---------------------------------------------------------------------- */
+
+FixAveCorrelateMemory::~FixAveCorrelateMemory()
+{
+  if (memory_switch == PERATOM) atom->delete_callback(id,0);
+
+  delete [] cor_groupbit;
+  memory->destroy(store);
+  memory->destroy(group_store);
+  memory->destroy(group_data_loc);
+  memory->destroy(group_data);
+  memory->destroy(group_mass);
+  memory->destroy(local_count);
+  memory->destroy(local_corr);
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixAveCorrelateMemory::setmask()
+{
+  int mask = 0;
+  mask |= END_OF_STEP;
+  return mask;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixAveCorrelateMemory::init()
+{
+  // need to reset nvalid if nvalid < ntimestep b/c minimize was performed
+  // the history is discarded, the running sums are kept
+
+  if (nvalid < update->ntimestep) {
+    lastindex = -1;
+    nsample = 0;
+    nvalid = nextvalid();
+  }
+}
+
+/* ----------------------------------------------------------------------
+   only does something if nvalid = current timestep
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemory::setup(int vflag)
+{
+  end_of_step();
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixAveCorrelateMemory::end_of_step()
+{
+  int i,j,c;
+
+  // skip if not step which requires doing something
+
+  bigint ntimestep = update->ntimestep;
+  if (ntimestep != nvalid) return;
+
+  double **v = atom->v;
+  double **f = atom->f;
+  int *mask = atom->mask;
+  int *type = atom->type;
+  double *mass = atom->mass;
+  double *rmass = atom->rmass;
+  int nlocal = atom->nlocal;
+
+  lastindex++;
+  if (lastindex == nsave) lastindex = 0;
+  if (nsample < nsave) nsample++;
+
+  if (memory_switch == PERATOM) {
+    for (i = 0; i < nlocal; i++) {
+      if (!(mask[i] & groupbit)) continue;
+      double *row = store[i];
+      row[lastindex] = v[i][0];
+      row[nsave+lastindex] = v[i][1];
+      row[2*nsave+lastindex] = v[i][2];
+      row[3*nsave+lastindex] = f[i][0];
+      row[4*nsave+lastindex] = f[i][1];
+      row[5*nsave+lastindex] = f[i][2];
+      accumulate_one(row);
+    }
+  } else {
+
+    // center-of-mass velocity and total force of each group,
+    // one packed reduction for all groups
+
+    for (j = 0; j < ngroup_glo; j++)
+      for (c = 0; c < 6; c++) group_data_loc[j][c] = 0.0;
+
+    for (i = 0; i < nlocal; i++) {
+      double massone = rmass ? rmass[i] : mass[type[i]];
+      for (j = 0; j < ngroup_glo; j++) {
+        if (!(mask[i] & cor_groupbit[j])) continue;
+        group_data_loc[j][0] += massone*v[i][0];
+        group_data_loc[j][1] += massone*v[i][1];
+        group_data_loc[j][2] += massone*v[i][2];
+        group_data_loc[j][3] += f[i][0];
+        group_data_loc[j][4] += f[i][1];
+        group_data_loc[j][5] += f[i][2];
+      }
+    }
+    MPI_Allreduce(&group_data_loc[0][0],&group_data[0][0],6*ngroup_glo,
+                  MPI_DOUBLE,MPI_SUM,world);
+
+    // every rank keeps the full history, groups are correlated round-robin
+
+    for (j = 0; j < ngroup_glo; j++) {
+      double massinv = 1.0/group_mass[j];
+      for (c = 0; c < 3; c++)
+        group_store[j][c*nsave+lastindex] = group_data[j][c]*massinv;
+      for (c = 3; c < 6; c++)
+        group_store[j][c*nsave+lastindex] = group_data[j][c];
+      if (j % nprocs == me) accumulate_one(group_store[j]);
+    }
+  }
+
+  nvalid += nevery;
+}
+
+/* ----------------------------------------------------------------------
+   correlate the latest sample of one history row with all stored samples
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemory::accumulate_one(double *row)
+{
+  int c,k,p;
+  double latest[6];
+
+  for (c = 0; c < 6; c++) latest[c] = row[c*nsave+lastindex];
+
+  int m = lastindex;
+  for (k = 0; k < nsample; k++) {
+    double *corr = local_corr[k];
+    for (p = 0; p < NCORR; p++)
+      corr[p] += row[corr_pair[p][0]*nsave+m]*latest[corr_pair[p][1]];
+    local_count[k] += 1.0;
+    m--;
+    if (m < 0) m = nsave-1;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   sum running correlations over all procs into count and corr
+   corr has to be allocated as nrepeat x NCORR
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemory::reduce_correlation(double *count, double **corr)
+{
+  MPI_Allreduce(local_count,count,nrepeat,MPI_DOUBLE,MPI_SUM,world);
+  MPI_Allreduce(&local_corr[0][0],&corr[0][0],nrepeat*NCORR,
+                MPI_DOUBLE,MPI_SUM,world);
+}
+
+/* ----------------------------------------------------------------------
+   nvalid = next step on which end_of_step does something
+   this step if multiple of nevery, else next multiple
+   startstep is lower bound
+------------------------------------------------------------------------- */
+
+bigint FixAveCorrelateMemory::nextvalid()
+{
+  bigint nvalid = update->ntimestep;
+  if (startstep > nvalid) nvalid = startstep;
+  if (nvalid % nevery) nvalid = (nvalid/nevery)*nevery + nevery;
+  return nvalid;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixAveCorrelateMemory::reset_timestep(bigint ntimestep)
+{
+  if (ntimestep > nvalid) error->all(FLERR,"Fix ave/correlate/memory missed timestep");
+}
+
+/* ----------------------------------------------------------------------
+   memory usage of history and running sums
+------------------------------------------------------------------------- */
+
+double FixAveCorrelateMemory::memory_usage()
+{
+  double bytes = nrepeat*(NCORR+1) * sizeof(double);
+  if (memory_switch == PERATOM) bytes += atom->nmax * 6*nsave * sizeof(double);
+  else bytes += ngroup_glo * (6*nsave+13) * sizeof(double);
+  return bytes;
+}
+
+/* ----------------------------------------------------------------------
+   allocate atom-based array
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemory::grow_arrays(int nmax)
+{
+  memory->grow(store,nmax,6*nsave,"ave/correlate/memory:store");
+}
+
+/* ----------------------------------------------------------------------
+   copy values within local atom-based array
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemory::copy_arrays(int i, int j, int delflag)
+{
+  memcpy(store[j],store[i],6*nsave*sizeof(double));
+}
+
+/* ----------------------------------------------------------------------
+   zero the history of a newly created atom
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemory::set_arrays(int i)
+{
+  for (int k = 0; k < 6*nsave; k++) store[i][k] = 0.0;
+}
+
+/* ----------------------------------------------------------------------
+   pack values in local atom-based array for exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixAveCorrelateMemory::pack_exchange(int i, double *buf)
+{
+  for (int k = 0; k < 6*nsave; k++) buf[k] = store[i][k];
+  return 6*nsave;
+}
+
+/* ----------------------------------------------------------------------
+   unpack values in local atom-based array from exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixAveCorrelateMemory::unpack_exchange(int nlocal, double *buf)
+{
+  for (int k = 0; k < 6*nsave; k++) store[nlocal][k] = buf[k];
+  return 6*nsave;
+}
+
+/* ----------------------------------------------------------------------
+   write data into restart file:
+   - running correlation sums, reduced to proc 0
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemory::write_restart(FILE *fp)
+{
+  double *count;
+  double **corr;
+  memory->create(count,nrepeat,"ave/correlate/memory:count");
+  memory->create(corr,nrepeat,NCORR,"ave/correlate/memory:corr");
+  reduce_correlation(count,corr);
+
+  if (me == 0) {
+    int n = nrepeat*(NCORR+1) + 1;
+    int size = n * sizeof(double);
+    double nrepeat_d = nrepeat;
+    fwrite(&size,sizeof(int),1,fp);
+    fwrite(&nrepeat_d,sizeof(double),1,fp);
+    fwrite(count,sizeof(double),nrepeat,fp);
+    fwrite(&corr[0][0],sizeof(double),nrepeat*NCORR,fp);
+  }
+
+  memory->destroy(count);
+  memory->destroy(corr);
+}
+
+/* ----------------------------------------------------------------------
+   read data from restart file:
+   - running correlation sums, only proc 0 keeps them so that the
+     next reduction does not count them nprocs times
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemory::restart(char *buf)
+{
+  double *dbuf = (double *) buf;
+  int dcount = 0;
+  int i,j;
+
+  int nrepeat_restart = static_cast<int> (dbuf[dcount++]);
+  if (nrepeat_restart != nrepeat)
+    error->all(FLERR,"Fix ave/correlate/memory Nrepeat changed since restart");
+  if (me != 0) return;
+
+  for (i = 0; i < nrepeat; i++) local_count[i] = dbuf[dcount++];
+  for (i = 0; i < nrepeat; i++)
+    for (j = 0; j < NCORR; j++) local_corr[i][j] = dbuf[dcount++];
+}
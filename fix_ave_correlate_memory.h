@@ -0,0 +1,110 @@
+/* -*- c++ -*- ----------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+#ifdef FIX_CLASS
+
+FixStyle(ave/correlate/memory,FixAveCorrelateMemory)
+
+#else
+
+#ifndef LMP_FIX_AVE_CORRELATE_MEMORY_H
+#define LMP_FIX_AVE_CORRELATE_MEMORY_H
+
+#include <stdio.h>
+#include "fix.h"
+
+namespace LAMMPS_NS {
+
+class FixAveCorrelateMemory : public Fix {
+ public:
+  FixAveCorrelateMemory(class LAMMPS *, int, char **);
+  ~FixAveCorrelateMemory();
+  int setmask();
+  void init();
+  void setup(int);
+  void end_of_step();
+  void reset_timestep(bigint);
+  double memory_usage();
+
+  void grow_arrays(int);
+  void copy_arrays(int, int, int);
+  void set_arrays(int);
+  int pack_exchange(int, double *);
+  int unpack_exchange(int, double *);
+
+  void write_restart(FILE *);
+  void restart(char *);
+
+  // number of velocity/force correlations accumulated per time lag
+  // (vv, vf, ff for each of the 6 components of the symmetric tensor)
+  static const int NCORR = 18;
+  void reduce_correlation(double *, double **);
+
+ private:
+  int me,nprocs;
+  int nrepeat,nsave;
+  bigint nvalid;
+  int startstep;
+  int memory_switch;
+
+  int lastindex;       // index in ring buffer of latest time sample
+  int nsample;         // number of time samples in ring buffer
+
+  double **store;      // per-atom ring buffer: vx,vy,vz,fx,fy,fz x nsave
+
+  // for switch group
+  int ngroup_glo;
+  int *cor_groupbit;
+  double *group_mass;
+  double **group_store;
+  double **group_data_loc,**group_data;
+
+  double *local_count;
+  double **local_corr;
+
+  void accumulate_one(double *);
+  bigint nextvalid();
+};
+
+}
+
+#endif
+#endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal ... command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.  You can use -echo screen as a
+command-line option when running LAMMPS to see the offending line.
+
+E: Could not find fix ave/correlate/memory group ID
+
+A group ID used in the switch group option does not exist.
+
+E: Fix ave/correlate/memory group has no atoms
+
+The center-of-mass velocity of an empty group is undefined.
+
+E: Fix ave/correlate/memory Nrepeat changed since restart
+
+The running correlation sums in the restart file were accumulated
+with a different number of time lags.
+
+E: Fix ave/correlate/memory missed timestep
+
+You cannot reset the timestep to a value beyond where the fix
+expects to next perform averaging.
+
+*/
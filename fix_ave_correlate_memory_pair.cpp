@@ -0,0 +1,389 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* Incremental estimator for the distance-resolved velocity/force
+ * correlations needed by compute memory/volterra/pair. As for the
+ * distance dependence of fix ave/correlate/peratom, the group data is
+ * gathered on every proc (switch pergroup), pairs are binned by their
+ * distance at the latest sample and all stored samples are projected on
+ * the latest pair axis, which is the projection used by fix gle/pair.
+ *
+ * The latest sample is the time origin of the sum. Time-reversal
+ * symmetry of equilibrium dynamics turns this into correlations
+ * conditioned on the distance at t = 0; for the force/velocity
+ * correlation this flips the sign, C_FV(t) = -<F(-t) V(0)>. */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "fix_ave_correlate_memory_pair.h"
+#include "update.h"
+#include "group.h"
+#include "domain.h"
+#include "memory.h"
+#include "error.h"
+#include "force.h"
+#include "atom.h"
+#include "comm.h"
+
+using namespace LAMMPS_NS;
+using namespace FixConst;
+
+/* ---------------------------------------------------------------------- */
+
+FixAveCorrelateMemoryPair::FixAveCorrelateMemoryPair(LAMMPS * lmp, int narg, char **arg):
+  Fix (lmp, narg, arg)
+{
+  if (narg < 8) error->all(FLERR,"Illegal fix ave/correlate/memory/pair command");
+
+  MPI_Comm_rank(world,&me);
+  MPI_Comm_size(world,&nprocs);
+
+  nevery = force->inumeric(FLERR,arg[3]);
+  nrepeat = force->inumeric(FLERR,arg[4]);
+  dstart = force->numeric(FLERR,arg[5]);
+  dstep = force->numeric(FLERR,arg[6]);
+  dstop = force->numeric(FLERR,arg[7]);
+
+  global_freq = nevery;
+  restart_global = 0;
+  startstep = 0;
+
+  int iarg = 8;
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"start") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix ave/correlate/memory/pair command");
+      startstep = force->inumeric(FLERR,arg[iarg+1]);
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"restart") == 0) {
+      restart_global = 1;
+      iarg += 1;
+    } else error->all(FLERR,"Illegal fix ave/correlate/memory/pair command");
+  }
+
+  if (nevery <= 0 || nrepeat <= 0)
+    error->all(FLERR,"Illegal fix ave/correlate/memory/pair command");
+  if (dstart < 0.0 || dstep <= 0.0 || dstop < dstart)
+    error->all(FLERR,"Illegal fix ave/correlate/memory/pair command");
+
+  // same bin count as the kernel tables of fix gle/pair
+
+  nbin = static_cast<int> ((dstop - dstart) / dstep + 1.5);
+  nsave = nrepeat;
+  nsum = NSELF*nrepeat + NPAIR*nbin*nrepeat;
+
+  memory->create(local_sum,nsum,"ave/correlate/memory/pair:local_sum");
+  for (int i = 0; i < nsum; i++) local_sum[i] = 0.0;
+
+  // sorted tags of the group members define the global index
+
+  bigint ncount = group->count(igroup);
+  if (ncount == 0) error->all(FLERR,"Fix ave/correlate/memory/pair group has no atoms");
+  if (ncount > MAXSMALLINT) error->all(FLERR,"Too many atoms for fix ave/correlate/memory/pair");
+  ngroup_glo = static_cast<int> (ncount);
+
+  int *mask = atom->mask;
+  tagint *tag = atom->tag;
+  int nlocal = atom->nlocal;
+  int ngroup_loc = 0, ngroup_scan = 0;
+  for (int i = 0; i < nlocal; i++)
+    if (mask[i] & groupbit) ngroup_loc++;
+  MPI_Exscan(&ngroup_loc,&ngroup_scan,1,MPI_INT,MPI_SUM,world);
+
+  tagint *group_ids_loc;
+  memory->create(group_ids,ngroup_glo,"ave/correlate/memory/pair:group_ids");
+  memory->create(group_ids_loc,ngroup_glo,"ave/correlate/memory/pair:group_ids_loc");
+  for (int a = 0; a < ngroup_glo; a++) group_ids_loc[a] = 0;
+  for (int i = 0; i < nlocal; i++)
+    if (mask[i] & groupbit) group_ids_loc[ngroup_scan++] = tag[i];
+  MPI_Allreduce(group_ids_loc,group_ids,ngroup_glo,MPI_LMP_TAGINT,MPI_SUM,world);
+  memory->destroy(group_ids_loc);
+  std::sort(group_ids,group_ids+ngroup_glo);
+
+  memory->create(sample_loc,ngroup_glo,9,"ave/correlate/memory/pair:sample_loc");
+  memory->create(sample,ngroup_glo,9,"ave/correlate/memory/pair:sample");
+  memory->create(history,ngroup_glo,6*nsave,"ave/correlate/memory/pair:history");
+
+  lastindex = -1;
+  nsample = 0;
+  nvalid = nextvalid();
+}
+
+/* ---------------------------------------------------------------------- */
+
+FixAveCorrelateMemoryPair::~FixAveCorrelateMemoryPair()
+{
+  memory->destroy(local_sum);
+  memory->destroy(group_ids);
+  memory->destroy(sample_loc);
+  memory->destroy(sample);
+  memory->destroy(history);
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixAveCorrelateMemoryPair::setmask()
+{
+  int mask = 0;
+  mask |= END_OF_STEP;
+  return mask;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixAveCorrelateMemoryPair::init()
+{
+  // need to reset nvalid if nvalid < ntimestep b/c minimize was performed
+
+  if (nvalid < update->ntimestep) {
+    lastindex = -1;
+    nsample = 0;
+    nvalid = nextvalid();
+  }
+}
+
+/* ----------------------------------------------------------------------
+   only does something if nvalid = current timestep
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemoryPair::setup(int vflag)
+{
+  end_of_step();
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixAveCorrelateMemoryPair::end_of_step()
+{
+  int a,c;
+
+  bigint ntimestep = update->ntimestep;
+  if (ntimestep != nvalid) return;
+
+  double **x = atom->x;
+  double **v = atom->v;
+  double **f = atom->f;
+  int *mask = atom->mask;
+  tagint *tag = atom->tag;
+  int nlocal = atom->nlocal;
+
+  // gather x,v,f of all group members
+
+  for (a = 0; a < ngroup_glo; a++)
+    for (c = 0; c < 9; c++) sample_loc[a][c] = 0.0;
+
+  for (int i = 0; i < nlocal; i++) {
+    if (!(mask[i] & groupbit)) continue;
+    a = group_index(tag[i]);
+    for (c = 0; c < 3; c++) {
+      sample_loc[a][c] = x[i][c];
+      sample_loc[a][3+c] = v[i][c];
+      sample_loc[a][6+c] = f[i][c];
+    }
+  }
+  MPI_Allreduce(&sample_loc[0][0],&sample[0][0],9*ngroup_glo,MPI_DOUBLE,MPI_SUM,world);
+
+  lastindex++;
+  if (lastindex == nsave) lastindex = 0;
+  if (nsample < nsave) nsample++;
+
+  for (a = 0; a < ngroup_glo; a++)
+    for (c = 0; c < 6; c++) history[a][c*nsave+lastindex] = sample[a][3+c];
+
+  accumulate();
+
+  nvalid += nevery;
+}
+
+/* ----------------------------------------------------------------------
+   correlate the latest sample with all stored samples
+   members are distributed round-robin over the procs, every pair is
+   handled by the proc owning its lower index
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemoryPair::accumulate()
+{
+  int a,b,c,k,m;
+  const int n = lastindex;
+  // bins l = 0..nbin-1 cover [dstart, dstart+nbin*dstep), the last one
+  // starts at dstop, matching the rows of the fix gle/pair kernel table
+  const double dmax = dstart + nbin*dstep;
+  const double dmax2 = dmax*dmax;
+  const double dstepinv = 1.0/dstep;
+
+  for (a = me; a < ngroup_glo; a += nprocs) {
+    const double *ha = history[a];
+
+    // single-particle correlation, averaged over the three components
+
+    m = n;
+    for (k = 0; k < nsample; k++) {
+      double *sum = &local_sum[self_offset(k)];
+      double vv = 0.0, fv = 0.0, ff = 0.0;
+      for (c = 0; c < 3; c++) {
+        vv += ha[c*nsave+m]*ha[c*nsave+n];
+        fv -= ha[(3+c)*nsave+m]*ha[c*nsave+n];
+        ff += ha[(3+c)*nsave+m]*ha[(3+c)*nsave+n];
+      }
+      sum[0] += 3.0;
+      sum[1] += vv;
+      sum[2] += fv;
+      sum[3] += ff;
+      m--;
+      if (m < 0) m = nsave-1;
+    }
+
+    // pair correlations parallel to the current pair axis
+
+    for (b = a+1; b < ngroup_glo; b++) {
+      double e[3];
+      e[0] = sample[a][0] - sample[b][0];
+      e[1] = sample[a][1] - sample[b][1];
+      e[2] = sample[a][2] - sample[b][2];
+      domain->minimum_image(e[0],e[1],e[2]);
+      double rsq = e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
+      if (rsq >= dmax2) continue;
+      double r = sqrt(rsq);
+      int l = static_cast<int> ((r - dstart)*dstepinv);
+      if (l < 0 || l >= nbin) continue;
+      double rinv = 1.0/r;
+      e[0] *= rinv;
+      e[1] *= rinv;
+      e[2] *= rinv;
+
+      const double *hb = history[b];
+      double va_n = 0.0, vb_n = 0.0, fa_n = 0.0, fb_n = 0.0;
+      for (c = 0; c < 3; c++) {
+        va_n += e[c]*ha[c*nsave+n];
+        vb_n += e[c]*hb[c*nsave+n];
+        fa_n += e[c]*ha[(3+c)*nsave+n];
+        fb_n += e[c]*hb[(3+c)*nsave+n];
+      }
+
+      m = n;
+      for (k = 0; k < nsample; k++) {
+        double *sum = &local_sum[pair_offset(l,k)];
+        double va_m = 0.0, vb_m = 0.0, fa_m = 0.0, fb_m = 0.0;
+        for (c = 0; c < 3; c++) {
+          va_m += e[c]*ha[c*nsave+m];
+          vb_m += e[c]*hb[c*nsave+m];
+          fa_m += e[c]*ha[(3+c)*nsave+m];
+          fb_m += e[c]*hb[(3+c)*nsave+m];
+        }
+        // both orderings of the pair, so the 2x2 matrices are symmetric
+        sum[0] += 2.0;
+        sum[1] += va_m*va_n + vb_m*vb_n;
+        sum[2] += va_m*vb_n + vb_m*va_n;
+        sum[3] -= fa_m*va_n + fb_m*vb_n;
+        sum[4] -= fa_m*vb_n + fb_m*va_n;
+        sum[5] += fa_m*fa_n + fb_m*fb_n;
+        sum[6] += fa_m*fb_n + fb_m*fa_n;
+        m--;
+        if (m < 0) m = nsave-1;
+      }
+    }
+  }
+}
+
+/* ----------------------------------------------------------------------
+   sum running correlations over all procs into buf of length nsum
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemoryPair::reduce_correlation(double *buf)
+{
+  MPI_Allreduce(local_sum,buf,nsum,MPI_DOUBLE,MPI_SUM,world);
+}
+
+/* ----------------------------------------------------------------------
+   index of an atom in the sorted list of group members
+------------------------------------------------------------------------- */
+
+int FixAveCorrelateMemoryPair::group_index(tagint itag)
+{
+  tagint *ptr = std::lower_bound(group_ids,group_ids+ngroup_glo,itag);
+  return ptr - group_ids;
+}
+
+/* ----------------------------------------------------------------------
+   nvalid = next step on which end_of_step does something
+   this step if multiple of nevery, else next multiple
+   startstep is lower bound
+------------------------------------------------------------------------- */
+
+bigint FixAveCorrelateMemoryPair::nextvalid()
+{
+  bigint nvalid = update->ntimestep;
+  if (startstep > nvalid) nvalid = startstep;
+  if (nvalid % nevery) nvalid = (nvalid/nevery)*nevery + nevery;
+  return nvalid;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixAveCorrelateMemoryPair::reset_timestep(bigint ntimestep)
+{
+  if (ntimestep > nvalid) error->all(FLERR,"Fix ave/correlate/memory/pair missed timestep");
+}
+
+/* ----------------------------------------------------------------------
+   memory usage of replicated group history and running sums
+------------------------------------------------------------------------- */
+
+double FixAveCorrelateMemoryPair::memory_usage()
+{
+  double bytes = nsum * sizeof(double);
+  bytes += ngroup_glo * (6*nsave+18) * sizeof(double);
+  bytes += ngroup_glo * sizeof(tagint);
+  return bytes;
+}
+
+/* ----------------------------------------------------------------------
+   write data into restart file:
+   - running correlation sums, reduced to proc 0
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemoryPair::write_restart(FILE *fp)
+{
+  double *buf;
+  memory->create(buf,nsum,"ave/correlate/memory/pair:buf");
+  reduce_correlation(buf);
+
+  if (me == 0) {
+    int size = (nsum+2) * sizeof(double);
+    double list[2];
+    list[0] = nrepeat;
+    list[1] = nbin;
+    fwrite(&size,sizeof(int),1,fp);
+    fwrite(list,sizeof(double),2,fp);
+    fwrite(buf,sizeof(double),nsum,fp);
+  }
+
+  memory->destroy(buf);
+}
+
+/* ----------------------------------------------------------------------
+   read data from restart file:
+   - running correlation sums, only proc 0 keeps them
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateMemoryPair::restart(char *buf)
+{
+  double *dbuf = (double *) buf;
+
+  if (static_cast<int> (dbuf[0]) != nrepeat || static_cast<int> (dbuf[1]) != nbin)
+    error->all(FLERR,"Fix ave/correlate/memory/pair binning changed since restart");
+  if (me != 0) return;
+
+  for (int i = 0; i < nsum; i++) local_sum[i] = dbuf[2+i];
+}
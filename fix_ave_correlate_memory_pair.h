@@ -0,0 +1,108 @@
+/* -*- c++ -*- ----------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+#ifdef FIX_CLASS
+
+FixStyle(ave/correlate/memory/pair,FixAveCorrelateMemoryPair)
+
+#else
+
+#ifndef LMP_FIX_AVE_CORRELATE_MEMORY_PAIR_H
+#define LMP_FIX_AVE_CORRELATE_MEMORY_PAIR_H
+
+#include <stdio.h>
+#include "fix.h"
+
+namespace LAMMPS_NS {
+
+class FixAveCorrelateMemoryPair : public Fix {
+ public:
+  FixAveCorrelateMemoryPair(class LAMMPS *, int, char **);
+  ~FixAveCorrelateMemoryPair();
+  int setmask();
+  void init();
+  void setup(int);
+  void end_of_step();
+  void reset_timestep(bigint);
+  double memory_usage();
+
+  void write_restart(FILE *);
+  void restart(char *);
+
+  // layout of the running sums
+  // self part:  per lag [count, vv, fv, ff]
+  // pair part:  per bin and lag [count, vv_s, vv_c, fv_s, fv_c, ff_s, ff_c]
+  //             _s = same particle, _c = partner, both projected on the pair axis
+  static const int NSELF = 4;
+  static const int NPAIR = 7;
+  int nrepeat,nbin;
+  double dstart,dstep,dstop;
+  int nsum;
+  void reduce_correlation(double *);
+  int self_offset(int k) { return NSELF*k; }
+  int pair_offset(int l, int k) { return NSELF*nrepeat + NPAIR*(l*nrepeat+k); }
+
+ private:
+  int me,nprocs;
+  int nsave;
+  bigint nvalid;
+  int startstep;
+
+  int lastindex;       // index in ring buffer of latest time sample
+  int nsample;         // number of time samples in ring buffer
+
+  int ngroup_glo;
+  tagint *group_ids;   // sorted tags of the group members
+  double **sample_loc,**sample;
+  double **history;    // per member ring buffer: vx,vy,vz,fx,fy,fz x nsave
+
+  double *local_sum;
+
+  void accumulate();
+  int group_index(tagint);
+  bigint nextvalid();
+};
+
+}
+
+#endif
+#endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal ... command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.  You can use -echo screen as a
+command-line option when running LAMMPS to see the offending line.
+
+E: Fix ave/correlate/memory/pair group has no atoms
+
+Self-explanatory.
+
+E: Too many atoms for fix ave/correlate/memory/pair
+
+The group data is replicated on every proc and indexed by a
+32-bit integer.
+
+E: Fix ave/correlate/memory/pair binning changed since restart
+
+The running correlation sums in the restart file were accumulated
+with a different number of time lags or distance bins.
+
+E: Fix ave/correlate/memory/pair missed timestep
+
+You cannot reset the timestep to a value beyond where the fix
+expects to next perform averaging.
+
+*/
@@ -33,18 +33,16 @@
 #include "comm.h"
 #include "input.h"
 #include "variable.h"
-#include "random_correlater.h"
+#include "random_correlator.h"
 #include "random_mars.h"
 #include "memory.h"
 #include "error.h"
 #include "group.h"
+#include "thr_omp.h"
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
 
-enum{NOBIAS,BIAS};
-enum{CONSTANT,EQUAL,ATOM};
-
 /* ---------------------------------------------------------------------- */
 
 FixBrownian::FixBrownian(LAMMPS *lmp, int narg, char **arg) :
@@ -56,8 +54,7 @@ FixBrownian::FixBrownian(LAMMPS *lmp, int narg, char **arg) :
   
   global_freq = 1;
   nevery = 1;
-  peratom_freq = 1;
-  peratom_flag = 1;
+  time_integrate = 1;
   
   // read input parameter
   D = force->numeric(FLERR,arg[3]);
@@ -66,21 +63,64 @@ FixBrownian::FixBrownian(LAMMPS *lmp, int narg, char **arg) :
   
   seed = force->inumeric(FLERR,arg[5]);
   
-  // optional parameter
-  
+  if (D <= 0.0 || temp <= 0.0) error->all(FLERR,"Illegal fix brownian command");
   if (seed <= 0) error->all(FLERR,"Illegal fix brownian command");
-  
-  // initialize correlated RNG with processor-unique seed
-  random = new RanMars(lmp,seed + comm->me);
 
+  // optional parameter
+  // kernel file N = colored noise with the first N points of the kernel
+
+  colored = 0;
+  mem_count = nhist = 0;
+  mem_kernel = NULL;
+  random_correlator = NULL;
+  history = NULL;
+
+  int iarg = 6;
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"kernel") == 0) {
+      if (iarg+3 > narg) error->all(FLERR,"Illegal fix brownian command");
+      colored = 1;
+      mem_count = force->inumeric(FLERR,arg[iarg+2]);
+      if (mem_count < 6)
+        error->all(FLERR,"Fix brownian kernel needs at least 6 points");
+      read_mem_file(arg[iarg+1]);
+      iarg += 3;
+    } else error->all(FLERR,"Illegal fix brownian command");
+  }
+  
+  // initialize RNGs with processor- and thread-unique seeds
+  random = NULL;
+  nrandom = 0;
+  create_random();
+
+  // correlated noise of unit variance, the kernel sets only its shape
+  if (colored) {
+    double norm = mem_kernel[0];
+    for (int i = 0; i < mem_count; i++) mem_kernel[i] /= norm;
+    random_correlator = new RanCor(lmp,mem_count,mem_kernel,0.000002);
+
+    nhist = 2*mem_count-1;
+    firstindex = 0;
+    maxexchange = 3*nhist;
+    grow_arrays(atom->nmax);
+    atom->add_callback(0);
+  }
+  first = 1;
 }
 
 /* ---------------------------------------------------------------------- */
 
 FixBrownian::~FixBrownian()
 {
-
-
+  for (int tid = 0; tid < nrandom; tid++) delete random[tid];
+  delete [] random;
+
+  if (colored) {
+    atom->delete_callback(id,0);
+    delete random_correlator;
+    delete [] mem_kernel;
+    memory->destroy(history);
+  }
 }
 
 /* ---------------------------------------------------------------------- */
@@ -89,75 +129,168 @@ int FixBrownian::setmask()
 {
   int mask = 0;
   mask |= INITIAL_INTEGRATE;
-  mask |= FINAL_INTEGRATE;
   return mask;
 }
 
-/* ---------------------------------------------------------------------- */
+/* ----------------------------------------------------------------------
+   kernel file: lines of "t K(t)", leading lines starting with # skipped
+   read by proc 0 and broadcast
+------------------------------------------------------------------------- */
 
+void FixBrownian::read_mem_file(const char *file)
+{
+  mem_kernel = new double[mem_count];
+
+  int nread = 0;
+  if (comm->me == 0) {
+    FILE *mem_file = fopen(file,"r");
+    if (mem_file == NULL) {
+      char str[128];
+      sprintf(str,"Cannot open fix brownian kernel file %s",file);
+      error->one(FLERR,str);
+    }
+
+    char buf[0x1000];
+    double t;
+    while (nread < mem_count && fgets(buf,sizeof(buf),mem_file) != NULL) {
+      if (buf[0] == '#') continue;
+      if (sscanf(buf,"%lf %lf",&t,&mem_kernel[nread]) == 2) nread++;
+    }
+    fclose(mem_file);
+  }
+
+  MPI_Bcast(&nread,1,MPI_INT,0,world);
+  if (nread < mem_count)
+    error->all(FLERR,"Fix brownian kernel file is incomplete");
+  MPI_Bcast(mem_kernel,mem_count,MPI_DOUBLE,0,world);
+}
+
+/* ----------------------------------------------------------------------
+   one generator per thread, thread 0 of every proc uses seed + me
+------------------------------------------------------------------------- */
+
+void FixBrownian::create_random()
+{
+  for (int tid = 0; tid < nrandom; tid++) delete random[tid];
+  delete [] random;
+
+  nrandom = comm->nthreads;
+  random = new RanMars*[nrandom];
+  for (int tid = 0; tid < nrandom; tid++)
+    random[tid] = new RanMars(lmp,seed + comm->me + comm->nprocs*tid);
+}
 
 /* ---------------------------------------------------------------------- */
 
 void FixBrownian::init()
 {
+  if (nrandom != comm->nthreads) create_random();
 
-  
+  // overdamped Langevin: dx = D/kT f dt + sqrt(2 D dt) xi
+  dtfD = update->dt * D / (force->boltz * temp);
+  sigma = sqrt(2.0 * D * update->dt);
 }
 
-/* ---------------------------------------------------------------------- */
+/* ----------------------------------------------------------------------
+   the colored noise history is filled with white noise once
+------------------------------------------------------------------------- */
 
 void FixBrownian::setup(int vflag)
 {
+  if (!colored || !first) return;
+  first = 0;
 
+  int nlocal = atom->nlocal;
+  for (int n = 0; n < nlocal; n++)
+    for (int m = 0; m < 3*nhist; m++)
+      history[n][m] = random[0]->gaussian();
 }
 
-/* ---------------------------------------------------------------------- */
+/* ----------------------------------------------------------------------
+   Euler-Maruyama step of the positions with the forces of the last step,
+   every thread draws the noise of its own atom range
+------------------------------------------------------------------------- */
 
 void FixBrownian::initial_integrate(int vflag)
 {
-  int n,d,m;
-  double **v = atom->v;
   double **x = atom->x;
   double **f = atom->f;
-  int *type = atom->type;
-  double *mass = atom->mass;
   int *mask = atom->mask;
   int nlocal = atom->nlocal;
-  tagint *tag = atom->tag;
-  
-
-
-  for ( n = 0; n < nlocal; n++) {
-    int itag = tag[n]-1;
-    if (mask[n] & groupbit) {
-      
+  const int nthreads = nrandom;
+
+#if defined(_OPENMP)
+#pragma omp parallel default(shared)
+#endif
+  {
+    int ifrom,ito,tid;
+    loop_setup_thr(ifrom,ito,tid,nlocal,nthreads);
+    RanMars *rng = random[tid];
+    double xi[3];
+
+    for (int n = ifrom; n < ito; n++) {
+      if (!(mask[n] & groupbit)) continue;
+
+      if (colored) {
+        for (int d = 0; d < 3; d++) {
+          history[n][d*nhist+firstindex] = rng->gaussian();
+          xi[d] = random_correlator->gaussian(&history[n][d*nhist],firstindex);
+        }
+      } else {
+        xi[0] = rng->gaussian();
+        xi[1] = rng->gaussian();
+        xi[2] = rng->gaussian();
+      }
+
+      x[n][0] += dtfD*f[n][0] + sigma*xi[0];
+      x[n][1] += dtfD*f[n][1] + sigma*xi[1];
+      x[n][2] += dtfD*f[n][2] + sigma*xi[2];
     }
   }
 
-  
+  if (colored) {
+    firstindex++;
+    if (firstindex == nhist) firstindex = 0;
+  }
 }
 
 /* ---------------------------------------------------------------------- */
 
-void FixBrownian::final_integrate()
+double FixBrownian::memory_usage()
 {
-  int n,d,m;
-  double **v = atom->v;
-  double **x = atom->x;
-  double **f = atom->f;
-  int *type = atom->type;
-  double *mass = atom->mass;
-  int *mask = atom->mask;
-  int nlocal = atom->nlocal;
-  tagint *tag = atom->tag;
-  int itag;
+  double bytes = 0.0;
+  if (colored) bytes += (double) atom->nmax * 3*nhist * sizeof(double);
+  return bytes;
+}
 
-  for ( n = 0; n < nlocal; n++) {
-   itag = tag[n]-1;
-    if (mask[n] & groupbit) {
+/* ----------------------------------------------------------------------
+   per-atom noise history, only allocated for colored noise
+------------------------------------------------------------------------- */
 
-    }
-  }
-  
-  
-}
\ No newline at end of file
+void FixBrownian::grow_arrays(int nmax)
+{
+  memory->grow(history,nmax,3*nhist,"fix/brownian:history");
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixBrownian::copy_arrays(int i, int j, int delflag)
+{
+  for (int m = 0; m < 3*nhist; m++) history[j][m] = history[i][m];
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixBrownian::pack_exchange(int i, double *buf)
+{
+  for (int m = 0; m < 3*nhist; m++) buf[m] = history[i][m];
+  return 3*nhist;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixBrownian::unpack_exchange(int nlocal, double *buf)
+{
+  for (int m = 0; m < 3*nhist; m++) history[nlocal][m] = buf[m];
+  return 3*nhist;
+}
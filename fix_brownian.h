@@ -32,20 +32,60 @@ class FixBrownian : public Fix {
   void init();
   void setup(int);
   virtual void initial_integrate(int);
-  virtual void final_integrate();
   
+  double memory_usage();
+  void grow_arrays(int);
+  void copy_arrays(int, int, int);
+  int pack_exchange(int, double *);
+  int unpack_exchange(int, double *);
 
  protected:
   double D;
   double temp;
+  double dtfD,sigma;        // drift per force and noise amplitude per step
 
-  class RanMars *random;
+  class RanMars **random;   // one generator per thread
+  int nrandom;
   class RanCor *random_correlator;
   int seed;
 
+  // colored noise: per-atom ring buffer of white noise, 3 x nhist values
+  int colored;
+  int mem_count,nhist;
+  int firstindex;
+  double *mem_kernel;
+  double **history;
+  int first;
+
+  void read_mem_file(const char *);
+  void create_random();
 };
 
 }
 
 #endif
 #endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal ... command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.  You can use -echo screen as a
+command-line option when running LAMMPS to see the offending line.
+
+E: Cannot open fix brownian kernel file %s
+
+The specified file cannot be opened.  Check that the path and name are
+correct.
+
+E: Fix brownian kernel needs at least 6 points
+
+The correlated noise generator uses mem_count+5 coefficients, which
+must fit into its noise history of 2*mem_count-1 values.
+
+E: Fix brownian kernel file is incomplete
+
+The kernel file has fewer points than requested.
+
+*/
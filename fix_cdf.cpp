@@ -12,7 +12,9 @@
 ------------------------------------------------------------------------- */
 
 #include "fix_cdf.h"
+#include "math.h"
 #include "string.h"
+#include <algorithm>
 #include "update.h"
 #include "group.h"
 #include "error.h"
@@ -23,6 +25,7 @@
 #include "domain.h"
 #include "input.h"
 #include "comm.h"
+#include "pair.h"
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
@@ -33,7 +36,7 @@ FixCDF::FixCDF(LAMMPS *lmp, int narg, char **arg) :
   Fix(lmp, narg, arg)
 {
   
-  if (narg < 9) error->all(FLERR,"Illegal compute cdf command");
+  if (narg < 9) error->all(FLERR,"Illegal fix cdf command");
   
   MPI_Comm_rank(world,&me);
   MPI_Comm_size(world,&nprocs);
@@ -44,45 +47,94 @@ FixCDF::FixCDF(LAMMPS *lmp, int narg, char **arg) :
   range_x = force->numeric(FLERR,arg[5]);
   nbin_r = force->inumeric(FLERR,arg[6]);
   range_r = force->numeric(FLERR,arg[7]);
+  if (nevery <= 0 || nbin_x <= 0 || nbin_r <= 0 || range_x <= 0.0 || range_r <= 0.0)
+    error->all(FLERR,"Illegal fix cdf command");
   
   jgroup = group->find(arg[8]);
+  if (jgroup == -1) error->all(FLERR,"Could not find fix cdf group ID");
   jgroupbit = group->bitmask[jgroup];
   
+  // optional args
+  // nrepeat = samples summed locally before one reduction and output
+
   print = 0;
-  
-  //printf("out: %s\n",arg[9]);
-  
-  if (strcmp(arg[9],"file") == 0) {
-    if (11 > narg) error->all(FLERR,"Illegal compute cdf/file command");
-    print = 1;
-    //printf("me: %d\n",me);
-    if (me == 0) {
-      //printf("Fix cdf, option file\n");
-      out = fopen(arg[10],"w");
-      if (out == NULL) {
-        char str[128];
-        sprintf(str,"Cannot open compute cdf/file file %s",arg[10]);
-        error->one(FLERR,str);
-      }
-    } 
+  binary = 0;
+  nrepeat = 1;
+  colloidstyle = GROUP;
+  axis = 0;
+  peravg = 1;
+  out = NULL;
+  char *filename = NULL;
+
+  int iarg = 9;
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"file") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix cdf command");
+      print = 1;
+      filename = arg[iarg+1];
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"nrepeat") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix cdf command");
+      nrepeat = force->inumeric(FLERR,arg[iarg+1]);
+      if (nrepeat <= 0) error->all(FLERR,"Illegal fix cdf command");
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"format") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix cdf command");
+      if (strcmp(arg[iarg+1],"text") == 0) binary = 0;
+      else if (strcmp(arg[iarg+1],"binary") == 0) binary = 1;
+      else error->all(FLERR,"Illegal fix cdf command");
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"colloids") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix cdf command");
+      if (strcmp(arg[iarg+1],"group") == 0) colloidstyle = GROUP;
+      else if (strcmp(arg[iarg+1],"molecule") == 0) colloidstyle = MOLECULE;
+      else error->all(FLERR,"Illegal fix cdf command");
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"axis") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix cdf command");
+      if (strcmp(arg[iarg+1],"x") == 0) axis = 0;
+      else if (strcmp(arg[iarg+1],"y") == 0) axis = 1;
+      else if (strcmp(arg[iarg+1],"z") == 0) axis = 2;
+      else error->all(FLERR,"Illegal fix cdf command");
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"profile") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix cdf command");
+      if (strcmp(arg[iarg+1],"average") == 0) peravg = 1;
+      else if (strcmp(arg[iarg+1],"each") == 0) peravg = 0;
+      else error->all(FLERR,"Illegal fix cdf command");
+      iarg += 2;
+    } else error->all(FLERR,"Illegal fix cdf command");
+  }
+
+  if (colloidstyle == MOLECULE && !atom->molecule_flag)
+    error->all(FLERR,"Fix cdf molecule colloids require molecule IDs");
+  if (colloidstyle == MOLECULE && domain->triclinic)
+    error->all(FLERR,"Fix cdf molecule colloids require an orthogonal box");
+
+  // radial plane of the axis
+  ax1 = (axis+1) % 3;
+  ax2 = (axis+2) % 3;
+  cutsq = range_x*range_x + range_r*range_r;
+
+  if (print && me == 0) {
+    if (binary) out = fopen(filename,"wb");
+    else out = fopen(filename,"w");
+    if (out == NULL) {
+      char str[128];
+      sprintf(str,"Cannot open fix cdf file %s",filename);
+      error->one(FLERR,str);
+    }
   }
   
-  // allocate memory
-  size_vector = nbin_x*nbin_r;
-  memory->create(data_histo,size_vector,"cdf/data_histo");
-  memory->create(data_histo_loc,size_vector,"cdf/data_histo_loc");
-  memory->create(data_velx,size_vector,"cdf/data_velx");
-  memory->create(data_vely,size_vector,"cdf/data_vely");
-  memory->create(data_velz,size_vector,"cdf/data_velz");
-  memory->create(data_vel_locx,size_vector,"cdf/data_vel_locx");
-  memory->create(data_vel_locy,size_vector,"cdf/data_vel_locy");
-  memory->create(data_vel_locz,size_vector,"cdf/data_vel_locz");
-  
-    memory->create(data_pressx,size_vector,"cdf/data_pressx");
-    memory->create(data_pressyz,size_vector,"cdf/data_pressyz");
-    
-    memory->create(data_press_locx,size_vector,"cdf/data_press_locx");
-    memory->create(data_press_locyz,size_vector,"cdf/data_press_locyz");
+  // colloids and sums are set up in init(), once the molecules are known
+  nbins = nbin_x*nbin_r;
+  ncolloid = nprofile = 0;
+  molids = NULL;
+  com_loc = com = NULL;
+  sum_loc = sum = NULL;
+  cellhead = cellnext = NULL;
+  maxcell = 0;
+  nsample = 0;
   
   count = nevery;
 }
@@ -91,20 +143,14 @@ FixCDF::FixCDF(LAMMPS *lmp, int narg, char **arg) :
 
 FixCDF::~FixCDF()
 {
-  memory->destroy(data_histo);
-  memory->destroy(data_histo_loc);
-  memory->destroy(data_velx);
-  memory->destroy(data_vely);
-  memory->destroy(data_velz);
-  memory->destroy(data_vel_locx);
-  memory->destroy(data_vel_locy);
-  memory->destroy(data_vel_locz);
-      memory->destroy(data_pressx);
-    memory->destroy(data_pressyz);
-    
-    memory->destroy(data_press_locx);
-    memory->destroy(data_press_locyz);
-  if (me==0) fclose(out);
+  memory->destroy(sum_loc);
+  memory->destroy(sum);
+  memory->destroy(molids);
+  memory->destroy(com_loc);
+  memory->destroy(com);
+  memory->destroy(cellhead);
+  memory->destroy(cellnext);
+  if (out) fclose(out);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -120,7 +166,222 @@ int FixCDF::setmask()
 
 void FixCDF::init()
 {
+  // the colloid does not change its mass, save one reduction per sample
+  if (colloidstyle == GROUP) masstotal = group->mass(igroup);
+  setup_colloids();
+}
+
+/* ----------------------------------------------------------------------
+   find the colloids and size the sums, sums survive a rerun if the number
+   of profiles is unchanged
+------------------------------------------------------------------------- */
+
+void FixCDF::setup_colloids()
+{
+  int i;
+
+  if (colloidstyle == GROUP) ncolloid = 1;
+  else {
+    int nlocal = atom->nlocal;
+    int *mask = atom->mask;
+    tagint *molecule = atom->molecule;
+
+    // unique molecule IDs of the fix group, first per proc then globally
+    tagint *mylist;
+    int n = 0;
+    memory->create(mylist,nlocal+1,"cdf:mylist");
+    for (i = 0; i < nlocal; i++)
+      if ((mask[i] & groupbit) && molecule[i] > 0) mylist[n++] = molecule[i];
+    std::sort(mylist,mylist+n);
+    n = std::unique(mylist,mylist+n) - mylist;
+
+    int *recvcounts,*displs;
+    memory->create(recvcounts,nprocs,"cdf:recvcounts");
+    memory->create(displs,nprocs,"cdf:displs");
+    MPI_Allgather(&n,1,MPI_INT,recvcounts,1,MPI_INT,world);
+    int ntotal = 0;
+    for (i = 0; i < nprocs; i++) {
+      displs[i] = ntotal;
+      ntotal += recvcounts[i];
+    }
+
+    memory->destroy(molids);
+    memory->create(molids,ntotal+1,"cdf:molids");
+    MPI_Allgatherv(mylist,n,MPI_LMP_TAGINT,molids,recvcounts,displs,
+                   MPI_LMP_TAGINT,world);
+    std::sort(molids,molids+ntotal);
+    ncolloid = std::unique(molids,molids+ntotal) - molids;
+
+    memory->destroy(mylist);
+    memory->destroy(recvcounts);
+    memory->destroy(displs);
+
+    if (ncolloid == 0) error->all(FLERR,"Fix cdf group has no molecules");
+  }
+
+  memory->destroy(com_loc);
+  memory->destroy(com);
+  memory->destroy(cellnext);
+  memory->create(com_loc,4*ncolloid,"cdf:com_loc");
+  memory->create(com,4*ncolloid,"cdf:com");
+  memory->create(cellnext,ncolloid,"cdf:cellnext");
+
+  int nprofile_new = peravg ? 1 : ncolloid;
+  if (nprofile_new != nprofile) {
+    nprofile = nprofile_new;
+    memory->destroy(sum_loc);
+    memory->destroy(sum);
+    memory->create(sum_loc,nprofile*NVALUE*nbins,"cdf:sum_loc");
+    memory->create(sum,nprofile*NVALUE*nbins,"cdf:sum");
+    for (i = 0; i < nprofile*NVALUE*nbins; i++) sum_loc[i] = 0.0;
+    nsample = 0;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   center of mass of every colloid, one reduction for all of them,
+   the centers are folded back into the periodic box
+------------------------------------------------------------------------- */
+
+void FixCDF::colloid_com()
+{
+  int i,k;
+  double massone,unwrap[3];
+
+  double **x = atom->x;
+  int *mask = atom->mask;
+  int *type = atom->type;
+  imageint *image = atom->image;
+  tagint *molecule = atom->molecule;
+  double *mass = atom->mass;
+  double *rmass = atom->rmass;
+  int nlocal = atom->nlocal;
+
+  for (k = 0; k < 4*ncolloid; k++) com_loc[k] = 0.0;
+
+  for (i = 0; i < nlocal; i++) {
+    if (!(mask[i] & groupbit) || molecule[i] <= 0) continue;
+    k = std::lower_bound(molids,molids+ncolloid,molecule[i]) - molids;
+    if (rmass) massone = rmass[i];
+    else massone = mass[type[i]];
+    domain->unmap(x[i],image[i],unwrap);
+    com_loc[4*k] += massone;
+    com_loc[4*k+1] += unwrap[0] * massone;
+    com_loc[4*k+2] += unwrap[1] * massone;
+    com_loc[4*k+3] += unwrap[2] * massone;
+  }
+
+  MPI_Allreduce(com_loc,com,4*ncolloid,MPI_DOUBLE,MPI_SUM,world);
+
+  for (k = 0; k < ncolloid; k++)
+    if (com[4*k] > 0.0) {
+      com[4*k+1] /= com[4*k];
+      com[4*k+2] /= com[4*k];
+      com[4*k+3] /= com[4*k];
+      imageint dummy = ((imageint) IMGMAX << IMG2BITS) |
+        ((imageint) IMGMAX << IMGBITS) | IMGMAX;
+      domain->remap(&com[4*k+1],dummy);
+    }
+}
+
+/* ----------------------------------------------------------------------
+   bin the colloid centers into cells that are at least one bin range wide,
+   so the nearest colloid in range is in one of the 27 surrounding cells
+------------------------------------------------------------------------- */
+
+void FixCDF::build_cells()
+{
+  int d,k;
+  double cut = sqrt(cutsq);
+
+  for (d = 0; d < 3; d++) {
+    ncell[d] = static_cast<int> (domain->prd[d]/cut);
+    if (ncell[d] < 1) ncell[d] = 1;
+    cellsize[d] = domain->prd[d]/ncell[d];
+  }
+
+  int ncellall = ncell[0]*ncell[1]*ncell[2];
+  if (ncellall > maxcell) {
+    maxcell = ncellall;
+    memory->destroy(cellhead);
+    memory->create(cellhead,maxcell,"cdf:cellhead");
+  }
+  for (k = 0; k < ncellall; k++) cellhead[k] = -1;
+
+  for (k = 0; k < ncolloid; k++) {
+    int c = (cell_coord(com[4*k+3],2)*ncell[1] + cell_coord(com[4*k+2],1))*ncell[0]
+      + cell_coord(com[4*k+1],0);
+    cellnext[k] = cellhead[c];
+    cellhead[c] = k;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   cell of coordinate xone in dimension d, wrapped or clamped into the box
+------------------------------------------------------------------------- */
+
+int FixCDF::cell_coord(double xone, int d)
+{
+  int c = static_cast<int> (floor((xone - domain->boxlo[d])/cellsize[d]));
+  if (domain->periodicity[d]) {
+    c %= ncell[d];
+    if (c < 0) c += ncell[d];
+  } else {
+    if (c < 0) c = 0;
+    if (c >= ncell[d]) c = ncell[d]-1;
+  }
+  return c;
+}
+
+/* ----------------------------------------------------------------------
+   index of the nearest colloid within range of xone, -1 if there is none
+   del = minimum image distance of xone to its center
+------------------------------------------------------------------------- */
+
+int FixCDF::nearest_colloid(double *xone, double *del)
+{
+  int d,m,k,ix,iy,iz;
+  int cells[3][3],ncells[3];
+  double dx,dy,dz,rsq;
 
+  // neighbor cells per dimension, each cell only once for short dimensions
+  for (d = 0; d < 3; d++) {
+    int c = cell_coord(xone[d],d);
+    if (domain->periodicity[d] && ncell[d] <= 3) {
+      ncells[d] = ncell[d];
+      for (m = 0; m < ncell[d]; m++) cells[d][m] = m;
+    } else {
+      ncells[d] = 0;
+      for (m = c-1; m <= c+1; m++) {
+        if (domain->periodicity[d]) cells[d][ncells[d]++] = (m + ncell[d]) % ncell[d];
+        else if (m >= 0 && m < ncell[d]) cells[d][ncells[d]++] = m;
+      }
+    }
+  }
+
+  int kmin = -1;
+  double rsqmin = cutsq;
+  for (iz = 0; iz < ncells[2]; iz++)
+    for (iy = 0; iy < ncells[1]; iy++)
+      for (ix = 0; ix < ncells[0]; ix++) {
+        k = cellhead[(cells[2][iz]*ncell[1] + cells[1][iy])*ncell[0] + cells[0][ix]];
+        for (; k >= 0; k = cellnext[k]) {
+          dx = xone[0] - com[4*k+1];
+          dy = xone[1] - com[4*k+2];
+          dz = xone[2] - com[4*k+3];
+          domain->minimum_image(dx,dy,dz);
+          rsq = dx*dx + dy*dy + dz*dz;
+          if (rsq < rsqmin) {
+            rsqmin = rsq;
+            kmin = k;
+            del[0] = dx;
+            del[1] = dy;
+            del[2] = dz;
+          }
+        }
+      }
+
+  return kmin;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -128,105 +389,148 @@ void FixCDF::init()
 void FixCDF::end_of_step() 
 {
   if (count == nevery) {
-    // determine com of the colloid
-    int n;
-    double xcm[3];
-    double masstotal = group->mass(igroup);
-    group->xcm(igroup,masstotal,xcm);
-    
-    for (n=0; n<nbin_x*nbin_r; n++) {
-      data_histo[n] = 0;
-      data_histo_loc[n] = 0;
-      data_velx[n] = 0.0;
-      data_vel_locx[n] = 0.0;
-      data_vely[n] = 0.0;
-      data_vel_locy[n] = 0.0;
-      data_velz[n] = 0.0;
-      data_vel_locz[n] = 0.0;
-      
-      data_pressx[n] = 0.0;
-      data_press_locx[n] = 0.0;
-      
-            data_pressyz[n] = 0.0;
-      data_press_locyz[n] = 0.0;
+    // determine com of the colloids, cell list of their centers
+    if (colloidstyle == GROUP) {
+      group->xcm(igroup,masstotal,&com[1]);
+      com[0] = masstotal;
+    } else {
+      colloid_com();
+      build_cells();
     }
     
-    double delx, dely, delz;
-    int i;
+    double del[3];
+    int i,k;
     double **x = atom->x;
     double **v = atom->v;
     int nlocal = atom->nlocal;
     int * mask = atom->mask;
-    double **vatom = force->pair->vatom;
+    // per-atom virial is only tallied on steps some compute asks for it
+    double **vatom = force->pair ? force->pair->vatom : NULL;
     for (i=0; i<nlocal; i++) {
       if(mask[i] & jgroupbit) {
-        delx = x[i][0] -xcm[0];
-        dely = x[i][1] -  xcm[1];
-        delz =  x[i][2] - xcm[2];  
-        
-        domain->minimum_image(delx,dely,delz);
-    
-        double data_x = delx + range_x;
-        double data_r = sqrt(dely*dely + delz*delz);
+        if (colloidstyle == GROUP) {
+          k = 0;
+          del[0] = x[i][0] - com[1];
+          del[1] = x[i][1] - com[2];
+          del[2] = x[i][2] - com[3];
+          domain->minimum_image(del);
+        } else {
+          k = nearest_colloid(x[i],del);
+          if (k < 0) continue;
+        }
+
+        // profile of this colloid or the common one
+        double *histo = &sum_loc[(peravg ? 0 : k)*NVALUE*nbins];
+        double *velx = histo + VELX*nbins;
+        double *vely = histo + VELY*nbins;
+        double *velz = histo + VELZ*nbins;
+        double *pressx = histo + PRESSX*nbins;
+        double *pressyz = histo + PRESSYZ*nbins;
+
+        double dely = del[ax1];
+        double delz = del[ax2];
+        double data_x = del[axis] + range_x;
+        double dr2 = dely*dely + delz*delz;
+        double data_r = sqrt(dr2);
         int bin_x=-1;
         if (data_x > 0.0)
           bin_x = data_x*((double) nbin_x)/(2.0*range_x);
         int bin_r = data_r*((double) nbin_r)/(range_r);
         if (bin_x >= 0 && bin_x <nbin_x && bin_r >= 0 && bin_r <nbin_r) {
-          data_histo_loc[bin_x*nbin_r + bin_r]++;
-          data_vel_locx[bin_x*nbin_r + bin_r]+=v[i][0];
-          data_vel_locy[bin_x*nbin_r + bin_r]+=sqrt(v[i][1]*v[i][1]+v[i][2]*v[i][2]);
-          double sign = v[i][1]*dely+v[i][2]*delz;
-          double dx = dely*dely + delz*delz;
-          data_vel_locz[bin_x*nbin_r + bin_r]=sign/sqrt(dx);
-	  
-	  data_vel_locx[bin_x*nbin_r + bin_r]+=vatom[i][0];
-	  data_vel_locx[bin_x*nbin_r + bin_r]+=v[i][0]*v[i][0];
-          data_vel_locyz[bin_x*nbin_r + bin_r]+=(vatom[i][1]+vatom[i][2])/2.0;
-	  data_vel_locyz[bin_x*nbin_r + bin_r]+=(v[i][1]*v[i][1]+v[i][2]*v[i][2])/2.0;
+          int n = bin_x*nbin_r + bin_r;
+          double va = v[i][axis];
+          double v1 = v[i][ax1];
+          double v2 = v[i][ax2];
+          histo[n]++;
+          velx[n] += va;
+          vely[n] += sqrt(v1*v1+v2*v2);
+          // radial velocity, undefined on the axis
+          if (dr2 > 0.0) velz[n] += (v1*dely+v2*delz)/data_r;
+
+          pressx[n] += va*va;
+          pressyz[n] += (v1*v1+v2*v2)/2.0;
+          if (vatom) {
+            pressx[n] += vatom[i][axis];
+            pressyz[n] += (vatom[i][ax1]+vatom[i][ax2])/2.0;
+          }
         }
       }
     }
     
-    //printf("test1\n");
-    
-    MPI_Allreduce(data_histo_loc, data_histo, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-    MPI_Allreduce(data_vel_locx, data_velx, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-    MPI_Allreduce(data_vel_locy, data_vely, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-    MPI_Allreduce(data_vel_locz, data_velz, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-    
-        MPI_Allreduce(data_press_locx, data_pressx, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-	 MPI_Allreduce(data_press_locyz, data_pressyz, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-    
-    //printf("test2\n");
-    
-    int r,xloc;
-    for (xloc=0; xloc<nbin_x; xloc++) {
-      for (r=0; r<nbin_r; r++) {
-        if ( data_histo[xloc*nbin_r + r] != 0 ) {
-          data_velx[xloc*nbin_r + r] /= data_histo[xloc*nbin_r + r];
-          data_vely[xloc*nbin_r + r] /= data_histo[xloc*nbin_r + r];
-          data_velz[xloc*nbin_r + r] /= data_histo[xloc*nbin_r + r];
-	  
-	  data_pressx[xloc*nbin_r + r] /= data_histo[xloc*nbin_r + r];
-	  data_pressyz[xloc*nbin_r + r] /= data_histo[xloc*nbin_r + r];
-        }
+    nsample++;
+    if (nsample == nrepeat) output();
+    count = 0;
+  } 
+  count ++;
+}
+
+/* ----------------------------------------------------------------------
+   one reduction of all sums to proc 0, averages over the samples and
+   restart the accumulation
+------------------------------------------------------------------------- */
+
+void FixCDF::output()
+{
+  int ntotal = nprofile*NVALUE*nbins;
+  MPI_Reduce(sum_loc,sum,ntotal,MPI_DOUBLE,MPI_SUM,0,world);
+  for (int n = 0; n < ntotal; n++) sum_loc[n] = 0.0;
+
+  if (print && me == 0) {
+    int n,m,p;
+
+    // per bin means weighted by the occupation of every sample,
+    // histogram as mean count per sample and colloid
+    double norm = nsample;
+    if (peravg) norm *= ncolloid;
+    for (p = 0; p < nprofile; p++) {
+      double *block = &sum[p*NVALUE*nbins];
+      double *histo = &block[HISTO*nbins];
+      for (n = 0; n < nbins; n++) {
+        if (histo[n] != 0.0)
+          for (m = VELX; m < NVALUE; m++) block[m*nbins+n] /= histo[n];
+        histo[n] /= norm;
       }
     }
-    
-    //printf("test3\n");
 
-    if (print && (me == 0) ) {
-      fprintf(out,"t=%d\n",update->ntimestep);
-      for (xloc=0; xloc<nbin_x; xloc++) {
-        for (r=0; r<nbin_r; r++) {
-          fprintf(out,"%f %f %f %f %f %f %f %f\n",xloc/((double) nbin_x)*(2.0*range_x)-range_x,r/((double) nbin_r)*(range_r),data_histo[xloc*nbin_r + r],data_velx[xloc*nbin_r + r],data_vely[xloc*nbin_r + r],data_velz[xloc*nbin_r + r],data_pressx[xloc*nbin_r + r],data_pressyz[xloc*nbin_r + r]);
+    if (binary) {
+      bigint ntimestep = update->ntimestep;
+      int header[6];
+      header[0] = nbin_x;
+      header[1] = nbin_r;
+      header[2] = NVALUE;
+      header[3] = nsample;
+      header[4] = nprofile;
+      header[5] = axis;
+      fwrite(&ntimestep,sizeof(bigint),1,out);
+      fwrite(header,sizeof(int),6,out);
+      fwrite(&range_x,sizeof(double),1,out);
+      fwrite(&range_r,sizeof(double),1,out);
+      if (colloidstyle == MOLECULE && !peravg)
+        fwrite(molids,sizeof(tagint),ncolloid,out);
+      fwrite(sum,sizeof(double),ntotal,out);
+    } else {
+      int r,xloc;
+      fprintf(out,"t=" BIGINT_FORMAT "\n",update->ntimestep);
+      for (p = 0; p < nprofile; p++) {
+        double *block = &sum[p*NVALUE*nbins];
+        if (colloidstyle == MOLECULE && !peravg)
+          fprintf(out,"colloid=" TAGINT_FORMAT "\n",molids[p]);
+        for (xloc=0; xloc<nbin_x; xloc++) {
+          for (r=0; r<nbin_r; r++) {
+            n = xloc*nbin_r + r;
+            fprintf(out,"%f %f %f %f %f %f %f %f\n",
+                    xloc/((double) nbin_x)*(2.0*range_x)-range_x,
+                    r/((double) nbin_r)*(range_r),
+                    block[HISTO*nbins+n],block[VELX*nbins+n],block[VELY*nbins+n],
+                    block[VELZ*nbins+n],block[PRESSX*nbins+n],block[PRESSYZ*nbins+n]);
+          }
+          fprintf(out,"\n");
         }
-        fprintf(out,"\n");
+        fprintf(out,"\n\n");
       }
-      fprintf(out,"\n\n");
     }
-    count = 0;
-  } 
-  count ++;
+    fflush(out);
+  }
+
+  nsample = 0;
 }
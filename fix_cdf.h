@@ -35,33 +35,83 @@ class FixCDF : public Fix {
  private:
   int me,nprocs;
   int nevery,count;
+  int nrepeat,nsample;   // samples per output, samples taken so far
   int nbin_x;
   double range_x;
   int nbin_r;
   double range_r;
-  
-  double * data_histo;
-  double * data_histo_loc;
-  double * data_velx;
-  double * data_vel_locx;
-    double * data_vely;
-  double * data_vel_locy;
-    double * data_velz;
-  double * data_vel_locz;
-  
-    double * data_press_locx;
-    double * data_pressx;
-    
-        double * data_press_locyz;
-    double * data_pressyz;
-  
+  int nbins;
+  double masstotal;
+
+  // colloids: the whole fix group or one per molecule ID in the fix group
+  // profiles along axis and radial to it, per colloid or averaged
+  enum{GROUP,MOLECULE};
+  int colloidstyle;
+  int axis,ax1,ax2;
+  int peravg;
+  int ncolloid,nprofile;
+  tagint *molids;         // sorted molecule IDs of the colloids
+  double *com_loc,*com;   // per colloid mass and mass weighted position
+  double cutsq;           // furthest distance that falls into a bin
+
+  // per bin sums of all samples since the last output, one block per value
+  // and profile, reduced in a single call, only proc 0 holds the result
+  enum{HISTO,VELX,VELY,VELZ,PRESSX,PRESSYZ,NVALUE};
+  double *sum_loc;
+  double *sum;
+
+  // cell list of the colloid centers, cells at least sqrt(cutsq) wide
+  int ncell[3];
+  double cellsize[3];
+  int *cellhead,*cellnext;
+  int maxcell;
+
   int jgroup,jgroupbit;
   
-  int print;
+  int print,binary;
   FILE * out;
+
+  void output();
+  void setup_colloids();
+  void colloid_com();
+  void build_cells();
+  int cell_coord(double, int);
+  int nearest_colloid(double *, double *);
 };
 
 }
 
 #endif
 #endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal ... command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.  You can use -echo screen as a
+command-line option when running LAMMPS to see the offending line.
+
+E: Could not find fix cdf group ID
+
+Self-explanatory.
+
+E: Fix cdf molecule colloids require molecule IDs
+
+The atom style does not define molecule IDs.
+
+E: Fix cdf molecule colloids require an orthogonal box
+
+The cell list of the colloid centers is only set up for orthogonal
+boxes.
+
+E: Fix cdf group has no molecules
+
+None of the fix group atoms has a nonzero molecule ID.
+
+E: Cannot open fix cdf file %s
+
+The specified file cannot be opened.  Check that the path and name are
+correct.
+
+*/
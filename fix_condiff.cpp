@@ -10,6 +10,7 @@
 #include "force.h"
 #include "pair.h"
 #include "domain.h"
+#include "comm.h"
 #include "memory.h"
 #include "error.h"
 #include "group.h"
@@ -17,6 +18,7 @@
 #include "random_mars.h"
 #include "math_const.h"
 #include "math_special.h"
+#include "thr_omp.h"
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
@@ -37,27 +39,33 @@ FixCondiff::FixCondiff(LAMMPS* lmp, int narg, char** arg)
     : Fix(lmp, narg, arg)
 {
     MPI_Comm_rank(world, &me);
+    MPI_Comm_size(world, &nprocs);
 
     if (narg < 4)
         error->all(FLERR, "Illegal fix condiff command"); //4 mandatory arguments
 
-    density_brick_velocity_x = NULL;
-    density_brick_velocity_y = NULL;
-    density_brick_velocity_z = NULL;
+    brick = NULL;
+    stencil_base = NULL;
+    stencil_w = NULL;
+    nmax = 0;
 
-    density_brick_force_x = NULL;
-    density_brick_force_y = NULL;
-    density_brick_force_z = NULL;
+    rand = rand_old = NULL;
+    nmax_rand = 0;
+    random = NULL;
+    nrandom = 0;
+    first = 0;
 
-    density_brick_counter_x = NULL;
+    buf1 = buf2 = NULL;
+    nbuf = 0;
 
-    rand = NULL;
-
-    rho1d = rho_coeff = drho1d = drho_coeff = NULL;
+    rho_coeff = NULL;
     order = force->kspace->order;
     minorder = 2;
     order_allocated = order;
 
+    //No grid yet, first post_force() builds it
+    nx_grid = ny_grid = nz_grid = order_grid = -1;
+
     //Set groupbit_condiff on condiff particles, so fix knows which particles to act on
     jgroup = group->find(arg[3]);
     if (jgroup == -1)
@@ -71,6 +79,8 @@ FixCondiff::FixCondiff(LAMMPS* lmp, int narg, char** arg)
     T = 1.0;
     D = 1.0;
     seed = 11111;
+    noise = UNIFORM;
+    integrator = EULER;
 
     //Optional args
     int iarg = 4;
@@ -100,6 +110,28 @@ FixCondiff::FixCondiff(LAMMPS* lmp, int narg, char** arg)
                 error->all(FLERR, "Illegal fix condiff command");
             iarg += 2;
         }
+        else if (strcmp(arg[iarg], "noise") == 0) {
+            if (iarg + 2 > narg)
+                error->all(FLERR, "Illegal fix condiff command");
+            if (strcmp(arg[iarg + 1], "uniform") == 0)
+                noise = UNIFORM;
+            else if (strcmp(arg[iarg + 1], "gaussian") == 0)
+                noise = GAUSSIAN;
+            else
+                error->all(FLERR, "Illegal fix condiff command");
+            iarg += 2;
+        }
+        else if (strcmp(arg[iarg], "integrator") == 0) {
+            if (iarg + 2 > narg)
+                error->all(FLERR, "Illegal fix condiff command");
+            if (strcmp(arg[iarg + 1], "euler") == 0)
+                integrator = EULER;
+            else if (strcmp(arg[iarg + 1], "baoab") == 0)
+                integrator = BAOAB;
+            else
+                error->all(FLERR, "Illegal fix condiff command");
+            iarg += 2;
+        }
         else
             error->all(FLERR, "Illegal fix condiff command");
     }
@@ -108,25 +140,39 @@ FixCondiff::FixCondiff(LAMMPS* lmp, int narg, char** arg)
         printf("Temp = %f\n", T);
         printf("Diffusion Coefficient = %f\n", D);
         printf("Seed = %i\n", seed);
+        printf("Noise = %s\n", noise == GAUSSIAN ? "gaussian" : "uniform");
+        printf("Integrator = %s\n", integrator == BAOAB ? "baoab" : "euler");
     }
 
-    //Random Number Generator
-    random = new RanMars(lmp, seed);
+    //Random Number Generators, one per thread
+    create_random();
+
+    //BAOAB limit keeps the noise of the last step with every atom,
+    //atoms created later get theirs from set_arrays()
+    if (integrator == BAOAB) {
+        grow_arrays(atom->nmax);
+        atom->add_callback(0);
+        create_attribute = 1;
+        first = 1;
+    }
 }
 
 //The class destructor
 FixCondiff::~FixCondiff()
 {
     deallocate();
-    memory->destroy(density_brick_velocity_x);
-    memory->destroy(density_brick_velocity_y);
-    memory->destroy(density_brick_velocity_z);
-    memory->destroy(density_brick_counter_x);
-    memory->destroy(density_brick_force_x);
-    memory->destroy(density_brick_force_y);
-    memory->destroy(density_brick_force_z);
-    
-    delete random;
+    memory->destroy(buf1);
+    memory->destroy(buf2);
+    memory->destroy(rand);
+
+    if (integrator == BAOAB) {
+        atom->delete_callback(id, 0);
+        memory->destroy(rand_old);
+    }
+
+    for (int tid = 0; tid < nrandom; tid++)
+        delete random[tid];
+    delete[] random;
 }
 
 //Where algorithm steps in
@@ -138,11 +184,30 @@ int FixCondiff::setmask()
     return mask;
 }
 
+//Thread count may have changed through package omp since the constructor,
+//the BAOAB noise history is drawn once for the first run
+void FixCondiff::init()
+{
+    if (nrandom != comm->nthreads)
+        create_random();
+
+    if (integrator == BAOAB && first) {
+        draw_noise(rand_old);
+        first = 0;
+    }
+}
+
 void FixCondiff::post_force(int vspace)
 {
     setup();
-    setup_grid();
+    //Grid and coefficients are only rebuilt if the box or kspace grid changed
+    if (grid_changed())
+        setup_grid();
     assign_vf();
+    //Sum ghost contributions into the owning procs, then refresh ghosts
+    reverse_comm_grid();
+    forward_comm_grid();
+    normalize_grid();
     reassign_vf();
 }
 
@@ -153,6 +218,7 @@ void FixCondiff::final_integrate()
 
 void FixCondiff::setup()
 {
+    order = force->kspace->order;
     nx_pppm = force->kspace->nx_pppm;
     ny_pppm = force->kspace->ny_pppm;
     nz_pppm = force->kspace->nz_pppm;
@@ -172,8 +238,10 @@ void FixCondiff::setup()
 
     delvolinv = delxinv * delyinv * delzinv;
     dt = update->dt;
-    //wienerConst = sqrt(2 * D * dt);
-    wienerConst = sqrt(6 * D * dt); // 6 due to uniform random numbers
+    if (noise == GAUSSIAN)
+        wienerConst = sqrt(2 * D * dt);
+    else
+        wienerConst = sqrt(6 * D * dt); // 6 due to uniform random numbers
 }
 
 //setup_grid() framework taken from pppm.cpp
@@ -186,223 +254,233 @@ void FixCondiff::setup_grid()
     set_grid_local();
     allocate();
     compute_rho_coeff();
+    ghost_setup();
 }
 
-void FixCondiff::assign_vf()
+//Compare the grid signature with the one the grid was built for
+//the subdomain bounds also catch box changes and load balancing,
+//the decision is reduced over all procs since the rebuild communicates
+int FixCondiff::grid_changed()
 {
-    int l, m, n, nx, ny, nz, mx, my, mz;
-    FFT_SCALAR dx, dy, dz, x0, y0, z0;
-
-    //Clear 3d density array
-
-    memset(&(density_brick_velocity_x[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_velocity_y[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_velocity_z[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_force_x[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_force_y[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_force_z[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_counter_x[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-
-    //Loop over my velocities, add their contribution to nearby grid points
-    //(nx,ny,nz) = global coords of grid pt to "lower left" of charge
-    //(dx,dy,dz) = distance to "lower left" grid pt
-    //(mx,my,mz) = global coords of moving stencil pt
+    int changed = 0;
+    int changedall;
+
+    if (nx_grid != nx_pppm || ny_grid != ny_pppm || nz_grid != nz_pppm || order_grid != order)
+        changed = 1;
+    for (int d = 0; d < 3; d++)
+        if (sublo_grid[d] != domain->sublo[d] || subhi_grid[d] != domain->subhi[d] || prd_grid[d] != domain->prd[d])
+            changed = 1;
+
+    if (changed) {
+        nx_grid = nx_pppm;
+        ny_grid = ny_pppm;
+        nz_grid = nz_pppm;
+        order_grid = order;
+        for (int d = 0; d < 3; d++) {
+            sublo_grid[d] = domain->sublo[d];
+            subhi_grid[d] = domain->subhi[d];
+            prd_grid[d] = domain->prd[d];
+        }
+    }
 
-    double** v = atom->v;
+    MPI_Allreduce(&changed, &changedall, 1, MPI_INT, MPI_MAX, world);
+    return changedall;
+}
+
+//Stencil of local atom i: flat index of its lower left grid point and
+//the 1d weights, kept for the reassign pass of the same step
+//weights are evaluated from rho_coeff directly, so threads can share it
+void FixCondiff::make_stencil(int i)
+{
     double** x = atom->x;
+    int nx, ny, nz, k, l;
+    FFT_SCALAR dx, dy, dz, r1, r2, r3;
+
+    nx = static_cast<int>((x[i][0] - boxlo[0]) * delxinv + shift) - OFFSET;
+    ny = static_cast<int>((x[i][1] - boxlo[1]) * delyinv + shift) - OFFSET;
+    nz = static_cast<int>((x[i][2] - boxlo[2]) * delzinv + shift) - OFFSET;
+    dx = nx + shiftone - (x[i][0] - boxlo[0]) * delxinv;
+    dy = ny + shiftone - (x[i][1] - boxlo[1]) * delyinv;
+    dz = nz + shiftone - (x[i][2] - boxlo[2]) * delzinv;
+
+    stencil_base[i] = grid_index(nx + nlower, ny + nlower, nz + nlower);
+    FFT_SCALAR* w = stencil_w[i];
+    for (k = nlower; k <= nupper; k++) {
+        r1 = r2 = r3 = ZEROF;
+        for (l = order - 1; l >= 0; l--) {
+            r1 = rho_coeff[l][k] + r1 * dx;
+            r2 = rho_coeff[l][k] + r2 * dy;
+            r3 = rho_coeff[l][k] + r3 * dz;
+        }
+        w[k - nlower] = r1;
+        w[order + k - nlower] = r2;
+        w[2 * order + k - nlower] = r3;
+    }
+}
+
+//assign_vf() follows PPPMOMP::make_rho(): every thread owns a range of
+//z-planes of the brick and adds the stencil planes of all atoms that fall
+//into it, so there are no write conflicts and no per-thread bricks
+void FixCondiff::assign_vf()
+{
+    double** v = atom->v;
     double** f = atom->f;
     int nlocal = atom->nlocal;
     int* mask = atom->mask;
-        int* tag = atom->tag;
-
-
-	double *force_tot = new double[3];
-	force_tot[0] = 0.0;
-	force_tot[1] = 0.0;
-	force_tot[2] = 0.0;
-	
-	double *force_tot2 = new double[3];
-	force_tot2[0] = 0.0;
-	force_tot2[1] = 0.0;
-	force_tot2[2] = 0.0;
-	
-    for (int i = 0; i < nlocal; i++) {
+    const int nthreads = comm->nthreads;
+
+    if (atom->nmax > nmax) {
+        memory->destroy(stencil_base);
+        memory->destroy(stencil_w);
+        nmax = atom->nmax;
+        memory->create(stencil_base, nmax, "condiff:stencil_base");
+        memory->create(stencil_w, nmax, 3 * order, "condiff:stencil_w");
+    }
 
-        //Take velocity of dpd-particles and map them on grid
-        if (mask[i] & groupbit) {
-            nx = static_cast<int>((x[i][0] - boxlo[0]) * delxinv + shift) - OFFSET;
-            ny = static_cast<int>((x[i][1] - boxlo[1]) * delyinv + shift) - OFFSET;
-            nz = static_cast<int>((x[i][2] - boxlo[2]) * delzinv + shift) - OFFSET;
-            dx = nx + shiftone - (x[i][0] - boxlo[0]) * delxinv;
-            dy = ny + shiftone - (x[i][1] - boxlo[1]) * delyinv;
-            dz = nz + shiftone - (x[i][2] - boxlo[2]) * delzinv;
-
-            compute_rho1d(dx, dy, dz);
-
-            z0 = delvolinv;
-            for (n = nlower; n <= nupper; n++) {
-                mz = n + nz;
-                y0 = z0 * rho1d[2][n];
-                for (m = nlower; m <= nupper; m++) {
-                    my = m + ny;
-                    x0 = y0 * rho1d[1][m];
-                    for (l = nlower; l <= nupper; l++) {
-                        mx = l + nx;
-                        density_brick_velocity_x[mz][my][mx] += x0 * rho1d[0][l] * v[i][0];
-                        density_brick_velocity_y[mz][my][mx] += x0 * rho1d[0][l] * v[i][1];
-                        density_brick_velocity_z[mz][my][mx] += x0 * rho1d[0][l] * v[i][2];
-                        density_brick_counter_x[mz][my][mx] += x0 * rho1d[0][l];
-                    }
-                }
-            }
-        }
+    //Stencils of velocity (dpd) and force (condiff) particles
+
+#if defined(_OPENMP)
+#pragma omp parallel for default(shared) schedule(static)
+#endif
+    for (int i = 0; i < nlocal; i++)
+        if (mask[i] & (groupbit | groupbit_condiff))
+            make_stencil(i);
+
+    const int nzout = nzhi_out - nzlo_out + 1;
 
-        //Take force of condiff-particles and map them on grid
-        if (mask[i] & groupbit_condiff) {
-	  force_tot[0] += f[i][0];
-	  force_tot[1] += f[i][1];
-	  force_tot[2] += f[i][2];
-	  //printf("force_tot_q %f %f %f \n",force_tot[0],force_tot[1],force_tot[2]);
-            nx = static_cast<int>((x[i][0] - boxlo[0]) * delxinv + shift) - OFFSET;
-            ny = static_cast<int>((x[i][1] - boxlo[1]) * delyinv + shift) - OFFSET;
-            nz = static_cast<int>((x[i][2] - boxlo[2]) * delzinv + shift) - OFFSET;
-            dx = nx + shiftone - (x[i][0] - boxlo[0]) * delxinv;
-            dy = ny + shiftone - (x[i][1] - boxlo[1]) * delyinv;
-            dz = nz + shiftone - (x[i][2] - boxlo[2]) * delzinv;
-
-            compute_rho1d(dx, dy, dz);
-
-            z0 = delvolinv;
-            for (n = nlower; n <= nupper; n++) {
-                mz = n + nz;
-                y0 = z0 * rho1d[2][n];
-                for (m = nlower; m <= nupper; m++) {
-                    my = m + ny;
-                    x0 = y0 * rho1d[1][m];
-                    for (l = nlower; l <= nupper; l++) {
-                        mx = l + nx;
-                        density_brick_force_x[mz][my][mx] += x0 * rho1d[0][l] * f[i][0];
-                        density_brick_force_y[mz][my][mx] += x0 * rho1d[0][l] * f[i][1];
-                        density_brick_force_z[mz][my][mx] += x0 * rho1d[0][l] * f[i][2];
-			force_tot2[0] +=  x0 * rho1d[0][l] * f[i][0];
-			force_tot2[1] += x0 * rho1d[0][l] * f[i][1];
-			force_tot2[2] += x0 * rho1d[0][l] * f[i][2];
+#if defined(_OPENMP)
+#pragma omp parallel default(shared)
+#endif
+    {
+        int zfrom, zto, tid;
+        loop_setup_thr(zfrom, zto, tid, nzout, nthreads);
+
+        //Clear my planes of the interleaved grid, ghosts included
+
+        if (zto > zfrom)
+            memset(brick + (bigint)zfrom * zstride * NCOMP, 0,
+                (bigint)(zto - zfrom) * zstride * NCOMP * sizeof(FFT_SCALAR));
+
+        for (int i = 0; i < nlocal; i++) {
+            int vflag = mask[i] & groupbit;
+            int fflag = mask[i] & groupbit_condiff;
+            if (!vflag && !fflag)
+                continue;
+
+            //stencil planes inside my range
+            const int iz0 = static_cast<int>(stencil_base[i] / zstride);
+            const int nlo = MAX(0, zfrom - iz0);
+            const int nhi = MIN(order, zto - iz0);
+            if (nlo >= nhi)
+                continue;
+
+            const FFT_SCALAR* wx = stencil_w[i];
+            const FFT_SCALAR* wy = wx + order;
+            const FFT_SCALAR* wz = wy + order;
+            const FFT_SCALAR vx = vflag ? v[i][0] : ZEROF;
+            const FFT_SCALAR vy = vflag ? v[i][1] : ZEROF;
+            const FFT_SCALAR vz = vflag ? v[i][2] : ZEROF;
+            const FFT_SCALAR cnt = vflag ? ONEF : ZEROF;
+            const FFT_SCALAR fx = fflag ? f[i][0] : ZEROF;
+            const FFT_SCALAR fy = fflag ? f[i][1] : ZEROF;
+            const FFT_SCALAR fz = fflag ? f[i][2] : ZEROF;
+
+            for (int n = nlo; n < nhi; n++) {
+                const FFT_SCALAR y0 = delvolinv * wz[n];
+                for (int m = 0; m < order; m++) {
+                    const FFT_SCALAR x0 = y0 * wy[m];
+                    FFT_SCALAR* g = brick + (stencil_base[i] + n * zstride + m * ystride) * NCOMP;
+                    for (int l = 0; l < order; l++, g += NCOMP) {
+                        FFT_SCALAR w = x0 * wx[l];
+                        g[VX] += w * vx;
+                        g[VY] += w * vy;
+                        g[VZ] += w * vz;
+                        g[CNT] += w * cnt;
+                        g[FX] += w * fx;
+                        g[FY] += w * fy;
+                        g[FZ] += w * fz;
                     }
                 }
             }
         }
     }
+}
 
-    //printf("force_tot_q %f %f %f \n",force_tot[0],force_tot[1],force_tot[2]);
-    //printf("force_tot_m %f %f %f \n",force_tot2[0],force_tot2[1],force_tot2[2]);
-    
-    delete [] force_tot;
-    delete [] force_tot2;
+//Normalization of every grid point, once per step instead of per stencil point
+//cutoff to prohibit float errors in the normalization, empty points get 0
+void FixCondiff::normalize_grid()
+{
+#if defined(_OPENMP)
+#pragma omp parallel for default(shared) schedule(static)
+#endif
+    for (int i = 0; i < ngrid; i++) {
+        FFT_SCALAR* g = brick + (bigint)i * NCOMP;
+        g[INV] = (g[CNT] * g[CNT] >= 0.0000000000000001) ? ONEF / g[CNT] : ZEROF;
+    }
 }
 
+//reassign_vf() only reads the grid, atoms are split over threads
 void FixCondiff::reassign_vf()
 {
-  double *force_tot = new double[3];
-	force_tot[0] = 0.0;
-	force_tot[1] = 0.0;
-	force_tot[2] = 0.0;
-
-    int l, m, n, nx, ny, nz, mx, my, mz;
-    FFT_SCALAR dx, dy, dz, x0, y0, z0;
-
     double** v = atom->v;
-    double** x = atom->x;
     double** f = atom->f;
     int nlocal = atom->nlocal;
     int* mask = atom->mask;
-    int* tag = atom->tag;
 
+#if defined(_OPENMP)
+#pragma omp parallel for default(shared) schedule(static)
+#endif
     for (int i = 0; i < nlocal; i++) {
-
-        //Remap velocities on condiff-particles (pseudo-ions)
-        if (mask[i] & groupbit_condiff) {
-            nx = static_cast<int>((x[i][0] - boxlo[0]) * delxinv + shift) - OFFSET;
-            ny = static_cast<int>((x[i][1] - boxlo[1]) * delyinv + shift) - OFFSET;
-            nz = static_cast<int>((x[i][2] - boxlo[2]) * delzinv + shift) - OFFSET;
-            dx = nx + shiftone - (x[i][0] - boxlo[0]) * delxinv;
-            dy = ny + shiftone - (x[i][1] - boxlo[1]) * delyinv;
-            dz = nz + shiftone - (x[i][2] - boxlo[2]) * delzinv;
-
-            compute_rho1d(dx, dy, dz);
-
-            v[i][0] = 0;
-            v[i][1] = 0;
-            v[i][2] = 0;
-
-            for (n = nlower; n <= nupper; n++) {
-                mz = n + nz;
-                z0 = rho1d[2][n];
-                for (m = nlower; m <= nupper; m++) {
-                    my = m + ny;
-                    y0 = z0 * rho1d[1][m];
-                    for (l = nlower; l <= nupper; l++) {
-                        mx = l + nx;
-                        x0 = y0 * rho1d[0][l];
-			// cutoff to prohibit float errors in the normalization
-                        if (density_brick_counter_x[mz][my][mx]*density_brick_counter_x[mz][my][mx]>=0.0000000000000001) { 
-                          v[i][0] += (density_brick_velocity_x[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx]);
-                          v[i][1] += (density_brick_velocity_y[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx]);
-                          v[i][2] += (density_brick_velocity_z[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx]);
-                        } else {
-			  if (density_brick_force_x[mz][my][mx]*density_brick_force_x[mz][my][mx] >= 0.000001 || density_brick_force_y[mz][my][mx]*density_brick_force_y[mz][my][mx] >= 0.000001 || density_brick_force_z[mz][my][mx]*density_brick_force_z[mz][my][mx] >= 0.000001) {
-			    //printf("Empty grid-point (%d %d %d) lost force (%f %f %f) in fix/condiff -> will break momentum conservation\n",mz,my,mx,density_brick_force_x[mz][my][mx] ,density_brick_force_y[mz][my][mx] ,density_brick_force_z[mz][my][mx]);
-			  }
-			}
-                    }
+        int fflag = mask[i] & groupbit;
+        int vflag = mask[i] & groupbit_condiff;
+        if (!vflag && !fflag)
+            continue;
+
+        //stencil cached by assign_vf() of this step
+        const FFT_SCALAR* wx = stencil_w[i];
+        const FFT_SCALAR* wy = wx + order;
+        const FFT_SCALAR* wz = wy + order;
+        FFT_SCALAR vsum[3] = { ZEROF, ZEROF, ZEROF };
+        FFT_SCALAR fsum[3] = { ZEROF, ZEROF, ZEROF };
+
+        for (int n = 0; n < order; n++) {
+            const FFT_SCALAR y0 = wz[n];
+            for (int m = 0; m < order; m++) {
+                const FFT_SCALAR x0 = y0 * wy[m];
+                const FFT_SCALAR* g = brick + (stencil_base[i] + n * zstride + m * ystride) * NCOMP;
+                for (int l = 0; l < order; l++, g += NCOMP) {
+                    FFT_SCALAR w = x0 * wx[l] * g[INV];
+                    vsum[0] += w * g[VX];
+                    vsum[1] += w * g[VY];
+                    vsum[2] += w * g[VZ];
+                    fsum[0] += w * g[FX];
+                    fsum[1] += w * g[FY];
+                    fsum[2] += w * g[FZ];
                 }
             }
         }
 
+        //Remap velocities on condiff-particles (pseudo-ions)
+        if (vflag) {
+            v[i][0] = vsum[0];
+            v[i][1] = vsum[1];
+            v[i][2] = vsum[2];
+        }
+
         //Assign (normalized) force of pseudo-ions to dpd-particles
-        if (mask[i] & groupbit) {
-            nx = static_cast<int>((x[i][0] - boxlo[0]) * delxinv + shift) - OFFSET;
-            ny = static_cast<int>((x[i][1] - boxlo[1]) * delyinv + shift) - OFFSET;
-            nz = static_cast<int>((x[i][2] - boxlo[2]) * delzinv + shift) - OFFSET;
-            dx = nx + shiftone - (x[i][0] - boxlo[0]) * delxinv;
-            dy = ny + shiftone - (x[i][1] - boxlo[1]) * delyinv;
-            dz = nz + shiftone - (x[i][2] - boxlo[2]) * delzinv;
-
-            compute_rho1d(dx, dy, dz);
-
-            for (n = nlower; n <= nupper; n++) {
-                mz = n + nz;
-                z0 = rho1d[2][n];
-                for (m = nlower; m <= nupper; m++) {
-                    my = m + ny;
-                    y0 = z0 * rho1d[1][m];
-                    for (l = nlower; l <= nupper; l++) {
-                        mx = l + nx;
-                        x0 = y0 * rho1d[0][l];
-                        if (density_brick_counter_x[mz][my][mx]*density_brick_counter_x[mz][my][mx]>=0.0000000000000001) { 
-                            f[i][0] += density_brick_force_x[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-                            f[i][1] += density_brick_force_y[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-                            f[i][2] += density_brick_force_z[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-			    force_tot[0] += density_brick_force_x[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-			    force_tot[1] += density_brick_force_y[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-			    force_tot[2] += density_brick_force_z[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-			    //printf("force_tot_s %d %f %f %f %f\n",i,force_tot[0],force_tot[1],force_tot[2],density_brick_counter_x[mz][my][mx]);
-			}
-                    }
-                }
-            }
+        if (fflag) {
+            f[i][0] += fsum[0];
+            f[i][1] += fsum[1];
+            f[i][2] += fsum[2];
         }
     }
-        //printf("force_tot_s %f %f %f \n",force_tot[0],force_tot[1],force_tot[2]);
-        delete [] force_tot;
 }
 
+//Position update of the condiff particles, threaded over atoms
+//euler: Euler-Maruyama, x += (v + D/T f) dt + sqrt(2 D dt) R_n
+//baoab: overdamped limit of BAOAB (Leimkuhler-Matthews), same drift with
+//       the mean of this and the last noise, sqrt(2 D dt) (R_n + R_n+1) / 2,
+//       second order for the invariant measure at the cost of Euler
 void FixCondiff::euler_step()
 {
     double** v = atom->v;
@@ -410,45 +488,136 @@ void FixCondiff::euler_step()
     double** f = atom->f;
     int nlocal = atom->nlocal;
     int* mask = atom->mask;
-    int* tag = atom->tag;
+    const double dtfm = dt * D / T;
+    const double halfWiener = 0.5 * wienerConst;
 
-    for (int i = 0; i < nlocal; i++) {
-        if (mask[i] & groupbit_condiff) {
-            rand[0] = 2*random->uniform()-1;//gaussian()
-            rand[1] = 2*random->uniform()-1;//gaussian()
-            rand[2] = 2*random->uniform()-1;//gaussian()
-	    //file = fopen("charge_density.cor", "a");
-            //fprintf(file, "%f\t%f\t%f\n", rand[0], rand[1], rand[2]);
-            //fclose(file);
-            x[i][0] += v[i][0] * dt + f[i][0] * dt * D / T + wienerConst * rand[0];
-            x[i][1] += v[i][1] * dt + f[i][1] * dt * D / T + wienerConst * rand[1];
-            x[i][2] += v[i][2] * dt + f[i][2] * dt * D / T + wienerConst * rand[2];
-	    
+    if (atom->nmax > nmax_rand) {
+        memory->destroy(rand);
+        nmax_rand = atom->nmax;
+        memory->create(rand, nmax_rand, 3, "condiff:rand");
+    }
+    draw_noise(rand);
+
+    if (integrator == BAOAB) {
+#if defined(_OPENMP)
+#pragma omp parallel for default(shared) schedule(static)
+#endif
+        for (int i = 0; i < nlocal; i++) {
+            if (mask[i] & groupbit_condiff) {
+                for (int d = 0; d < 3; d++) {
+                    x[i][d] += v[i][d] * dt + f[i][d] * dtfm
+                        + halfWiener * (rand[i][d] + rand_old[i][d]);
+                    rand_old[i][d] = rand[i][d];
+                }
+            }
+        }
+    }
+    else {
+#if defined(_OPENMP)
+#pragma omp parallel for default(shared) schedule(static)
+#endif
+        for (int i = 0; i < nlocal; i++) {
+            if (mask[i] & groupbit_condiff) {
+                x[i][0] += v[i][0] * dt + f[i][0] * dtfm + wienerConst * rand[i][0];
+                x[i][1] += v[i][1] * dt + f[i][1] * dtfm + wienerConst * rand[i][1];
+                x[i][2] += v[i][2] * dt + f[i][2] * dtfm + wienerConst * rand[i][2];
+            }
         }
     }
 }
 
-//compute_rho1d framework taken from pppm.cpp
-void FixCondiff::compute_rho1d(const FFT_SCALAR& dx, const FFT_SCALAR& dy,
-    const FFT_SCALAR& dz)
+//Fill r with unit variance noise for the condiff particles
+//every thread draws the numbers of its own atom range from its own generator
+void FixCondiff::draw_noise(double** r)
 {
-    int k, l;
-    FFT_SCALAR r1, r2, r3;
-
-    for (k = (1 - order) / 2; k <= order / 2; k++) {
-        r1 = r2 = r3 = ZEROF;
+    int nlocal = atom->nlocal;
+    int* mask = atom->mask;
 
-        for (l = order - 1; l >= 0; l--) {
-            r1 = rho_coeff[l][k] + r1 * dx;
-            r2 = rho_coeff[l][k] + r2 * dy;
-            r3 = rho_coeff[l][k] + r3 * dz;
+#if defined(_OPENMP)
+#pragma omp parallel default(shared)
+#endif
+    {
+        int ifrom, ito, tid;
+        loop_setup_thr(ifrom, ito, tid, nlocal, nrandom);
+        RanMars* rng = random[tid];
+
+        if (noise == GAUSSIAN) {
+            for (int i = ifrom; i < ito; i++)
+                if (mask[i] & groupbit_condiff) {
+                    r[i][0] = rng->gaussian();
+                    r[i][1] = rng->gaussian();
+                    r[i][2] = rng->gaussian();
+                }
+        }
+        else {
+            for (int i = ifrom; i < ito; i++)
+                if (mask[i] & groupbit_condiff) {
+                    r[i][0] = 2 * rng->uniform() - 1;
+                    r[i][1] = 2 * rng->uniform() - 1;
+                    r[i][2] = 2 * rng->uniform() - 1;
+                }
         }
-        rho1d[0][k] = r1;
-        rho1d[1][k] = r2;
-        rho1d[2][k] = r3;
     }
 }
 
+//One generator per thread, thread 0 of every proc uses the usual seed + me
+void FixCondiff::create_random()
+{
+    for (int tid = 0; tid < nrandom; tid++)
+        delete random[tid];
+    delete[] random;
+
+    nrandom = comm->nthreads;
+    random = new RanMars*[nrandom];
+    for (int tid = 0; tid < nrandom; tid++)
+        random[tid] = new RanMars(lmp, seed + me + nprocs * tid);
+}
+
+//Per-atom noise of the last step, only kept for the BAOAB integrator
+void FixCondiff::grow_arrays(int nmax)
+{
+    memory->grow(rand_old, nmax, 3, "condiff:rand_old");
+}
+
+//Noise history of an atom created by create_atoms, fix deposit, ...
+//drawn like the one of the first run, outside of threaded regions
+void FixCondiff::set_arrays(int i)
+{
+    if (noise == GAUSSIAN) {
+        rand_old[i][0] = random[0]->gaussian();
+        rand_old[i][1] = random[0]->gaussian();
+        rand_old[i][2] = random[0]->gaussian();
+    }
+    else {
+        rand_old[i][0] = 2 * random[0]->uniform() - 1;
+        rand_old[i][1] = 2 * random[0]->uniform() - 1;
+        rand_old[i][2] = 2 * random[0]->uniform() - 1;
+    }
+}
+
+void FixCondiff::copy_arrays(int i, int j, int delflag)
+{
+    rand_old[j][0] = rand_old[i][0];
+    rand_old[j][1] = rand_old[i][1];
+    rand_old[j][2] = rand_old[i][2];
+}
+
+int FixCondiff::pack_exchange(int i, double* buf)
+{
+    buf[0] = rand_old[i][0];
+    buf[1] = rand_old[i][1];
+    buf[2] = rand_old[i][2];
+    return 3;
+}
+
+int FixCondiff::unpack_exchange(int nlocal, double* buf)
+{
+    rand_old[nlocal][0] = buf[0];
+    rand_old[nlocal][1] = buf[1];
+    rand_old[nlocal][2] = buf[2];
+    return 3;
+}
+
 //compute_rho_coeff framework taken from pppm.cpp
 void FixCondiff::compute_rho_coeff()
 {
@@ -484,35 +653,12 @@ void FixCondiff::compute_rho_coeff()
         for (l = 0; l < order; l++) {
             rho_coeff[l][m] = a[l][k];
         }
-        for (l = 1; l < order; l++)
-            drho_coeff[l - 1][m] = l * a[l][k];
         m++;
     }
 
     memory->destroy2d_offset(a, -order);
 }
 
-//compute_drho1d framework taken from pppm.cpp
-void FixCondiff::compute_drho1d(const FFT_SCALAR& dx, const FFT_SCALAR& dy,
-    const FFT_SCALAR& dz)
-{
-    int k, l;
-    FFT_SCALAR r1, r2, r3;
-
-    for (k = (1 - order) / 2; k <= order / 2; k++) {
-        r1 = r2 = r3 = ZEROF;
-
-        for (l = order - 2; l >= 0; l--) {
-            r1 = drho_coeff[l][k] + r1 * dx;
-            r2 = drho_coeff[l][k] + r2 * dy;
-            r3 = drho_coeff[l][k] + r3 * dz;
-        }
-        drho1d[0][k] = r1;
-        drho1d[1][k] = r2;
-        drho1d[2][k] = r3;
-    }
-}
-
 //set_grid_local() framework taken from pppm.cpp
 void FixCondiff::set_grid_local()
 {
@@ -601,58 +747,203 @@ void FixCondiff::set_grid_local()
     ngrid = (nxhi_out - nxlo_out + 1) * (nyhi_out - nylo_out + 1) * (nzhi_out - nzlo_out + 1);
 }
 
-//deallocate() framework taken from pppm.cpp
-void FixCondiff::deallocate()
+//Flat index of grid point (ix,iy,iz) in the interleaved brick
+bigint FixCondiff::grid_index(int ix, int iy, int iz)
+{
+    return (bigint)(iz - nzlo_out) * zstride + (bigint)(iy - nylo_out) * ystride + (ix - nxlo_out);
+}
+
+//ghost_setup() exchanges the number of ghost planes with the 6 neighbors
+//ghost planes of a neighbor overlap my owned planes at the opposite side
+//swaps are done per dimension, so corners are passed on in two or three hops
+void FixCondiff::ghost_setup()
+{
+    int nin[3] = { nxhi_in - nxlo_in + 1, nyhi_in - nylo_in + 1, nzhi_in - nzlo_in + 1 };
+    int nout[3] = { nxhi_out - nxlo_out + 1, nyhi_out - nylo_out + 1, nzhi_out - nzlo_out + 1 };
+
+    ghost_lo[0] = nxlo_in - nxlo_out;
+    ghost_hi[0] = nxhi_out - nxhi_in;
+    ghost_lo[1] = nylo_in - nylo_out;
+    ghost_hi[1] = nyhi_out - nyhi_in;
+    ghost_lo[2] = nzlo_in - nzlo_out;
+    ghost_hi[2] = nzhi_out - nzhi_in;
+
+    MPI_Status status;
+    int flag = 0;
+    int nmax = 0;
+    for (int d = 0; d < 3; d++) {
+        MPI_Sendrecv(&ghost_lo[d], 1, MPI_INT, comm->procneigh[d][0], 0,
+            &recv_hi[d], 1, MPI_INT, comm->procneigh[d][1], 0, world, &status);
+        MPI_Sendrecv(&ghost_hi[d], 1, MPI_INT, comm->procneigh[d][1], 0,
+            &recv_lo[d], 1, MPI_INT, comm->procneigh[d][0], 0, world, &status);
+        if (ghost_lo[d] > nin[d] || ghost_hi[d] > nin[d] || recv_lo[d] > nin[d] || recv_hi[d] > nin[d])
+            flag = 1;
+
+        //largest plane stack of this dimension, cross section with ghosts
+        int area = 1;
+        for (int e = 0; e < 3; e++)
+            if (e != d)
+                area *= nout[e];
+        int nplanes = MAX(MAX(ghost_lo[d], ghost_hi[d]), MAX(recv_lo[d], recv_hi[d]));
+        nmax = MAX(nmax, nplanes * area);
+    }
+
+    int flagall;
+    MPI_Allreduce(&flag, &flagall, 1, MPI_INT, MPI_MAX, world);
+    if (flagall)
+        error->all(FLERR, "Fix condiff ghost grid extends beyond neighbor proc");
+
+    nmax *= NBRICK;
+    if (nmax > nbuf) {
+        nbuf = nmax;
+        memory->destroy(buf1);
+        memory->destroy(buf2);
+        memory->create(buf1, nbuf, "condiff:buf1");
+        memory->create(buf2, nbuf, "condiff:buf2");
+    }
+}
+
+//pack the NBRICK communicated components of a sub-brick into one message
+int FixCondiff::pack_grid(FFT_SCALAR* buf, const int* lo, const int* hi)
+{
+    int n = 0;
+    for (int iz = lo[2]; iz <= hi[2]; iz++)
+        for (int iy = lo[1]; iy <= hi[1]; iy++) {
+            const FFT_SCALAR* g = brick + grid_index(lo[0], iy, iz) * NCOMP;
+            for (int ix = lo[0]; ix <= hi[0]; ix++, g += NCOMP)
+                for (int c = 0; c < NBRICK; c++)
+                    buf[n++] = g[c];
+        }
+    return n;
+}
+
+//unpack one message into a sub-brick, summing or overwriting
+void FixCondiff::unpack_grid(const FFT_SCALAR* buf, const int* lo, const int* hi, int sumflag)
+{
+    int n = 0;
+    for (int iz = lo[2]; iz <= hi[2]; iz++)
+        for (int iy = lo[1]; iy <= hi[1]; iy++) {
+            FFT_SCALAR* g = brick + grid_index(lo[0], iy, iz) * NCOMP;
+            for (int ix = lo[0]; ix <= hi[0]; ix++, g += NCOMP) {
+                if (sumflag)
+                    for (int c = 0; c < NBRICK; c++)
+                        g[c] += buf[n++];
+                else
+                    for (int c = 0; c < NBRICK; c++)
+                        g[c] = buf[n++];
+            }
+        }
+}
+
+//send sub-brick (slo,shi) to proc sendproc, receive into (rlo,rhi) from recvproc
+void FixCondiff::swap_grid(int sendproc, const int* slo, const int* shi,
+    int recvproc, const int* rlo, const int* rhi, int sumflag)
+{
+    MPI_Request request;
+    int nrecv = NBRICK;
+    for (int d = 0; d < 3; d++)
+        nrecv *= MAX(rhi[d] - rlo[d] + 1, 0);
+
+    MPI_Irecv(buf2, nrecv, MPI_FFT_SCALAR, recvproc, 0, world, &request);
+    int nsend = pack_grid(buf1, slo, shi);
+    MPI_Send(buf1, nsend, MPI_FFT_SCALAR, sendproc, 0, world);
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    unpack_grid(buf2, rlo, rhi, sumflag);
+}
+
+//reverse_comm_grid() sums the ghost cells into the procs owning them
+//dimension d swaps cover the full ghost range of the dimensions after d,
+//and only the owned range of the dimensions already done
+void FixCondiff::reverse_comm_grid()
+{
+    int in_lo[3] = { nxlo_in, nylo_in, nzlo_in };
+    int in_hi[3] = { nxhi_in, nyhi_in, nzhi_in };
+    int out_lo[3] = { nxlo_out, nylo_out, nzlo_out };
+    int out_hi[3] = { nxhi_out, nyhi_out, nzhi_out };
+
+    for (int d = 0; d < 3; d++) {
+        int slo[3], shi[3], rlo[3], rhi[3];
+        for (int e = 0; e < 3; e++) {
+            slo[e] = rlo[e] = (e < d) ? in_lo[e] : out_lo[e];
+            shi[e] = rhi[e] = (e < d) ? in_hi[e] : out_hi[e];
+        }
+
+        //my upper ghosts to the upper neighbor, its lower ghosts onto my lower owned planes
+        slo[d] = in_hi[d] + 1;
+        shi[d] = out_hi[d];
+        rlo[d] = in_lo[d];
+        rhi[d] = in_lo[d] + recv_lo[d] - 1;
+        swap_grid(comm->procneigh[d][1], slo, shi, comm->procneigh[d][0], rlo, rhi, 1);
+
+        //my lower ghosts to the lower neighbor
+        slo[d] = out_lo[d];
+        shi[d] = in_lo[d] - 1;
+        rlo[d] = in_hi[d] - recv_hi[d] + 1;
+        rhi[d] = in_hi[d];
+        swap_grid(comm->procneigh[d][0], slo, shi, comm->procneigh[d][1], rlo, rhi, 1);
+    }
+}
+
+//forward_comm_grid() copies owned cells into the ghost cells of the neighbors
+//same swaps as reverse_comm_grid() in opposite order and direction
+void FixCondiff::forward_comm_grid()
 {
-    memory->destroy3d_offset(density_brick_velocity_x, nzlo_out, nylo_out, nxlo_out);
-    memory->destroy3d_offset(density_brick_counter_x, nzlo_out, nylo_out, nxlo_out);
-    memory->destroy3d_offset(density_brick_force_x, nzlo_out, nylo_out, nxlo_out);
-    memory->destroy3d_offset(density_brick_velocity_y, nzlo_out, nylo_out, nxlo_out);
+    int in_lo[3] = { nxlo_in, nylo_in, nzlo_in };
+    int in_hi[3] = { nxhi_in, nyhi_in, nzhi_in };
+    int out_lo[3] = { nxlo_out, nylo_out, nzlo_out };
+    int out_hi[3] = { nxhi_out, nyhi_out, nzhi_out };
+
+    for (int d = 2; d >= 0; d--) {
+        int slo[3], shi[3], rlo[3], rhi[3];
+        for (int e = 0; e < 3; e++) {
+            slo[e] = rlo[e] = (e < d) ? in_lo[e] : out_lo[e];
+            shi[e] = rhi[e] = (e < d) ? in_hi[e] : out_hi[e];
+        }
 
-    memory->destroy3d_offset(density_brick_force_y, nzlo_out, nylo_out, nxlo_out);
-    memory->destroy3d_offset(density_brick_velocity_z, nzlo_out, nylo_out, nxlo_out);
+        //my lower owned planes fill the upper ghosts of the lower neighbor
+        slo[d] = in_lo[d];
+        shi[d] = in_lo[d] + recv_lo[d] - 1;
+        rlo[d] = in_hi[d] + 1;
+        rhi[d] = out_hi[d];
+        swap_grid(comm->procneigh[d][0], slo, shi, comm->procneigh[d][1], rlo, rhi, 0);
+
+        //my upper owned planes fill the lower ghosts of the upper neighbor
+        slo[d] = in_hi[d] - recv_hi[d] + 1;
+        shi[d] = in_hi[d];
+        rlo[d] = out_lo[d];
+        rhi[d] = in_lo[d] - 1;
+        swap_grid(comm->procneigh[d][1], slo, shi, comm->procneigh[d][0], rlo, rhi, 0);
+    }
+}
 
-    memory->destroy3d_offset(density_brick_force_z, nzlo_out, nylo_out, nxlo_out);
+//deallocate() framework taken from pppm.cpp
+void FixCondiff::deallocate()
+{
+    memory->destroy(brick);
 
-    memory->destroy2d_offset(rho1d, -order_allocated / 2);
-    memory->destroy2d_offset(drho1d, -order_allocated / 2);
     memory->destroy2d_offset(rho_coeff, (1 - order_allocated) / 2);
-    memory->destroy2d_offset(drho_coeff, (1 - order_allocated) / 2);
 
-    memory->destroy(rand);
+    //stencil width depends on the order
+    memory->destroy(stencil_base);
+    memory->destroy(stencil_w);
+    nmax = 0;
+
+    brick = NULL;
+    rho_coeff = NULL;
+    stencil_base = NULL;
+    stencil_w = NULL;
 }
 
 //allocate() framework taken from pppm.cpp
+//one brick with NCOMP interleaved values per grid point
 void FixCondiff::allocate()
 {
-    memory->create3d_offset(density_brick_velocity_x, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_velocity_x");
-    memory->create3d_offset(density_brick_counter_x, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_counter_x");
-    memory->create3d_offset(density_brick_force_x, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_force_x");
-    memory->create3d_offset(density_brick_velocity_y, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_velocity_y");
-
-    memory->create3d_offset(density_brick_force_y, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_force_y");
-    memory->create3d_offset(density_brick_velocity_z, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_velocity_z");
-
-    memory->create3d_offset(density_brick_force_z, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_force_z");
+    ystride = nxhi_out - nxlo_out + 1;
+    zstride = ystride * (nyhi_out - nylo_out + 1);
+    memory->create(brick, (bigint)ngrid * NCOMP, "condiff:brick");
 
     order_allocated = order;
-    memory->create2d_offset(rho1d, 3, -order / 2, order / 2, "condiff:rho1d");
-    memory->create2d_offset(drho1d, 3, -order / 2, order / 2, "condiff:drho1d");
     memory->create2d_offset(rho_coeff, order, (1 - order) / 2, order / 2, "condiff:rho_coeff");
-    memory->create2d_offset(drho_coeff, order, (1 - order) / 2, order / 2,
-        "condiff:drho_coeff");
-
-    memory->create(rand, 3, "condiff:rand");
-
-    // create ghost grid object for rho and velocity field communication
-    //int (*procneigh)[2] = comm->procneigh;
 }
 
 //check if pppm computation is used
@@ -35,11 +35,18 @@ public:
     FixCondiff(class LAMMPS*, int, char**);
     ~FixCondiff();
     int setmask();
+    void init();
     void post_force(int);
     void final_integrate();
     void kspace_check();
     void pppm_check();
 
+    void grow_arrays(int);
+    void copy_arrays(int, int, int);
+    void set_arrays(int);
+    int pack_exchange(int, double*);
+    int unpack_exchange(int, double*);
+
 protected:
     void setup();
     virtual void assign_vf();
@@ -47,25 +54,50 @@ protected:
     void euler_step();
     void deallocate();
     void allocate();
-    void compute_rho1d(const FFT_SCALAR&, const FFT_SCALAR&,
-        const FFT_SCALAR&);
     void compute_rho_coeff();
-    void compute_drho1d(const FFT_SCALAR&, const FFT_SCALAR&, const FFT_SCALAR&);
     void set_grid_local();
     void setup_grid();
-
-    FFT_SCALAR*** density_brick_velocity_x;
-    FFT_SCALAR*** density_brick_velocity_y;
-    FFT_SCALAR*** density_brick_velocity_z;
-    FFT_SCALAR*** density_brick_counter_x;
-
-    FFT_SCALAR*** density_brick_force_x;
-    FFT_SCALAR*** density_brick_force_y;
-    FFT_SCALAR*** density_brick_force_z;
-
-    double* rand;
-
-    FFT_SCALAR **rho1d, **rho_coeff, **drho1d, **drho_coeff;
+    int grid_changed();
+
+    //ghost grid communication
+    void ghost_setup();
+    int pack_grid(FFT_SCALAR*, const int*, const int*);
+    void unpack_grid(const FFT_SCALAR*, const int*, const int*, int);
+    void swap_grid(int, const int*, const int*, int, const int*, const int*, int);
+    void reverse_comm_grid();
+    void forward_comm_grid();
+
+    //interleaved grid: velocity, counter, force and 1/counter per point
+    enum { VX, VY, VZ, CNT, FX, FY, FZ, INV, NCOMP };
+    FFT_SCALAR* brick;
+    int ystride, zstride;
+    bigint grid_index(int, int, int);
+    void normalize_grid();
+
+    //per-atom stencil: lower left grid point and 1d weights
+    void make_stencil(int);
+    bigint* stencil_base;
+    FFT_SCALAR** stencil_w;
+
+    //noise and integrator options
+    enum { UNIFORM, GAUSSIAN };
+    enum { EULER, BAOAB };
+    int noise, integrator;
+    void draw_noise(double**);
+    void create_random();
+
+    double** rand; //noise of this step, per atom
+    double** rand_old; //noise of the last step, per atom (baoab)
+    int nmax_rand;
+    int first;
+
+    static const int NBRICK = 7; //communicated components, INV is local
+    int ghost_lo[3], ghost_hi[3]; //my ghost planes per dimension
+    int recv_lo[3], recv_hi[3]; //ghost planes of the neighbors on my owned planes
+    FFT_SCALAR *buf1, *buf2;
+    int nbuf;
+
+    FFT_SCALAR **rho_coeff;
 
     int order, minorder, order_allocated;
 
@@ -95,7 +127,12 @@ protected:
     int nxlo_out, nylo_out, nzlo_out, nxhi_out, nyhi_out, nzhi_out;
     int ngrid;
 
-    class RanMars* random;
+    //Signature of the allocated grid
+    int nx_grid, ny_grid, nz_grid, order_grid;
+    double sublo_grid[3], subhi_grid[3], prd_grid[3];
+
+    class RanMars** random; //one generator per thread
+    int nrandom;
 
     int nmax;
 
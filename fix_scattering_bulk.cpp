@@ -11,6 +11,7 @@
    See the README file in the top-level LAMMPS directory.
 ------------------------------------------------------------------------- */
 
+#include "math.h"
 #include "stdlib.h"
 #include "string.h"
 #include "unistd.h"
@@ -28,15 +29,23 @@
 #include "force.h"
 #include "atom.h"
 #include "comm.h"
+#include "kiss_fft.h"
 #include <sstream>
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
 
+enum{AXES,SHELL};
+
+#define TILE 64
+
+#define OFFSET 16384
+#define MAXORDER 7
+
 FixScatteringBulk::FixScatteringBulk(LAMMPS * lmp, int narg, char **arg):
   Fix (lmp, narg, arg)
 {
-  if (narg < 10) error->all(FLERR,"Illegal fix scattering/bulk command");
+  if (narg < 11) error->all(FLERR,"Illegal fix scattering/bulk command");
   nevery = force->inumeric(FLERR,arg[3]);
   nrelax = force->inumeric(FLERR,arg[4]);
   N_blocks = force->inumeric(FLERR,arg[5]);
@@ -45,13 +54,118 @@ FixScatteringBulk::FixScatteringBulk(LAMMPS * lmp, int narg, char **arg):
   N_levels_msd = force->inumeric(FLERR,arg[8]);
    N_cor = force->inumeric(FLERR,arg[9]);
     nFunCorr = force->inumeric(FLERR,arg[10]);
+
+  // optional keywords
+
+  kspace = AXES;
+  dk_shell = kmax_shell = 0.0;
+  gridflag = 0;
+  ngx = ngy = ngz = 0;
+  grid_order = 0;
+
+  int iarg = 11;
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"shell") == 0) {
+      if (iarg+3 > narg) error->all(FLERR,"Illegal fix scattering/bulk command");
+      kspace = SHELL;
+      dk_shell = force->numeric(FLERR,arg[iarg+1]);
+      kmax_shell = force->numeric(FLERR,arg[iarg+2]);
+      if (dk_shell <= 0.0 || kmax_shell < dk_shell)
+        error->all(FLERR,"Illegal fix scattering/bulk command");
+      iarg += 3;
+    } else if (strcmp(arg[iarg],"grid") == 0) {
+      if (iarg+5 > narg) error->all(FLERR,"Illegal fix scattering/bulk command");
+      gridflag = 1;
+      ngx = force->inumeric(FLERR,arg[iarg+1]);
+      ngy = force->inumeric(FLERR,arg[iarg+2]);
+      ngz = force->inumeric(FLERR,arg[iarg+3]);
+      grid_order = force->inumeric(FLERR,arg[iarg+4]);
+      if (ngx <= 0 || ngy <= 0 || ngz <= 0)
+        error->all(FLERR,"Illegal fix scattering/bulk command");
+      if (grid_order < 2 || grid_order > MAXORDER)
+        error->all(FLERR,"Fix scattering/bulk grid order must be between 2 and 7");
+      iarg += 5;
+    } else error->all(FLERR,"Illegal fix scattering/bulk command");
+  }
+  if (gridflag && kspace != SHELL)
+    error->all(FLERR,"Fix scattering/bulk grid requires the shell keyword");
+
+  if (N_blocks % N_count != 0) error->all(FLERR,"FixScatteringBulk N_blocks mod N_count must be 0");
+  dmin = N_blocks/N_count;
+  
+  if (nrelax % nevery != 0) error->all(FLERR,"FixScatteringBulk nrelax mod nevery must be 0");
+
+  MPI_Comm_rank(world,&me);
+
+  restart_global = 1;
+  restart_peratom = 1;
+
+  // self part is stored per atom and migrates with the atoms:
+  // last unwrapped position, blocking sums of the displacements,
+  // VACF shift registers and accumulators, and the history of x,v,f
+  off_pos = 0;
+  off_block = off_pos + 3;
+  off_vshift = off_block + 3*N_blocks*N_levels_msd;
+  off_vacc = off_vshift + 3*N_blocks*N_levels;
+  off_hist = off_vacc + 3*N_levels;
+  nperatom = off_hist + 9*N_cor;
+
+  peratom = NULL;
+  glist = NULL;
+  maxglist = 0;
+  SetupChannels();
+  AllocArrays();
+
+  // statistics are kept over successive runs
+
+  for (int j=0; j<ncol; j++) {
+    strucFac[j]=0.0;
+  }
+  
+  t_loc = 0;
+  count = 0;
+  
+  ZeroSpacetimeCorr ();
+  ZeroSpacetimeCorrIn ();
+  ZeroSpacetimeCorrIn2 ();
 }
 
 /* ---------------------------------------------------------------------- */
 
 FixScatteringBulk::~FixScatteringBulk()
 {
-  
+  atom->delete_callback(id,0);
+  atom->delete_callback(id,1);
+  memory->destroy(peratom);
+  memory->destroy(chan_col);
+  memory->destroy(ncol_chan);
+  memory->destroy(kcol);
+  memory->destroy(krow);
+  memory->destroy(rhok);
+  memory->destroy(gridrho);
+  memory->destroy2d_offset(rho_coeff,(1-grid_order)/2);
+  memory->destroy(winv);
+  if (fftbuf) free(fftbuf);
+  if (fftwork) free(fftwork);
+  for (int d = 0; d < 3; d++)
+    if (fftcfg[d]) free(fftcfg[d]);
+
+  free (valST);
+  free (strucFac);
+  FreeMem2 (correlationIn);
+  FreeMem2 (MSD);
+  FreeMem2 (NGP);
+  FreeMem2 (countIn);
+  free (countMSD);
+  free (countNGP);
+  delete corST;
+  delete corVACF;
+  FreeMem2 (correlationVACF);
+  FreeMem2 (correlationIn2);
+  free (countIn2);
+  free (act_level);
+  free (act_block);
+  memory->destroy(glist);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -67,24 +181,20 @@ int FixScatteringBulk::setmask()
 
 void FixScatteringBulk::init() {
 
-  AllocArrays();
-  
-  if (N_blocks % N_count != 0) error->all(FLERR,"FixScatteringBulk N_blocks mod N_count must be 0");
-  dmin = N_blocks/N_count;
-  
-  if (nrelax % nevery != 0) error->all(FLERR,"FixScatteringBulk nrelax mod nevery must be 0");
+  // normalization by all atoms in the group, not only the local ones
 
-  for (int j=0; j<nFunCorr; j++) {
-    strucFac[j]=0.0;
+  natoms = group->count(igroup);
+  if (natoms == 0) error->all(FLERR,"FixScatteringBulk group has no atoms");
+
+  // the k-shells, their channels and |k| labels are set up once from the
+  // box of the constructor, the correlator cannot change its channels
+  if (kspace == SHELL) {
+    if (domain->box_change_size || domain->box_change_shape)
+      error->all(FLERR,"Fix scattering/bulk shell requires a fixed box");
+    for (int d = 0; d < 3; d++)
+      if (domain->prd[d] != prd_shell[d])
+        error->all(FLERR,"Fix scattering/bulk shell requires a fixed box");
   }
-  
-  t_loc = 0;
-  kmax = 0;
-  count = 0;
-  
-  ZeroSpacetimeCorr ();
-  ZeroSpacetimeCorrIn ();
-  ZeroSpacetimeCorrIn2 ();
 }
 
 /* ---------------------------------------------------------------------- */
@@ -101,8 +211,679 @@ void FixScatteringBulk::end_of_step() {
   if (update->ntimestep % nevery == 0)
     EvalSpacetimeCorr ();
   
-  if (update->nsteps == update->ntimestep && t_loc != 0) {
-   AccumSpacetimeCorr();
+  // intermediate output at the end of a run, the statistics continue
+  // in the next run or from a restart file
+  if (update->ntimestep == update->laststep && t_loc != 0) {
+   AccumSpacetimeCorr(0);
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+double FixScatteringBulk::memory_usage()
+{
+  double bytes = atom->nmax * nperatom * sizeof(double);
+  bytes += (N_blocks*N_levels_msd * (2*nFunCorr + 9)) * sizeof(real);
+  bytes += corST->memory_usage() + corVACF->memory_usage();
+  bytes += N_blocks*N_levels * 3 * sizeof(real);
+  bytes += (nchan + 5*nkrow) * sizeof(int) + 2*nchan * sizeof(double);
+  if (gridflag) {
+    bytes += (double) ngx*ngy*ngz * sizeof(double);
+    if (me == 0) bytes += (double) ngx*ngy*ngz * sizeof(kiss_fft_cpx);
+  }
+  bytes += N_cor * (9*nFunCorr + 1) * sizeof(real);
+  return bytes;
+}
+
+/* ----------------------------------------------------------------------
+   allocate atom-based array
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::grow_arrays(int nmax)
+{
+  memory->grow(peratom,nmax,nperatom,"scattering/bulk:peratom");
+}
+
+/* ----------------------------------------------------------------------
+   copy values within local atom-based array
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::copy_arrays(int i, int j, int delflag)
+{
+  memcpy(peratom[j],peratom[i],nperatom*sizeof(double));
+}
+
+/* ----------------------------------------------------------------------
+   pack values in local atom-based array for exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixScatteringBulk::pack_exchange(int i, double *buf)
+{
+  for (int k = 0; k < nperatom; k++) buf[k] = peratom[i][k];
+  return nperatom;
+}
+
+/* ----------------------------------------------------------------------
+   unpack values in local atom-based array from exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixScatteringBulk::unpack_exchange(int nlocal, double *buf)
+{
+  for (int k = 0; k < nperatom; k++) peratom[nlocal][k] = buf[k];
+  return nperatom;
+}
+
+/* ----------------------------------------------------------------------
+   pack values in local atom-based array for restart file
+------------------------------------------------------------------------- */
+
+int FixScatteringBulk::pack_restart(int i, double *buf)
+{
+  buf[0] = nperatom+1;
+  for (int k = 0; k < nperatom; k++) buf[k+1] = peratom[i][k];
+  return nperatom+1;
+}
+
+/* ----------------------------------------------------------------------
+   unpack values from atom->extra array to restart the fix
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::unpack_restart(int nlocal, int nth)
+{
+  double **extra = atom->extra;
+
+  // skip to Nth set of extra values
+
+  int m = 0;
+  for (int i = 0; i < nth; i++) m += static_cast<int> (extra[nlocal][m]);
+  m++;
+
+  for (int k = 0; k < nperatom; k++) peratom[nlocal][k] = extra[nlocal][m++];
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixScatteringBulk::maxsize_restart()
+{
+  return nperatom+1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixScatteringBulk::size_restart(int nlocal)
+{
+  return nperatom+1;
+}
+
+/* ----------------------------------------------------------------------
+   running sums of the self parts are partial sums over the local atoms
+------------------------------------------------------------------------- */
+
+int FixScatteringBulk::size_partial()
+{
+  int nblk = N_blocks*N_levels_msd;
+  return 3*N_blocks*N_levels + nblk*(2*nFunCorr + 9) + N_cor*(9*nFunCorr + 1);
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixScatteringBulk::pack_partial(double *buf)
+{
+  int i, n = 0;
+  int nblk = N_blocks*N_levels_msd;
+  for (i = 0; i < 3*N_blocks*N_levels; i++) buf[n++] = correlationVACF[0][i];
+  for (i = 0; i < nblk*nFunCorr; i++) buf[n++] = correlationIn[0][i];
+  for (i = 0; i < nblk*nFunCorr; i++) buf[n++] = countIn[0][i];
+  for (i = 0; i < 3*nblk; i++) buf[n++] = MSD[0][i];
+  for (i = 0; i < 4*nblk; i++) buf[n++] = NGP[0][i];
+  for (i = 0; i < nblk; i++) buf[n++] = countMSD[i];
+  for (i = 0; i < nblk; i++) buf[n++] = countNGP[i];
+  for (i = 0; i < 9*nFunCorr*N_cor; i++) buf[n++] = correlationIn2[0][i];
+  for (i = 0; i < N_cor; i++) buf[n++] = countIn2[i];
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixScatteringBulk::unpack_partial(double *buf)
+{
+  int i, n = 0;
+  int nblk = N_blocks*N_levels_msd;
+  for (i = 0; i < 3*N_blocks*N_levels; i++) correlationVACF[0][i] = buf[n++];
+  for (i = 0; i < nblk*nFunCorr; i++) correlationIn[0][i] = buf[n++];
+  for (i = 0; i < nblk*nFunCorr; i++) countIn[0][i] = static_cast<int> (buf[n++]);
+  for (i = 0; i < 3*nblk; i++) MSD[0][i] = buf[n++];
+  for (i = 0; i < 4*nblk; i++) NGP[0][i] = buf[n++];
+  for (i = 0; i < nblk; i++) countMSD[i] = static_cast<int> (buf[n++]);
+  for (i = 0; i < nblk; i++) countNGP[i] = static_cast<int> (buf[n++]);
+  for (i = 0; i < 9*nFunCorr*N_cor; i++) correlationIn2[0][i] = buf[n++];
+  for (i = 0; i < N_cor; i++) countIn2[i] = static_cast<int> (buf[n++]);
+}
+
+/* ----------------------------------------------------------------------
+   write data into restart file:
+   - settings, step counters, structure factor and both correlators
+   - self sums, reduced to proc 0
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::write_restart(FILE *fp)
+{
+  int npart = size_partial();
+  double *part, *list;
+  memory->create(part,npart,"scattering/bulk:part");
+  pack_partial(part);
+  if (me == 0) {
+    int nsize = 12 + ncol + corST->size_restart() + corVACF->size_restart() + npart;
+    memory->create(list,nsize,"scattering/bulk:list");
+  } else list = NULL;
+  int nhead = 12 + ncol + corST->size_restart() + corVACF->size_restart();
+  MPI_Reduce(part,(me == 0) ? &list[nhead] : NULL,npart,MPI_DOUBLE,MPI_SUM,0,world);
+  memory->destroy(part);
+
+  if (me == 0) {
+    int n = 0;
+    list[n++] = N_blocks;
+    list[n++] = N_count;
+    list[n++] = N_levels;
+    list[n++] = N_levels_msd;
+    list[n++] = N_cor;
+    list[n++] = nFunCorr;
+    list[n++] = nchan;
+    list[n++] = ncol;
+    list[n++] = nrelax;
+    list[n++] = t_loc;
+    list[n++] = count;
+    list[n++] = lastindex;
+    for (int m = 0; m < ncol; m++) list[n++] = strucFac[m];
+    n += corST->pack_restart(&list[n]);
+    n += corVACF->pack_restart(&list[n]);
+    n += npart;
+
+    int size = n * sizeof(double);
+    fwrite(&size,sizeof(int),1,fp);
+    fwrite(list,sizeof(double),n,fp);
+    memory->destroy(list);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   use state info from restart file to restart the fix
+   self sums are only kept by proc 0 so that the next reduction
+   does not count them nprocs times
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::restart(char *buf)
+{
+  double *list = (double *) buf;
+  int n = 0;
+
+  if (static_cast<int> (list[n++]) != N_blocks ||
+      static_cast<int> (list[n++]) != N_count ||
+      static_cast<int> (list[n++]) != N_levels ||
+      static_cast<int> (list[n++]) != N_levels_msd ||
+      static_cast<int> (list[n++]) != N_cor ||
+      static_cast<int> (list[n++]) != nFunCorr ||
+      static_cast<int> (list[n++]) != nchan ||
+      static_cast<int> (list[n++]) != ncol ||
+      static_cast<int> (list[n++]) != nrelax)
+    error->all(FLERR,"Fix scattering/bulk settings changed since restart");
+
+  t_loc = static_cast<int> (list[n++]);
+  count = static_cast<int> (list[n++]);
+  lastindex = static_cast<int> (list[n++]);
+  for (int m = 0; m < ncol; m++) strucFac[m] = list[n++];
+
+  int m = corST->unpack_restart(&list[n]);
+  if (m < 0) error->all(FLERR,"Fix scattering/bulk settings changed since restart");
+  n += m;
+  m = corVACF->unpack_restart(&list[n]);
+  if (m < 0) error->all(FLERR,"Fix scattering/bulk settings changed since restart");
+  n += m;
+
+  if (me == 0) unpack_partial(&list[n]);
+}
+
+/* ----------------------------------------------------------------------
+   e^{i n theta} for n = -nmax..nmax, stored at index n+nmax
+------------------------------------------------------------------------- */
+
+static inline void phase_factors(double theta, int nmax, double *re, double *im)
+{
+  const double c = cos(theta);
+  const double s = sin(theta);
+  re[nmax] = 1.0;
+  im[nmax] = 0.0;
+  for (int n = 1; n <= nmax; n++) {
+    re[nmax+n] = re[nmax+n-1]*c - im[nmax+n-1]*s;
+    im[nmax+n] = re[nmax+n-1]*s + im[nmax+n-1]*c;
+    re[nmax-n] = re[nmax+n];
+    im[nmax-n] = -im[nmax+n];
+  }
+}
+
+/* ----------------------------------------------------------------------
+   set up the complex channels of the coherent correlator and the
+   output column (axis harmonic or k-shell) each of them contributes to
+   AXES:  channel kp*nFunCorr+m is harmonic m+1 of 2 pi/xprd along axis kp
+   SHELL: one channel per k-vector with |k| <= kmax_shell in one half space,
+          stored as rows of contiguous nz: nx, ny, nzlo, length, 1st channel
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::SetupChannels()
+{
+  krow = NULL;
+  nkrow = 0;
+  rhok = NULL;
+  gridrho = NULL;
+  rho_coeff = NULL;
+  winv = NULL;
+  fftbuf = fftwork = NULL;
+  fftcfg[0] = fftcfg[1] = fftcfg[2] = NULL;
+
+  if (kspace == AXES) {
+    nchan = 3*nFunCorr;
+    ncol = nFunCorr;
+    memory->create(chan_col,nchan,"scattering/bulk:chan_col");
+    memory->create(ncol_chan,ncol,"scattering/bulk:ncol_chan");
+    memory->create(kcol,ncol,"scattering/bulk:kcol");
+    for (int kp = 0; kp < 3; kp++)
+      for (int m = 0; m < nFunCorr; m++) chan_col[kp*nFunCorr+m] = m;
+    for (int m = 0; m < ncol; m++) ncol_chan[m] = 3;
+    return;
+  }
+
+  if (domain->triclinic)
+    error->all(FLERR,"Fix scattering/bulk shell requires an orthogonal box");
+
+  double kunit[3];
+  kunit[0] = 2. * M_PI / domain->xprd;
+  kunit[1] = 2. * M_PI / domain->yprd;
+  kunit[2] = 2. * M_PI / domain->zprd;
+  for (int d = 0; d < 3; d++) prd_shell[d] = domain->prd[d];
+  for (int d = 0; d < 3; d++) nkmax[d] = static_cast<int> (kmax_shell/kunit[d]);
+
+  ncol = static_cast<int> (ceil(kmax_shell/dk_shell));
+  const double kmax2 = kmax_shell*kmax_shell;
+
+  // count rows and channels first, then fill them
+
+  for (int pass = 0; pass < 2; pass++) {
+    nkrow = nchan = 0;
+    for (int nx = 0; nx <= nkmax[0]; nx++)
+      for (int ny = -nkmax[1]; ny <= nkmax[1]; ny++) {
+        if (nx == 0 && ny < 0) continue;
+        double rem = kmax2 - Sqr(nx*kunit[0]) - Sqr(ny*kunit[1]);
+        if (rem < 0.0) continue;
+        int nzhi = MIN(static_cast<int> (sqrt(rem)/kunit[2]),nkmax[2]);
+        int nzlo = (nx == 0 && ny == 0) ? 1 : -nzhi;
+        if (nzlo > nzhi) continue;
+        if (pass) {
+          krow[nkrow][0] = nx;
+          krow[nkrow][1] = ny;
+          krow[nkrow][2] = nzlo;
+          krow[nkrow][3] = nzhi-nzlo+1;
+          krow[nkrow][4] = nchan;
+          for (int nz = nzlo; nz <= nzhi; nz++) {
+            double kval = sqrt(Sqr(nx*kunit[0]) + Sqr(ny*kunit[1]) + Sqr(nz*kunit[2]));
+            int m = MIN(static_cast<int> (kval/dk_shell),ncol-1);
+            chan_col[nchan+nz-nzlo] = m;
+            ncol_chan[m]++;
+            kcol[m] += kval;
+          }
+        }
+        nkrow++;
+        nchan += nzhi-nzlo+1;
+      }
+
+    if (nchan == 0)
+      error->all(FLERR,"Fix scattering/bulk shell contains no k-vectors");
+
+    if (pass == 0) {
+      memory->create(krow,nkrow,5,"scattering/bulk:krow");
+      memory->create(chan_col,nchan,"scattering/bulk:chan_col");
+      memory->create(ncol_chan,ncol,"scattering/bulk:ncol_chan");
+      memory->create(kcol,ncol,"scattering/bulk:kcol");
+      for (int m = 0; m < ncol; m++) {
+        ncol_chan[m] = 0;
+        kcol[m] = 0.0;
+      }
+    }
+  }
+
+  for (int m = 0; m < ncol; m++)
+    if (ncol_chan[m]) kcol[m] /= ncol_chan[m];
+
+  memory->create(rhok,2*nchan,"scattering/bulk:rhok");
+
+  if (gridflag) SetupGrid();
+}
+
+/* ----------------------------------------------------------------------
+   replicated density grid for the FFT evaluation of rho(k)
+   all k-vectors of the shells must lie below the Nyquist index
+   winv = inverse Fourier transform of the B-spline assignment per axis
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::SetupGrid()
+{
+  int ng[3];
+  ng[0] = ngx;
+  ng[1] = ngy;
+  ng[2] = ngz;
+  for (int d = 0; d < 3; d++)
+    if (2*nkmax[d] >= ng[d])
+      error->all(FLERR,"Fix scattering/bulk grid too coarse for shell kmax");
+
+  ngridfft = ngx*ngy*ngz;
+  memory->create(gridrho,ngridfft,"scattering/bulk:gridrho");
+  memory->create2d_offset(rho_coeff,grid_order,(1-grid_order)/2,grid_order/2,
+                          "scattering/bulk:rho_coeff");
+  compute_rho_coeff();
+
+  int nkmaxall = MAX(nkmax[0],MAX(nkmax[1],nkmax[2]));
+  memory->create(winv,3,2*nkmaxall+1,"scattering/bulk:winv");
+  for (int d = 0; d < 3; d++)
+    for (int n = -nkmax[d]; n <= nkmax[d]; n++) {
+      double arg = M_PI * n / ng[d];
+      double sinc = (n == 0) ? 1.0 : sin(arg)/arg;
+      winv[d][n+nkmax[d]] = 1.0/pow(sinc,grid_order);
+    }
+
+  // FFT is done on proc 0 only
+
+  if (me == 0) {
+    fftbuf = (kiss_fft_cpx *) KISS_FFT_MALLOC(sizeof(kiss_fft_cpx)*ngridfft);
+    fftwork = (kiss_fft_cpx *) KISS_FFT_MALLOC(sizeof(kiss_fft_cpx)*MAX(ngx,MAX(ngy,ngz)));
+    for (int d = 0; d < 3; d++) fftcfg[d] = kiss_fft_alloc(ng[d],1,0,0);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   coefficients of the B-spline charge assignment
+   framework taken from pppm.cpp, as in fix condiff
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::compute_rho_coeff()
+{
+  int j, k, l, m;
+  double s;
+  double **a;
+  const int order = grid_order;
+
+  memory->create2d_offset(a,order,-order,order,"scattering/bulk:a");
+
+  for (k = -order; k <= order; k++)
+    for (l = 0; l < order; l++)
+      a[l][k] = 0.0;
+
+  a[0][0] = 1.0;
+  for (j = 1; j < order; j++) {
+    for (k = -j; k <= j; k += 2) {
+      s = 0.0;
+      for (l = 0; l < j; l++) {
+        a[l+1][k] = (a[l][k+1] - a[l][k-1]) / (l+1);
+        s += pow(0.5,(double) l+1) * (a[l][k-1] + pow(-1.0,(double) l) * a[l][k+1]) / (l+1);
+      }
+      a[0][k] = s;
+    }
+  }
+
+  m = (1-order)/2;
+  for (k = -(order-1); k < order; k += 2) {
+    for (l = 0; l < order; l++)
+      rho_coeff[l][m] = a[l][k];
+    m++;
+  }
+
+  memory->destroy2d_offset(a,-order);
+}
+
+/* ----------------------------------------------------------------------
+   assignment weights of one particle, w[d][k-nlower] for stencil point k
+   framework taken from compute_rho1d() in pppm.cpp
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::compute_rho1d(const double *dx, double w[3][MAXORDER])
+{
+  const int order = grid_order;
+  const int nlower = -(order-1)/2;
+  for (int k = nlower; k <= order/2; k++) {
+    double r1, r2, r3;
+    r1 = r2 = r3 = 0.0;
+    for (int l = order-1; l >= 0; l--) {
+      r1 = rho_coeff[l][k] + r1*dx[0];
+      r2 = rho_coeff[l][k] + r2*dx[1];
+      r3 = rho_coeff[l][k] + r3*dx[2];
+    }
+    w[0][k-nlower] = r1;
+    w[1][k-nlower] = r2;
+    w[2][k-nlower] = r3;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   |k| of an output column
+------------------------------------------------------------------------- */
+
+double FixScatteringBulk::kcolumn(int m)
+{
+  if (kspace == AXES) return (m+1) * 2. * M_PI / domain->xprd;
+  return kcol[m];
+}
+
+/* ----------------------------------------------------------------------
+   rho(k) = sum_j e^{i k.x_j} for all k-vectors of the shells
+   the phase factor factorizes into e^{i kx x} e^{i ky y} e^{i kz z},
+   each built by a recurrence, the innermost loop over nz is contiguous
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::EvalRhoShell ()
+{
+  int nlocal = atom->nlocal;
+  int *mask = atom->mask;
+  double **x = atom->x;
+
+  const double kx = 2. * M_PI / domain->xprd;
+  const double ky = 2. * M_PI / domain->yprd;
+  const double kz = 2. * M_PI / domain->zprd;
+  const int nval = 2*nchan;
+  real *rho = rhok;     // real parts followed by imaginary parts
+  for (int j = 0; j < nval; j++) rho[j] = 0.0;
+
+  #if defined(_OPENMP)
+  #pragma omp parallel
+  #endif
+  {
+    const int nxs = 2*nkmax[0]+1;
+    const int nys = 2*nkmax[1]+1;
+    const int nzs = 2*nkmax[2]+1;
+    double *ebuf = new double[2*(nxs+nys+nzs)];
+    double *exr = ebuf;
+    double *exi = exr + nxs;
+    double *eyr = exi + nxs;
+    double *eyi = eyr + nys;
+    double *ezr = eyi + nys;
+    double *ezi = ezr + nzs;
+
+    #if defined(_OPENMP)
+    #pragma omp for reduction(+:rho[:nval])
+    #endif
+    for (int i = 0; i < nlocal; i++) {
+      if (mask[i] & groupbit) {
+        phase_factors(kx*x[i][0],nkmax[0],exr,exi);
+        phase_factors(ky*x[i][1],nkmax[1],eyr,eyi);
+        phase_factors(kz*x[i][2],nkmax[2],ezr,ezi);
+
+        for (int r = 0; r < nkrow; r++) {
+          const int *row = krow[r];
+          const int ix = row[0] + nkmax[0];
+          const int iy = row[1] + nkmax[1];
+          const double ar = exr[ix]*eyr[iy] - exi[ix]*eyi[iy];
+          const double ai = exr[ix]*eyi[iy] + exi[ix]*eyr[iy];
+          const double *zr = ezr + row[2] + nkmax[2];
+          const double *zi = ezi + row[2] + nkmax[2];
+          real *rr = rho + row[4];
+          real *ri = rho + nchan + row[4];
+          const int len = row[3];
+          #if defined(_OPENMP)
+          #pragma omp simd
+          #endif
+          for (int n = 0; n < len; n++) {
+            rr[n] += ar*zr[n] - ai*zi[n];
+            ri[n] += ar*zi[n] + ai*zr[n];
+          }
+        }
+      }
+    }
+
+    delete [] ebuf;
+  }
+
+  MPI_Allreduce(MPI_IN_PLACE,rhok,nval,MPI_DOUBLE,MPI_SUM,world);
+
+  for (int j = 0; j < nchan; j++) {
+    valST[2*j] = rhok[j];
+    valST[2*j+1] = rhok[nchan+j];
+  }
+}
+
+/* ----------------------------------------------------------------------
+   rho(k) from B-spline assignment onto a replicated periodic grid,
+   summed on proc 0, 3d FFT by 1d transforms along x, y and z,
+   and deconvolution of the assignment function
+   cost O(N order^3 + G log G) instead of O(N nchan)
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::EvalRhoGrid ()
+{
+  int nlocal = atom->nlocal;
+  int *mask = atom->mask;
+  double **x = atom->x;
+  double *boxlo = domain->boxlo;
+
+  const int order = grid_order;
+  const int nlower = -(order-1)/2;
+  const int nupper = order/2;
+  const double sft = (order % 2) ? OFFSET + 0.5 : OFFSET;
+  const double sftone = (order % 2) ? 0.0 : 0.5;
+  double delinv[3];
+  delinv[0] = ngx / domain->xprd;
+  delinv[1] = ngy / domain->yprd;
+  delinv[2] = ngz / domain->zprd;
+
+  const int ng = ngridfft;
+  double *g = gridrho;
+  for (int j = 0; j < ng; j++) g[j] = 0.0;
+
+  #if defined(_OPENMP)
+  #pragma omp parallel for reduction(+:g[:ng])
+  #endif
+  for (int i = 0; i < nlocal; i++) {
+    if (mask[i] & groupbit) {
+      int nxyz[3];
+      double dx[3];
+      double w[3][MAXORDER];
+      for (int d = 0; d < 3; d++) {
+        double u = (x[i][d] - boxlo[d]) * delinv[d];
+        nxyz[d] = static_cast<int> (u + sft) - OFFSET;
+        dx[d] = nxyz[d] + sftone - u;
+      }
+      compute_rho1d(dx,w);
+
+      for (int n = nlower; n <= nupper; n++) {
+        int mz = (nxyz[2] + n) % ngz;
+        if (mz < 0) mz += ngz;
+        const double z0 = w[2][n-nlower];
+        for (int m = nlower; m <= nupper; m++) {
+          int my = (nxyz[1] + m) % ngy;
+          if (my < 0) my += ngy;
+          const double y0 = z0 * w[1][m-nlower];
+          double *gline = g + (mz*ngy + my)*ngx;
+          for (int l = nlower; l <= nupper; l++) {
+            int mx = (nxyz[0] + l) % ngx;
+            if (mx < 0) mx += ngx;
+            gline[mx] += y0 * w[0][l-nlower];
+          }
+        }
+      }
+    }
+  }
+
+  if (me == 0) MPI_Reduce(MPI_IN_PLACE,gridrho,ng,MPI_DOUBLE,MPI_SUM,0,world);
+  else MPI_Reduce(gridrho,NULL,ng,MPI_DOUBLE,MPI_SUM,0,world);
+
+  if (me == 0) {
+    int ix, iy, iz;
+    for (int j = 0; j < ng; j++) {
+      fftbuf[j].r = gridrho[j];
+      fftbuf[j].i = 0.0;
+    }
+
+    // backward transforms, sum_m rho_m exp(+2 pi i n m / N) as for rho(k)
+
+    for (int j = 0; j < ngy*ngz; j++) {
+      kiss_fft(fftcfg[0],&fftbuf[j*ngx],fftwork);
+      memcpy(&fftbuf[j*ngx],fftwork,ngx*sizeof(kiss_fft_cpx));
+    }
+    for (iz = 0; iz < ngz; iz++)
+      for (ix = 0; ix < ngx; ix++) {
+        kiss_fft_cpx *line = &fftbuf[iz*ngy*ngx + ix];
+        kiss_fft_stride(fftcfg[1],line,fftwork,ngx);
+        for (iy = 0; iy < ngy; iy++) line[iy*ngx] = fftwork[iy];
+      }
+    for (iy = 0; iy < ngy; iy++)
+      for (ix = 0; ix < ngx; ix++) {
+        kiss_fft_cpx *line = &fftbuf[iy*ngx + ix];
+        kiss_fft_stride(fftcfg[2],line,fftwork,ngx*ngy);
+        for (iz = 0; iz < ngz; iz++) line[iz*ngx*ngy] = fftwork[iz];
+      }
+
+    // pick the k-vectors of the shells, undo the assignment window
+    // and the shift of the grid origin to boxlo
+
+    const int nxs = 2*nkmax[0]+1;
+    const int nys = 2*nkmax[1]+1;
+    const int nzs = 2*nkmax[2]+1;
+    double *ebuf = new double[2*(nxs+nys+nzs)];
+    double *exr = ebuf;
+    double *exi = exr + nxs;
+    double *eyr = exi + nxs;
+    double *eyi = eyr + nys;
+    double *ezr = eyi + nys;
+    double *ezi = ezr + nzs;
+    phase_factors(2. * M_PI / domain->xprd * boxlo[0],nkmax[0],exr,exi);
+    phase_factors(2. * M_PI / domain->yprd * boxlo[1],nkmax[1],eyr,eyi);
+    phase_factors(2. * M_PI / domain->zprd * boxlo[2],nkmax[2],ezr,ezi);
+
+    for (int r = 0; r < nkrow; r++) {
+      const int *row = krow[r];
+      const int jx = row[0] + nkmax[0];
+      const int jy = row[1] + nkmax[1];
+      ix = (row[0] + ngx) % ngx;
+      iy = (row[1] + ngy) % ngy;
+      double ar = exr[jx]*eyr[jy] - exi[jx]*eyi[jy];
+      double ai = exr[jx]*eyi[jy] + exi[jx]*eyr[jy];
+      const double wxy = winv[0][jx] * winv[1][jy];
+      for (int n = 0; n < row[3]; n++) {
+        const int nz = row[2] + n;
+        const int jz = nz + nkmax[2];
+        iz = (nz + ngz) % ngz;
+        const kiss_fft_cpx &F = fftbuf[(iz*ngy + iy)*ngx + ix];
+        const double pr = ar*ezr[jz] - ai*ezi[jz];
+        const double pi = ar*ezi[jz] + ai*ezr[jz];
+        const double wk = wxy * winv[2][jz];
+        rhok[row[4]+n] = wk * (F.r*pr - F.i*pi);
+        rhok[nchan+row[4]+n] = wk * (F.r*pi + F.i*pr);
+      }
+    }
+
+    delete [] ebuf;
+  }
+
+  MPI_Bcast(rhok,2*nchan,MPI_DOUBLE,0,world);
+
+  for (int j = 0; j < nchan; j++) {
+    valST[2*j] = rhok[j];
+    valST[2*j+1] = rhok[nchan+j];
   }
 }
 
@@ -110,17 +891,11 @@ void FixScatteringBulk::end_of_step() {
   
 /* Help functions to calculate Structure factor and coherent scattering function */
 void FixScatteringBulk::AllocArrays(){
-  // has to be adapted for parallelization
-  int N=atom->nlocal;
-
-  int nb,k;
-  AllocMem (valST, 6 * nFunCorr, real);
-  
-  AllocMem (valVEL, 3 * N, real);
+  int k;
+  AllocMem (valST, 2 * nchan, real);
   
-  AllocMem (strucFac, nFunCorr, real);
+  AllocMem (strucFac, ncol, real);
   
-  AllocMem2 (blocking_sum, N_blocks*N_levels_msd, 3*N, real);
   AllocMem2 (correlationIn, N_blocks*N_levels_msd, nFunCorr, real);
   AllocMem2 (MSD, N_blocks*N_levels_msd,3,real);
     AllocMem2 (NGP, N_blocks*N_levels_msd,4,real);
@@ -128,26 +903,27 @@ void FixScatteringBulk::AllocArrays(){
   AllocMem (countMSD, N_blocks*N_levels_msd, int);
     AllocMem (countNGP, N_blocks*N_levels_msd, int);
   
-  AllocMem2 (shift, N_blocks*N_levels, 6 *  nFunCorr, real);
-  AllocMem2 (accumulator, N_levels, 6  * nFunCorr, real);
-  AllocMem (naccumulator, N_levels, int);
-  AllocMem2 (correlation, N_blocks*N_levels, nFunCorr, real);
-  AllocMem (countcor, N_blocks*N_levels,int);
-  AllocMem (insertindex, N_levels,int);
-  
-  AllocMem2 (shiftVACF, N_blocks*N_levels, 3 *N, real);
-  AllocMem2 (accumulatorVACF, N_levels, 3*N, real);
-  AllocMem (naccumulatorVACF, N_levels, int);
+  // re and im of channel ic both add to column chan_col[ic]
+  int *col;
+  AllocMem (col, 2 * nchan, int);
+  for (int ic = 0; ic < nchan; ic ++) col[2*ic] = col[2*ic+1] = chan_col[ic];
+  corST = new MultiTau<real>(lmp,N_levels,N_blocks,N_count,dmin,2*nchan,ncol,col);
+  free (col);
+
+  corVACF = new MultiTau<real>(lmp,N_levels,N_blocks,N_count,dmin,0);
   AllocMem2 (correlationVACF, N_blocks*N_levels, 3, real);
-  AllocMem (countcorVACF, N_blocks*N_levels,int);
-  AllocMem (insertindexVACF, N_levels,int);
   
-  AllocMem (pos_save, 3*N,real);
-  AllocMem2 (pos_save2, 9*N,N_cor,real);
-  
-  AllocMem2 (correlationIn2, N_cor, 9*nFunCorr, real);
+  AllocMem2 (correlationIn2, 9*nFunCorr, N_cor, real);
   AllocMem (countIn2, N_cor, int);
+  AllocMem (act_level, N_levels_msd, int);
+  AllocMem (act_block, N_levels_msd, int);
   
+  // per-atom self part, migrates with the atoms
+
+  grow_arrays(atom->nmax);
+  atom->add_callback(0);
+  atom->add_callback(1);
+
   lastindex = 0;
 }
   
@@ -155,484 +931,531 @@ void FixScatteringBulk::AllocArrays(){
   
   void FixScatteringBulk::EvalSpacetimeCorr (){
     real b, c, c0, c1, c2, kVal, s, s1, s2;
-    real cc, sc, QVal;
-    int j,  k, m, nb,  nv;
+    int i, j,  k, m;
     
-    int N=atom->nlocal;
     int nlocal = atom->nlocal;
     int *mask= atom->mask;
     double **x = atom->x;
-    double **v = atom->v;
-    double **f = atom->f;
 
-    for (j = 0; j < 6 * nFunCorr; j ++) valST[j] = 0.;
-    for (j = 0; j < 3*N; j ++) valVEL[j] = 0.;
     count++;
     
     // calculate FT for coherent scattering fct
+    // partial sums of the local atoms, summed over all procs
     kVal = 2. * M_PI / domain->xprd;
-    for (int i = 0; i < nlocal; i++) {
-      if (mask[i] & groupbit) {
-        j = 0;
-        for (k = 0; k < 3; k ++) {
-          for (m = 0; m < nFunCorr; m ++) {
-            if (m == 0) {
-              b = kVal * x[i][k];
-
-              c = cos (b);
-              s = sin (b);
-              c0 = c;
-            } else if (m == 1) {
-              c1 = c;
-              s1 = s;
-              c = 2. * c0 * c1 - 1.;
-              s = 2. * c0 * s1;
-            } else {
-              c2 = c1;
-              s2 = s1;
-              c1 = c;
-              s1 = s;
-              c = 2. * c0 * c1 - c2;
-              s = 2. * c0 * s1 - s2;
+    if (kspace == SHELL) {
+      if (gridflag) EvalRhoGrid ();
+      else EvalRhoShell ();
+    } else {
+      const int nval = 2 * nchan;
+      real *val = valST;
+      for (j = 0; j < nval; j ++) val[j] = 0.;
+      #if defined(_OPENMP)
+      #pragma omp parallel for private(i,j,k,m,b,c,c0,c1,c2,s,s1,s2) reduction(+:val[:nval])
+      #endif
+      for (i = 0; i < nlocal; i++) {
+        if (mask[i] & groupbit) {
+          j = 0;
+          for (k = 0; k < 3; k ++) {
+            for (m = 0; m < nFunCorr; m ++) {
+              if (m == 0) {
+                b = kVal * x[i][k];
+  
+                c = cos (b);
+                s = sin (b);
+                c0 = c;
+              } else if (m == 1) {
+                c1 = c;
+                s1 = s;
+                c = 2. * c0 * c1 - 1.;
+                s = 2. * c0 * s1;
+              } else {
+                c2 = c1;
+                s2 = s1;
+                c1 = c;
+                s1 = s;
+                c = 2. * c0 * c1 - c2;
+                s = 2. * c0 * s1 - s2;
+              }
+              val[j ++] += c; //second element of SF -real part
+              val[j ++] += s; //imaginary 
             }
-            valST[j ++] += c; //second element of SF -real part
-            valST[j ++] += s; //imaginary 
           }
         }
       }
+      MPI_Allreduce(MPI_IN_PLACE,valST,nval,MPI_DOUBLE,MPI_SUM,world);
     }
+
     // acumualte and calculate logarithmic correlation function
-    add(valST,0);
-    
+    corST->add(valST);
     
-    // add values to VACF
-    j = 0;
-    for (int i = 0; i < nlocal; i++) {
-      if (mask[i] & groupbit) {
-        for (k = 0; k < 3; k ++) {
-          valVEL[j ++] = v[i][k];
-        }
-      }
-      //if (i==1) printf("input v[i][0]=%f\n",v[i][0]);
-    }
     // acumualte and calculate logarithmic velocity correlation function
-    addVACF(valVEL,0,N);
+    addVACF();
 	
     // calc structure factor
-    for (k = 0; k < 3; k ++) {
-      for (m = 0; m < nFunCorr; m ++) {
-        int ind_j = 2*k*nFunCorr + 2*m;
-        double c = valST[ind_j];
-        double s = valST[ind_j+1];
+    for (j = 0; j < nchan; j ++) {
+      double c = valST[2*j];
+      double s = valST[2*j+1];
 
-        strucFac[m] += c*c + s*s;
-      }
+      strucFac[chan_col[j]] += c*c + s*s;
     }
     
-    // calculate \Delta r in blocking algorithm for self-intermediate scattering function
+    // local group members, shared by both self correlations of this step
+    int ngl = GroupList ();
+
+    // self-intermediate scattering function, MSD and NGP from blocking sums
+    EvalSelfBlocking (kVal, ngl);
+
+    // incoherent scattering function and derivatives from the x,v,f history
+    EvalSelfHistory (kVal, ngl);
+     
+    lastindex++;
+    if (lastindex >N_cor-1) lastindex -= N_cor;
+    
+    int t_tot = (int) pow(N_blocks,N_levels_msd);
+    if (t_loc == t_tot-1) {
+      AccumSpacetimeCorr ();
+      t_loc = 0;
+    } else t_loc++;
+  }
+  
+  /***************************************************************************************/
+  
+  // calculate \Delta r in blocking algorithm for self-intermediate scattering function
+  // the levels updated at this step are the same for all atoms, so they are
+  // determined once; atoms are processed in tiles of TILE, the blocking sums
+  // of a tile are copied to contiguous lanes and all sums over atoms
+  // (cosines via branch-free Chebyshev recurrence, MSD, NGP) are SIMD reductions
+
+  void FixScatteringBulk::EvalSelfBlocking (double kVal, int ngl){
     int t = t_loc;
-    int np=0;
-    int max_levels = (int) (log(t)/log(N_blocks));
+    int max_levels = (t > 0) ? (int) (log(t)/log(N_blocks)) : -1;
     if (max_levels >= N_levels) max_levels = N_levels-1;
-    
-    tagint *tag = atom->tag;
-      imageint *image = atom->image;
-    int itag;
-    double unwrap[3];
-    //printf("max_l %d\n",max_levels);
-    for (int i = 0; i < nlocal; i++) {
-      if (mask[i] & groupbit) {
-        double delx,dely,delz;
-        int j0; // = i % N_blocks;
-        //if (np==0) printf("checkin0\n");
-        if (t==0) {
-          itag = tag[i] - 1;
-          domain->unmap(x[i],image[i],unwrap);
-          pos_save[3*itag] = unwrap[0];
-          pos_save[3*itag+1] = unwrap[1];
-          pos_save[3*itag+2] = unwrap[2];
-        }
-        for (int k=0; k<(max_levels+1); k++) {
-            
-          if (k==0) {
-            itag = tag[i] - 1;
-            domain->unmap(x[i],image[i],unwrap);
-            delx = unwrap[0]-pos_save[3*itag];
-            dely = unwrap[1]-pos_save[3*itag+1];
-            delz = unwrap[2]-pos_save[3*itag+2];
-            pos_save[3*itag] = unwrap[0];
-            pos_save[3*itag+1] = unwrap[1];
-            pos_save[3*itag+2] = unwrap[2];
-          } else {
-            delx = blocking_sum[N_blocks-1+(k-1)*N_blocks][np];
-            dely = blocking_sum[N_blocks-1+(k-1)*N_blocks][np+N];
-            delz = blocking_sum[N_blocks-1+(k-1)*N_blocks][np+2*N];
-          }
-            
-          int nblocks_to_k = 1 ; // (int) round(pow(N_blocks,k));
 
-          for (int kk=0; kk<k; kk++) nblocks_to_k *= N_blocks;
-          //if (np==0) printf("checkin1\n");
-          if (t % nblocks_to_k == 0) {
-              
-            j0 =  ((t) / nblocks_to_k-1) % N_blocks;  // was -1
+    int nact = 0;
+    int nblocks_to_k = 1 ; // (int) round(pow(N_blocks,k));
+    for (int k=0; k<(max_levels+1); k++) {
+      if (t % nblocks_to_k == 0) {
+        act_level[nact] = k;
+        act_block[nact] = ((t) / nblocks_to_k-1) % N_blocks;  // was -1
+        nact++;
+      }
+      nblocks_to_k *= N_blocks;
+    }
+
+    double **x = atom->x;
+    imageint *image = atom->image;
+    if (t > 0 && nact == 0) return;
 
+    const int ntile = (ngl + TILE - 1) / TILE;
+#if defined(_OPENMP)
+    const int nblk = N_blocks*N_levels_msd;     // extent of the reductions
+#endif
+    real *cIn = correlationIn[0];
+    int *cntIn = countIn[0];
+    real *msd = MSD[0];
+    real *ngp = NGP[0];
+    int *cntMSD = countMSD;
+    int *cntNGP = countNGP;
+
+    #if defined(_OPENMP)
+    #pragma omp parallel
+    #endif
+    {
+      double *lane = new double[(3*nact+3) * TILE];
+      double *cm = lane + 3*nact*TILE;
+      double *cp = cm + TILE;
+      double *c0 = cp + TILE;
+
+      #if defined(_OPENMP)
+      #pragma omp for schedule(static) reduction(+:cIn[:nblk*nFunCorr],cntIn[:nblk*nFunCorr],msd[:3*nblk],ngp[:4*nblk],cntMSD[:nblk],cntNGP[:nblk])
+      #endif
+      for (int tile = 0; tile < ntile; tile++) {
+        const int ibegin = tile*TILE;
+        const int n = MIN(TILE, ngl - ibegin);
+
+        // update per-atom blocking sums, lowest level first
+
+        for (int ii = 0; ii < n; ii++) {
+          const int i = glist[ibegin+ii];
+          double unwrap[3], del[3];
+          double *pos_save = peratom[i] + off_pos;
+          double *blocking_sum = peratom[i] + off_block;
+          domain->unmap(x[i],image[i],unwrap);
+          if (t==0) {
+            pos_save[0] = unwrap[0];
+            pos_save[1] = unwrap[1];
+            pos_save[2] = unwrap[2];
+            continue;
+          }
+          for (int a = 0; a < nact; a++) {
+            const int k = act_level[a];
+            const int j0 = act_block[a];
+            if (k==0) {
+              del[0] = unwrap[0]-pos_save[0];
+              del[1] = unwrap[1]-pos_save[1];
+              del[2] = unwrap[2]-pos_save[2];
+              pos_save[0] = unwrap[0];
+              pos_save[1] = unwrap[1];
+              pos_save[2] = unwrap[2];
+            } else {
+              const double *prev = blocking_sum + 3*(N_blocks-1+(k-1)*N_blocks);
+              del[0] = prev[0];
+              del[1] = prev[1];
+              del[2] = prev[2];
+            }
+            double *bs = blocking_sum + 3*(j0+k*N_blocks);
             if (j0==0) {
-              blocking_sum[j0+k*N_blocks][np] = delx; //blocking_sum[N_blocks-1][k-1][n] ;
-              blocking_sum[j0+k*N_blocks][np+N] = dely; //blocking_sum[N_blocks-1][k-1][n] ;
-              blocking_sum[j0+k*N_blocks][np+2*N] = delz; //blocking_sum[N_blocks-1][k-1][n] ;
+              bs[0] = del[0];
+              bs[1] = del[1];
+              bs[2] = del[2];
+            } else {
+              bs[0] = bs[-3] + del[0];
+              bs[1] = bs[-2] + del[1];
+              bs[2] = bs[-1] + del[2];
             }
-            else {
-              blocking_sum[j0+k*N_blocks][np] = blocking_sum[j0-1+k*N_blocks][np] + delx; 
-              blocking_sum[j0+k*N_blocks][np+N] = blocking_sum[j0-1+k*N_blocks][np+N] + dely; 
-              blocking_sum[j0+k*N_blocks][np+2*N] = blocking_sum[j0-1+k*N_blocks][np+2*N] + delz; 
+            lane[(3*a)*TILE+ii] = bs[0];
+            lane[(3*a+1)*TILE+ii] = bs[1];
+            lane[(3*a+2)*TILE+ii] = bs[2];
+          }
+        }
+        if (t==0) continue;
+
+        // sums over the atoms of the tile
+
+        for (int a = 0; a < nact; a++) {
+          const int jb = act_block[a] + act_level[a]*N_blocks;
+          const double *dx = lane + (3*a)*TILE;
+          const double *dy = dx + TILE;
+          const double *dz = dy + TILE;
+
+          // now calculate incoherent scattering functions
+          for (int km = 0; km < 3; km ++) {
+            const double *u = lane + (3*a+km)*TILE;
+            #if defined(_OPENMP)
+            #pragma omp simd
+            #endif
+            for (int ii = 0; ii < n; ii++) {
+              c0[ii] = cos (kVal * u[ii]);
+              cm[ii] = c0[ii];
+              cp[ii] = 1.0;
             }
-            
-            
-            // now calculate incoherent scattering functions
-            for (int km = 0; km < 3; km ++) {
-              for (m = 0; m < nFunCorr; m ++) {
-                if (m == 0) {
-                  b = kVal * blocking_sum[j0+k*N_blocks][km*N+np] ;
-                  //if (k==0) printf("x coord %f\n",Sim->particles[p1].getPosition()[k]);
-                  c = cos (b);
-                  s = sin (b);
-                  c0 = c;
-                } else if (m == 1) {
-                  c1 = c;
-                  s1 = s;
-                  c = 2. * c0 * c1 - 1.;
-                  s = 2. * c0 * s1;
-                } else {
-                  c2 = c1;
-                  s2 = s1;
-                  c1 = c;
-                  s1 = s;
-                  c = 2. * c0 * c1 - c2;
-                  s = 2. * c0 * s1 - s2;
-                }
-            
-                correlationIn[j0+k*N_blocks][m] += c;
-                countIn[j0+k*N_blocks][m] += 1;
+            for (int m = 0; m < nFunCorr; m ++) {
+              double sum = 0.0;
+              #if defined(_OPENMP)
+              #pragma omp simd reduction(+:sum)
+              #endif
+              for (int ii = 0; ii < n; ii++) {
+                sum += cm[ii];
+                const double cn = 2. * c0[ii] * cm[ii] - cp[ii];
+                cp[ii] = cm[ii];
+                cm[ii] = cn;
               }
+              cIn[jb*nFunCorr+m] += sum;
+              cntIn[jb*nFunCorr+m] += n;
             }
-            
-            
-            // calc MSD
-            MSD[j0+k*N_blocks][0]+=blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np];
-            MSD[j0+k*N_blocks][1]+=blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N];
-            MSD[j0+k*N_blocks][2]+=blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N];
-            countMSD[j0+k*N_blocks] += 1;
-            
-            NGP[j0+k*N_blocks][0]+=blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np];
-            NGP[j0+k*N_blocks][1]+=blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N];
-            NGP[j0+k*N_blocks][2]+=blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N];
-            NGP[j0+k*N_blocks][3]+=(blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np] + blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N] + blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N])*(blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np] + blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N] + blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N]);
-            countNGP[j0+k*N_blocks] += 1;
           }
+
+          // calc MSD and NGP
+          double sx2 = 0.0, sy2 = 0.0, sz2 = 0.0;
+          double sx4 = 0.0, sy4 = 0.0, sz4 = 0.0, sr4 = 0.0;
+          #if defined(_OPENMP)
+          #pragma omp simd reduction(+:sx2,sy2,sz2,sx4,sy4,sz4,sr4)
+          #endif
+          for (int ii = 0; ii < n; ii++) {
+            const double dx2 = dx[ii]*dx[ii];
+            const double dy2 = dy[ii]*dy[ii];
+            const double dz2 = dz[ii]*dz[ii];
+            const double dr2 = dx2 + dy2 + dz2;
+            sx2 += dx2;
+            sy2 += dy2;
+            sz2 += dz2;
+            sx4 += dx2*dx2;
+            sy4 += dy2*dy2;
+            sz4 += dz2*dz2;
+            sr4 += dr2*dr2;
+          }
+          msd[3*jb] += sx2;
+          msd[3*jb+1] += sy2;
+          msd[3*jb+2] += sz2;
+          cntMSD[jb] += n;
+          ngp[4*jb] += sx4;
+          ngp[4*jb+1] += sy4;
+          ngp[4*jb+2] += sz4;
+          ngp[4*jb+3] += sr4;
+          cntNGP[jb] += n;
         }
-        np++;
       }
+
+      delete [] lane;
     }
-    
-    // calculate incoherent scattering function and derivatives (expensive!!)
-    real bx, cx, c0x, c1x, c2x, sx, s1x, s2x;
-    real by, cy, c0y, c1y, c2y, sy, s1y, s2y;
-    real bz, cz, c0z, c1z, c2z, sz, s1z, s2z;
+  }
+
+  /***************************************************************************************/
+  
+  // calculate incoherent scattering function and derivatives (expensive!!)
+  // the history of each atom is time contiguous, the lags of the ring buffer
+  // are gathered into lag-contiguous arrays and all nFunCorr harmonics are
+  // generated by branch-free Chebyshev recurrences, SIMD over the lags;
+  // correlationIn2 is stored as [9*m+q][lag] so the accumulation is contiguous
+
+  void FixScatteringBulk::EvalSelfHistory (double kVal, int ngl){
+    double **x = atom->x;
+    double **v = atom->v;
+    double **f = atom->f;
+    imageint *image = atom->image;
+
     int tcor_max = N_cor;
     if (t_loc<N_cor) tcor_max=t_loc;
-    for (int i = 0; i < nlocal; i++) {
-      if (mask[i] & groupbit) {
+    const int docorr = (update->ntimestep % nrelax == 0);
+    const int ind1 = lastindex;
+    const int nc = N_cor;
+    real *cIn2 = correlationIn2[0];
+    int *cntIn2 = countIn2;
+
+    #if defined(_OPENMP)
+    #pragma omp parallel
+    #endif
+    {
+      // per lag: cos/sin of the first harmonic, current and previous harmonic,
+      // velocities and forces at the earlier time
+      double *work = new double[24*nc];
+      double *C0 = work;
+      double *S0 = C0 + 3*nc;
+      double *Cm = S0 + 3*nc;
+      double *Sm = Cm + 3*nc;
+      double *Cp = Sm + 3*nc;
+      double *Sp = Cp + 3*nc;
+      double *Vt = Sp + 3*nc;
+      double *Ft = Vt + 3*nc;
+
+      #if defined(_OPENMP)
+      #pragma omp for reduction(+:cIn2[:9*nFunCorr*nc],cntIn2[:nc])
+      #endif
+      for (int ii = 0; ii < ngl; ii++) {
+        const int i = glist[ii];
+        double unwrap[3];
+
         // save new positions and velocities
-        itag = tag[i] - 1;
+        // history of component c at time slot ind is hist[c*N_cor+ind]
+        double *hist = peratom[i] + off_hist;
         domain->unmap(x[i],image[i],unwrap);
-        pos_save2[9*itag][lastindex] = unwrap[0];
-        pos_save2[9*itag+1][lastindex] = unwrap[1];
-        pos_save2[9*itag+2][lastindex] = unwrap[2];
-        pos_save2[9*itag+3][lastindex] = v[i][0];
-        pos_save2[9*itag+4][lastindex] = v[i][1];
-        pos_save2[9*itag+5][lastindex] = v[i][2];
-        pos_save2[9*itag+6][lastindex] = f[i][0];
-        pos_save2[9*itag+7][lastindex] = f[i][1];
-        pos_save2[9*itag+8][lastindex] = f[i][2];
-      }
-    }
-    
-    if (update->ntimestep % nrelax == 0) {
-      for (int i = 0; i < nlocal; i++) {
-        if (mask[i] & groupbit) {
-          // save new positions and velocities
-          itag = tag[i] - 1;
-          // calculate correlation function
-          int ind1 = lastindex;
-          int ind2 = ind1;
-          for (int tcor=0; tcor < tcor_max; tcor++) {
-            double dx = pos_save2[9*itag][ind2]-pos_save2[9*itag][ind1];
-            double dy = pos_save2[9*itag+1][ind2]-pos_save2[9*itag+1][ind1];
-            double dz = pos_save2[9*itag+2][ind2]-pos_save2[9*itag+2][ind1];
-            
-            double vx0 = pos_save2[9*itag+3][ind1];
-            double vy0 = pos_save2[9*itag+4][ind1];
-            double vz0 = pos_save2[9*itag+5][ind1];
-            double vxt = pos_save2[9*itag+3][ind2];
-            double vyt = pos_save2[9*itag+4][ind2];
-            double vzt = pos_save2[9*itag+5][ind2];
-            
-            double Fx0 = pos_save2[9*itag+6][ind1];
-            double Fy0 = pos_save2[9*itag+7][ind1];
-            double Fz0 = pos_save2[9*itag+8][ind1];
-            double Fxt = pos_save2[9*itag+6][ind2];
-            double Fyt = pos_save2[9*itag+7][ind2];
-            double Fzt = pos_save2[9*itag+8][ind2];
-            
-            for (m = 0; m < nFunCorr; m ++) {
-              if (m == 0) {
-                bx = kVal * dx ;
-                by = kVal * dy ;
-                bz = kVal * dz ;
-                //if (k==0) printf("x coord %f\n",Sim->particles[p1].getPosition()[k]);
-                cx = cos (bx);
-                sx = sin (bx);
-                c0x = cx;
-                cy = cos (by);
-                sy = sin (by);
-                c0y = cy;
-                cz = cos (bz);
-                sz = sin (bz);
-                c0z = cz;
-              } else if (m == 1) {
-                c1x = cx;
-                s1x = sx;
-                cx = 2. * c0x * c1x - 1.;
-                sx = 2. * c0x * s1x;
-                c1y = cy;
-                s1y = sy;
-                cy = 2. * c0y * c1y - 1.;
-                sy = 2. * c0y * s1y;
-                c1z = cz;
-                s1z = sz;
-                cz = 2. * c0z * c1z - 1.;
-                sz = 2. * c0z * s1z;
-              } else {
-                c2x = c1x;
-                s2x = s1x;
-                c1x = cx;
-                s1x = sx;
-                cx = 2. * c0x * c1x - c2x;
-                sx = 2. * c0x * s1x - s2x;
-                c2y = c1y;
-                s2y = s1y;
-                c1y = cy;
-                s1y = sy;
-                cy = 2. * c0y * c1y - c2y;
-                sy = 2. * c0y * s1y - s2y;
-                c2z = c1z;
-                s2z = s1z;
-                c1z = cz;
-                s1z = sz;
-                cz = 2. * c0z * c1z - c2z;
-                sz = 2. * c0z * s1z - s2z;
-              }
-              double qVal = (m+1)*kVal;
-              double q2Val = qVal*qVal;
-              double q3Val = q2Val*qVal;
-              double q4Val = q2Val*q2Val;
+        hist[ind1] = unwrap[0];
+        hist[nc+ind1] = unwrap[1];
+        hist[2*nc+ind1] = unwrap[2];
+        hist[3*nc+ind1] = v[i][0];
+        hist[4*nc+ind1] = v[i][1];
+        hist[5*nc+ind1] = v[i][2];
+        hist[6*nc+ind1] = f[i][0];
+        hist[7*nc+ind1] = f[i][1];
+        hist[8*nc+ind1] = f[i][2];
+
+        if (!docorr || tcor_max == 0) continue;
+
+        // gather lags, the ring buffer runs backwards from ind1 and wraps once
+        const int nfirst = MIN(ind1+1, tcor_max);
+        for (int d = 0; d < 3; d++) {
+          const double *xh = hist + d*nc;
+          const double *vh = hist + (3+d)*nc;
+          const double *fh = hist + (6+d)*nc;
+          const double xnow = xh[ind1];
+          double *c0 = C0 + d*nc;
+          double *s0 = S0 + d*nc;
+          double *vt = Vt + d*nc;
+          double *ft = Ft + d*nc;
+          for (int tc = 0; tc < nfirst; tc++) {
+            c0[tc] = xh[ind1-tc] - xnow;
+            vt[tc] = vh[ind1-tc];
+            ft[tc] = fh[ind1-tc];
+          }
+          for (int tc = nfirst; tc < tcor_max; tc++) {
+            c0[tc] = xh[ind1-tc+nc] - xnow;
+            vt[tc] = vh[ind1-tc+nc];
+            ft[tc] = fh[ind1-tc+nc];
+          }
+          double *cm = Cm + d*nc;
+          double *sm = Sm + d*nc;
+          double *cp = Cp + d*nc;
+          double *sp = Sp + d*nc;
+          #if defined(_OPENMP)
+          #pragma omp simd
+          #endif
+          for (int tc = 0; tc < tcor_max; tc++) {
+            const double b = kVal * c0[tc];
+            c0[tc] = cos (b);
+            s0[tc] = sin (b);
+            cm[tc] = c0[tc];
+            sm[tc] = s0[tc];
+            cp[tc] = 1.0;
+            sp[tc] = 0.0;
+          }
+        }
+
+        const double vx0 = hist[3*nc+ind1];
+        const double vy0 = hist[4*nc+ind1];
+        const double vz0 = hist[5*nc+ind1];
+        const double Fx0 = hist[6*nc+ind1];
+        const double Fy0 = hist[7*nc+ind1];
+        const double Fz0 = hist[8*nc+ind1];
+
+        for (int m = 0; m < nFunCorr; m ++) {
+          const double qVal = (m+1)*kVal;
+          const double q1 = qVal/3.0;
+          const double q2 = q1*qVal;
+          const double q3 = q2*qVal;
+          const double q4 = q3*qVal;
+          real *acc = cIn2 + 9*m*nc;
+          #if defined(_OPENMP)
+          #pragma omp simd
+          #endif
+          for (int tc = 0; tc < tcor_max; tc++) {
+            const double cx = Cm[tc], cy = Cm[nc+tc], cz = Cm[2*nc+tc];
+            const double sx = Sm[tc], sy = Sm[nc+tc], sz = Sm[2*nc+tc];
+            const double vxt = Vt[tc], vyt = Vt[nc+tc], vzt = Vt[2*nc+tc];
+            const double Fxt = Ft[tc], Fyt = Ft[nc+tc], Fzt = Ft[2*nc+tc];
           
-              // S
-              correlationIn2[tcor][9*m] += (cx + cy + cz)/3.0;
-              // dS/dt
-              correlationIn2[tcor][9*m+1] -= qVal*(vxt*sx+vyt*sz+vzt*sz)/3.0;
-              // dS^2/dt^2
-              correlationIn2[tcor][9*m+2] += q2Val*(vxt*vx0*cx+vyt*vy0*cy+vzt*vz0*cz)/3.0;
-              // dS^3/dt^3
-              correlationIn2[tcor][9*m+3] -= q3Val*(vxt*vxt*vx0*sx+vyt*vyt*vy0*sy+vzt*vzt*vz0*sz)/3.0;
-              correlationIn2[tcor][9*m+4] += q2Val*(Fxt*vx0*cx+Fyt*vy0*cy+Fzt*vz0*cz)/3.0;
-              // dS^4/dt^4
-              correlationIn2[tcor][9*m+5] -= q4Val*(vxt*vxt*vx0*vx0*cx+vyt*vyt*vy0*vy0*cy+vzt*vzt*vz0*vz0*cz)/3.0;
-              correlationIn2[tcor][9*m+6] -= q3Val*(Fx0*vxt*vxt*sx+Fy0*vyt*vyt*sy+Fz0*vzt*vzt*sz)/3.0;
-              correlationIn2[tcor][9*m+7] -= q3Val*(vx0*vx0*Fxt*sx+vy0*vy0*Fyt*sy+vz0*vz0*Fzt*sz)/3.0;
-              correlationIn2[tcor][9*m+8] += q2Val*(Fxt*Fx0*cx+Fyt*Fy0*cy+Fzt*Fz0*cz)/3.0;
-              
-              
-              if (m==0) countIn2[tcor] += 1;
+            // S
+            acc[tc] += (cx + cy + cz)/3.0;
+            // dS/dt
+            acc[nc+tc] -= q1*(vxt*sx+vyt*sy+vzt*sz);
+            // dS^2/dt^2
+            acc[2*nc+tc] += q2*(vxt*vx0*cx+vyt*vy0*cy+vzt*vz0*cz);
+            // dS^3/dt^3
+            acc[3*nc+tc] -= q3*(vxt*vxt*vx0*sx+vyt*vyt*vy0*sy+vzt*vzt*vz0*sz);
+            acc[4*nc+tc] += q2*(Fxt*vx0*cx+Fyt*vy0*cy+Fzt*vz0*cz);
+            // dS^4/dt^4
+            acc[5*nc+tc] -= q4*(vxt*vxt*vx0*vx0*cx+vyt*vyt*vy0*vy0*cy+vzt*vzt*vz0*vz0*cz);
+            acc[6*nc+tc] -= q3*(Fx0*vxt*vxt*sx+Fy0*vyt*vyt*sy+Fz0*vzt*vzt*sz);
+            acc[7*nc+tc] -= q3*(vx0*vx0*Fxt*sx+vy0*vy0*Fyt*sy+vz0*vz0*Fzt*sz);
+            acc[8*nc+tc] += q2*(Fxt*Fx0*cx+Fyt*Fy0*cy+Fzt*Fz0*cz);
+          }
+
+          // next harmonic: cos/sin((m+2) b) = 2 cos(b) cos/sin((m+1) b) - cos/sin(m b)
+          for (int d = 0; d < 3; d++) {
+            #if defined(_OPENMP)
+            #pragma omp simd
+            #endif
+            for (int j = d*nc; j < d*nc+tcor_max; j++) {
+              const double cn = 2. * C0[j] * Cm[j] - Cp[j];
+              const double sn = 2. * C0[j] * Sm[j] - Sp[j];
+              Cp[j] = Cm[j];
+              Sp[j] = Sm[j];
+              Cm[j] = cn;
+              Sm[j] = sn;
             }
-                
-            
-            ind2 --;
-            if (ind2 < 0) ind2 += N_cor;
           }
-          
         }
+
+        #if defined(_OPENMP)
+        #pragma omp simd
+        #endif
+        for (int tc = 0; tc < tcor_max; tc++) cntIn2[tc] += 1;
       }
+
+      delete [] work;
     }
-        
-     
-    lastindex++;
-    if (lastindex >N_cor-1) lastindex -= N_cor;
-    
-    int t_tot = (int) pow(N_blocks,N_levels_msd);
-    if (t_loc == t_tot-1) {
-      AccumSpacetimeCorr ();
-      t_loc = 0;
-      kmax = 0;
-    } else t_loc++;
   }
-  
+
   /***************************************************************************************/
   
-  void FixScatteringBulk::add(real * val, int k){
-    // If we exceed the correlator side, the value is discarded
-    if (k == N_levels) return;
-    if (k > kmax) kmax=k;
-
-    // Insert new value in shift array
-    for (int i = 0; i < 6 * nFunCorr; i ++)
-      shift[k*N_blocks+insertindex[k]][i] = val[i];
-
-    // Add to accumulator and, if needed, add to next correlator
-    for (int i = 0; i < 6 * nFunCorr ; i ++)
-      accumulator[k][i] += val[i];
-    ++naccumulator[k];
-    if (naccumulator[k]==N_count) {
-      for (int i = 0; i < 6 * nFunCorr ; i ++) accumulator[k][i] /= N_count;
-      add(&accumulator[k][0], k+1);
-      for (int i = 0; i < 6 * nFunCorr ; i ++) accumulator[k][i]=0.0;
-      naccumulator[k]=0;
-    }
+  // local atoms of the group, refreshed every step
 
-    // Calculate correlation function
-    unsigned int ind1=insertindex[k];
-    if (k==0) { // First correlator is different
-      int ind2=ind1;
-      for (int j=0;j<N_blocks;++j) {
-	for (int kp = 0; kp < 3; kp ++) {
-	  for (int m = 0; m < nFunCorr; m ++) {
-	    int nv = m;
-	    int ind_j = kp*2*nFunCorr + 2*m;
-	    double c = shift[k*N_blocks+ind2][ind_j];
-	    double s = shift[k*N_blocks+ind2][ind_j+1];
-	    double c2 = shift[k*N_blocks+ind1][ind_j];
-	    double s2 = shift[k*N_blocks+ind1][ind_j+1];
-	    
-	    if (c > -1e10) {
-
-	      correlation[k*N_blocks+j][nv]  += c*c2 + s*s2;
-
-	      if (nv==0) ++countcor[k*N_blocks+j];
-	    }
-	  }
-	}
-	--ind2;
-	if (ind2<0) ind2+=N_blocks;
-      }
-    } else {
-      int ind2=ind1-dmin;
-      for (int j=dmin;j<N_blocks;++j) {
-	if (ind2<0) ind2+=N_blocks;
-	for (int kp = 0; kp < 3; kp ++) {
-	  for (int m = 0; m < nFunCorr; m ++) {
-	    int nv = m ;
-	    int ind_j = kp*2*nFunCorr + 2*m;
-	    double c = shift[k*N_blocks+ind2][ind_j];
-	    double s = shift[k*N_blocks+ind2][ind_j+1];
-	    double c2 = shift[k*N_blocks+ind1][ind_j];
-	    double s2 = shift[k*N_blocks+ind1][ind_j+1];
-	    
-	    if (c > -1e10) {
-	      correlation[k*N_blocks+j][nv]  += c*c2 + s*s2;
-
-	      if (nv==0) ++countcor[k*N_blocks+j];
-	    }
+  int FixScatteringBulk::GroupList (){
+    int nlocal = atom->nlocal;
+    int *mask = atom->mask;
 
-	  }
-	}
-	--ind2;
-      }
+    if (nlocal > maxglist) {
+      maxglist = atom->nmax;
+      memory->destroy(glist);
+      memory->create(glist,maxglist,"scattering/bulk:glist");
     }
 
-    ++insertindex[k];
-    if (insertindex[k]==N_blocks) insertindex[k]=0;
-
-
+    int ngl = 0;
+    for (int i = 0; i < nlocal; i++)
+      if (mask[i] & groupbit) glist[ngl++] = i;
+    return ngl;
   }
+
+  /***************************************************************************************/
   
-   /***************************************************************************************/
-  
-  void FixScatteringBulk::addVACF(real * val, int k, int N){
-    // If we exceed the correlator side, the value is discarded
-    if (k == N_levels) return;
-    if (k > kmax) kmax=k;
-
-    // Insert new value in shift array
-    for (int i = 0; i < 3 * N; i ++)
-      shiftVACF[k*N_blocks+insertindexVACF[k]][i] = val[i];
-
-    // Add to accumulator and, if needed, add to next correlator
-    for (int i = 0; i < 3 * N ; i ++)
-      accumulatorVACF[k][i] += val[i];
-    ++naccumulatorVACF[k];
-    if (naccumulatorVACF[k]==N_count) {
-      for (int i = 0; i < 3 * N ; i ++) accumulatorVACF[k][i] /= N_count;
-      addVACF(&accumulatorVACF[k][0], k+1,N);
-      for (int i = 0; i < 3 * N ; i ++) accumulatorVACF[k][i]=0.0;
-      naccumulatorVACF[k]=0;
-    }
+  void FixScatteringBulk::addVACF(){
+    int nlocal = atom->nlocal;
+    int *mask = atom->mask;
+    double **v = atom->v;
+    int i, k, kp;
 
-    // Calculate correlation function
-    unsigned int ind1=insertindexVACF[k];
-    if (k==0) { // First correlator is different
-      int ind2=ind1;
-      for (int j=0;j<N_blocks;++j) {
-	for (int m = 0; m < N; m ++) {
-      
-	  for (int kp = 0; kp < 3; kp ++) {
-	    int ind_j = 3*m+kp;
-	    double t0 = shiftVACF[k*N_blocks+ind2][ind_j];
-	    double t1 = shiftVACF[k*N_blocks+ind1][ind_j];
-	    
-	    if (t0 > -1e10) {
+    // the schedule tells which levels get a new value at this step,
+    // the value on level k>0 is the averaged accumulator of level k-1
+    const int ntouch = corVACF->push();
+    const int nflush = corVACF->flushed();
+    const double invm = 1.0/N_count;
+#if defined(_OPENMP)
+    const int nc = N_blocks*N_levels;     // extent of the reduction
+#endif
+    real *cVACF = correlationVACF[0];
 
-	      correlationVACF[k*N_blocks+j][kp]  += t0*t1;
-	      
-	      if (kp==0) ++countcorVACF[k*N_blocks+j];
+    #if defined(_OPENMP)
+    #pragma omp parallel for private(i,k,kp) reduction(+:cVACF[:3*nc])
+    #endif
+    for (i = 0; i < nlocal; i++) {
+      if (mask[i] & groupbit) {
+        double *p = peratom[i];
+        for (k = 0; k < ntouch; k++) {
 
-	    }
-	  }
-	}
-	--ind2;
-	if (ind2<0) ind2+=N_blocks;
-      }
-    } else {
-      int ind2=ind1-dmin;
-      for (int j=dmin;j<N_blocks;++j) {
-	if (ind2<0) ind2+=N_blocks;
-	for (int m = 0; m < N; m ++) {
-
-	  for (int kp = 0; kp < 3; kp ++) {
-	    int ind_j = 3*m+kp;
-	    double t0 = shiftVACF[k*N_blocks+ind2][ind_j];
-	    double t1 = shiftVACF[k*N_blocks+ind1][ind_j];
-	    
-	    if (t0 > -1e10) {
-	      correlationVACF[k*N_blocks+j][kp]  += t0*t1;
-	      if (kp==0) ++countcorVACF[k*N_blocks+j];
-	    }
+          // Insert new value in shift array and add to accumulator
+          const int islot = off_vshift + 3*(k*N_blocks+corVACF->slot(k));
+          const int iacc = off_vacc + 3*k;
+          for (kp = 0; kp < 3; kp ++) {
+            double val = (k == 0) ? v[i][kp] : p[iacc-3+kp];
+            if (k > 0) p[iacc-3+kp] = 0.0;
+            p[islot+kp] = val;
+            p[iacc+kp] += val;
+            if (k < nflush) p[iacc+kp] *= invm;
+          }
 
-	  }
-	}
-	--ind2;
+          // Calculate correlation function, first correlator is different
+          const double *shiftVACF = p + off_vshift + 3*k*N_blocks;
+          const double *t1 = p + islot;
+          for (int j=corVACF->first_lag(k);j<corVACF->last_lag(k);++j) {
+            const double *t0 = shiftVACF + 3*corVACF->past(k,j);
+            for (kp = 0; kp < 3; kp ++)
+              cVACF[3*(k*N_blocks+j)+kp] += t0[kp]*t1[kp];
+          }
+        }
+
+        // average of the last level has nowhere to go
+        if (nflush == N_levels)
+          for (kp = 0; kp < 3; kp ++) p[off_vacc+3*(N_levels-1)+kp] = 0.0;
       }
     }
+  }
+  
+/***************************************************************************************/
 
-    ++insertindexVACF[k];
-    if (insertindexVACF[k]==N_blocks) insertindexVACF[k]=0;
+  void FixScatteringBulk::ReduceSpacetimeCorr (){
+    
+    // self parts are partial sums over the local atoms,
+    // the coherent part is computed from reduced values already
 
+    int nblk = N_blocks*N_levels_msd;
+    int nc = N_blocks*N_levels;
+    MPI_Allreduce(MPI_IN_PLACE,correlationIn[0],nblk*nFunCorr,MPI_DOUBLE,MPI_SUM,world);
+    MPI_Allreduce(MPI_IN_PLACE,countIn[0],nblk*nFunCorr,MPI_INT,MPI_SUM,world);
+    MPI_Allreduce(MPI_IN_PLACE,MSD[0],3*nblk,MPI_DOUBLE,MPI_SUM,world);
+    MPI_Allreduce(MPI_IN_PLACE,NGP[0],4*nblk,MPI_DOUBLE,MPI_SUM,world);
+    MPI_Allreduce(MPI_IN_PLACE,countMSD,nblk,MPI_INT,MPI_SUM,world);
+    MPI_Allreduce(MPI_IN_PLACE,countNGP,nblk,MPI_INT,MPI_SUM,world);
+    MPI_Allreduce(MPI_IN_PLACE,correlationVACF[0],3*nc,MPI_DOUBLE,MPI_SUM,world);
+    MPI_Allreduce(MPI_IN_PLACE,correlationIn2[0],9*nFunCorr*N_cor,MPI_DOUBLE,MPI_SUM,world);
+    MPI_Allreduce(MPI_IN_PLACE,countIn2,N_cor,MPI_INT,MPI_SUM,world);
   }
-  
+
 /***************************************************************************************/
 
-  void FixScatteringBulk::AccumSpacetimeCorr (){
+  void FixScatteringBulk::AccumSpacetimeCorr (int reset){
     
+    ReduceSpacetimeCorr ();
+
+    if (me == 0) {
     // print coherent
         long double sysTime = update->ntimestep*nevery*update->dt;;
     //printf("systemTime %Lf\n",sysTime);
@@ -670,11 +1493,23 @@ void FixScatteringBulk::AllocArrays(){
     out = fopen(out_string3.c_str(),"w");
     PrintStrucFac (out);
     fclose(out);
+    }
     
+    // without reset, proc 0 keeps the reduced self sums
+    if (!reset) {
+      if (me != 0) {
+        int npart = size_partial();
+        double *part;
+        memory->create(part,npart,"scattering/bulk:part");
+        for (int i = 0; i < npart; i ++) part[i] = 0.0;
+        unpack_partial(part);
+        memory->destroy(part);
+      }
+      return;
+    }
 
-    
     count = 0;
-    for (int m = 0; m < nFunCorr; m ++) {
+    for (int m = 0; m < ncol; m ++) {
       strucFac[m]=0.0;
     }
     
@@ -688,40 +1523,23 @@ void FixScatteringBulk::AllocArrays(){
 
   void FixScatteringBulk::ZeroSpacetimeCorr () 
   {
-    int N=atom->nlocal;
+    int nlocal = atom->nlocal;
     
-    for (int kp = 0; kp < N_blocks*N_levels; kp ++) {
-      for (int j = 0; j < 6* nFunCorr; j ++) { 
-	shift[kp][j] = -2E10;
-      }
-      for (int j = 0; j < nFunCorr; j ++) { 
-	correlation[kp][j] = 0.;
+    corST->zero();
+    corVACF->zero();
+    
+    for (int i = 0; i < nlocal; i ++) {
+      for (int j = 0; j < 3*N_blocks*N_levels; j ++) { 
+	peratom[i][off_vshift+j] = 0.;
       }
-      countcor[kp] = 0;
-    }
-    for (int k = 0; k < N_levels; k ++) {
-      for (int j = 0; j < 6 * nFunCorr; j ++) { 
-	accumulator[k][j] = 0.;
+      for (int j = 0; j < 3*N_levels; j ++) { 
+	peratom[i][off_vacc+j] = 0.;
       }
-      naccumulator[k] = 0;
-      insertindex[k] = 0;
     }
-    
-        for (int kp = 0; kp < N_blocks*N_levels; kp ++) {
-      for (int j = 0; j < 3*N; j ++) { 
-	shiftVACF[kp][j] = -2E10;
-      }
+    for (int kp = 0; kp < N_blocks*N_levels; kp ++) {
       for (int j = 0; j < 3; j ++) { 
 	correlationVACF[kp][j] = 0.;
       }
-      countcorVACF[kp] = 0;
-    }
-    for (int k = 0; k < N_levels; k ++) {
-      for (int j = 0; j < 3*N; j ++) { 
-	accumulatorVACF[k][j] = 0.;
-      }
-      naccumulatorVACF[k] = 0;
-      insertindexVACF[k] = 0;
     }
   }
 
@@ -729,14 +1547,14 @@ void FixScatteringBulk::AllocArrays(){
   
   void FixScatteringBulk::ZeroSpacetimeCorrIn () 
   {
-    int N=atom->nlocal;
+    int nlocal = atom->nlocal;
     
-    for (int kp = 0; kp < N_blocks*N_levels_msd; kp ++) {
-      for (int i = 0; i < N; i ++) { 
-	blocking_sum[kp][i] = 0.;
-	blocking_sum[kp][i+N] = 0.;
-	blocking_sum[kp][i+2*N] = 0.;
+    for (int i = 0; i < nlocal; i ++) {
+      for (int j = 0; j < 3*N_blocks*N_levels_msd; j ++) { 
+	peratom[i][off_block+j] = 0.;
       }
+    }
+    for (int kp = 0; kp < N_blocks*N_levels_msd; kp ++) {
       for (int j = 0; j < nFunCorr; j ++) { 
 	correlationIn[kp][j] = 0.;
 	countIn[kp][j] = 0;
@@ -760,10 +1578,12 @@ void FixScatteringBulk::AllocArrays(){
   void FixScatteringBulk::ZeroSpacetimeCorrIn2 () 
   {
     
-    for (int tloc = 0; tloc < N_cor; tloc ++) {
-      for (int j = 0; j < 9*nFunCorr; j ++) { 
-        correlationIn2[tloc][j] = 0.;
+    for (int j = 0; j < 9*nFunCorr; j ++) { 
+      for (int tloc = 0; tloc < N_cor; tloc ++) {
+        correlationIn2[j][tloc] = 0.;
       }
+    }
+    for (int tloc = 0; tloc < N_cor; tloc ++) {
       countIn2[tloc] = 0;
     }
  
@@ -773,15 +1593,15 @@ void FixScatteringBulk::AllocArrays(){
   
   void FixScatteringBulk::PrintStrucFac  (FILE *fp){
 
-        int N=atom->nlocal;
+        double N = natoms;
     
     fprintf(fp,"#qval S(q)\n");
   
-    // print structure factor
-    double kval = 2. * M_PI / domain->xprd;
-    for (int m = 0; m < nFunCorr; m ++) {
-      fprintf(fp,"%f ",(m+1)*kval);
-	fprintf(fp,"%f ",strucFac[m]/((double) count)/3. / ((double) N));
+    // print structure factor, averaged over the k-vectors of each column
+    for (int m = 0; m < ncol; m ++) {
+      if (ncol_chan[m] == 0) continue;
+      fprintf(fp,"%f ",kcolumn(m));
+	fprintf(fp,"%f ",strucFac[m]/((double) count)/ncol_chan[m] / ((double) N));
       
       fprintf(fp,"\n");
     }
@@ -793,46 +1613,34 @@ void FixScatteringBulk::AllocArrays(){
     real tVal;
     int j, n;
     
-    int N=atom->nlocal;
+    double N = natoms;
     const double dt = nevery*update->dt;
 
-    double kVal = 2. * M_PI / domain->xprd;
       fprintf (fp, "(1):t ");
-      for (int m = 0; m < nFunCorr; m ++) {
-          fprintf (fp, "(%d):%f ",(m+1)*kVal,m+2);
+      for (int m = 0; m < ncol; m ++) {
+          fprintf (fp, "(%d):%f ",m+2,kcolumn(m));
       }
       for (int m = 0; m < 3; m ++) {
-          fprintf (fp, "(%d):VACFdim(%d) ",m+202,m);
+          fprintf (fp, "(%d):VACFdim(%d) ",m+ncol+2,m);
       }
       fprintf (fp, "\n");
       
-      for (int j=0;j<N_blocks;++j) {
-	if (countcor[j] > 0) {
-	  double t = j*dt;
-	  fprintf (fp, "%8.4f", t);
-	  for (int m = 0; m < nFunCorr; m ++) {
-	    int nv = m ;
-	    fprintf (fp, " %8.4f", correlation[j][nv]/countcor[j]/N);
-	  }
-	  	  if (countcorVACF[j]>0) {
-	   fprintf (fp, " %10.6f %10.6f %10.6f", correlationVACF[j][0]/countcorVACF[j], correlationVACF[j][1]/countcorVACF[j], correlationVACF[j][2]/countcorVACF[j]);
-	  }
-	  fprintf (fp, "\n");
-	}
-      }
-      
-      for (int k=1;k<=kmax;++k) {
-	for (int j=dmin;j<N_blocks;++j) {
-	  if (countcor[k*N_blocks+j]>0) {
-	    double t = j * pow((double)N_count, k)*nevery*update->dt;
+      for (int k=0;k<=corST->max_level();++k) {
+	for (int j=corST->first_lag(k);j<N_blocks;++j) {
+	  bigint n = corST->count(k,j);
+	  if (n>0) {
+	    const real *corr = corST->correlation(k,j);
+	    double t = j * pow((double)N_count, k)*dt;
 	    fprintf (fp, "%8.4f", t);
-	    for (int m = 0; m < nFunCorr; m ++) {
+	    for (int m = 0; m < ncol; m ++) {
 	      int nv = m ;
-	      fprintf (fp, " %8.4f", correlation[k*N_blocks+j][nv]/countcor[k*N_blocks+j]/N);
+	      fprintf (fp, " %8.4f", ncol_chan[nv] ? corr[nv]/n/ncol_chan[nv]/N : 0.0);
+	    }
+	    bigint nVACF = corVACF->count(k,j);
+	    if (nVACF>0) {
+	      const real *cVACF = correlationVACF[k*N_blocks+j];
+	      fprintf (fp, " %10.6f %10.6f %10.6f", cVACF[0]/nVACF/N, cVACF[1]/nVACF/N, cVACF[2]/nVACF/N);
 	    }
-	    	  if (countcorVACF[k*N_blocks+j]>0) {
-	   fprintf (fp, " %10.6f %10.6f %10.6f", correlationVACF[k*N_blocks+j][0]/countcorVACF[k*N_blocks+j], correlationVACF[k*N_blocks+j][1]/countcorVACF[k*N_blocks+j], correlationVACF[k*N_blocks+j][2]/countcorVACF[k*N_blocks+j]);
-	  }
 	    fprintf (fp, "\n");
 	  }
 	}
@@ -904,7 +1712,7 @@ void FixScatteringBulk::AllocArrays(){
 	  fprintf (fp, "%8.4f", time_here);
 	  for (int m = 0; m < nFunCorr; m ++) {
 	    if (countIn2[tloc] > 0) {
-        for (int i=0; i<9; i++) fprintf (fp, " %10.8f", correlationIn2[tloc][9*m+i]/((double) countIn2[tloc]));
+        for (int i=0; i<9; i++) fprintf (fp, " %10.8f", correlationIn2[9*m+i][tloc]/((double) countIn2[tloc]));
       }
 	  }
 	  
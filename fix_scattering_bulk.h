@@ -21,6 +21,8 @@ FixStyle(scattering/bulk,FixScatteringBulk)
 #define LMP_FIX_SCATTERING_BULK_H
 
 #include "fix.h"
+#include "kiss_fft.h"
+#include "multi_tau.h"
 #include <vector>
 
 
@@ -30,6 +32,8 @@ FixStyle(scattering/bulk,FixScatteringBulk)
 	  AllocMem (a, n1, t *);\
 	  AllocMem (a[0], n1 * n2, t);\
 	  for (k = 1; k < n1; k ++) a[k] = a[k - 1] + n2;
+
+#define FreeMem2(a) free (a[0]); free (a)
 	  
 #define Sqr(x) ((x) * (x))
 
@@ -47,20 +51,73 @@ class FixScatteringBulk : public Fix {
     void init();
     void setup(int);
     void end_of_step();
+    double memory_usage();
+
+    void grow_arrays(int);
+    void copy_arrays(int, int, int);
+    int pack_exchange(int, double *);
+    int unpack_exchange(int, double *);
+
+    void write_restart(FILE *);
+    void restart(char *);
+    int pack_restart(int, double *);
+    void unpack_restart(int, int);
+    int size_restart(int);
+    int maxsize_restart();
 
   protected:
 
+    int me;
+    bigint natoms;
+
     real *valST;
-    real *valVEL;
     int nFunCorr;
+
+    // channels of the coherent correlator: complex rho(k) values
+    // contributing to ncol output columns (axis harmonics or k-shells)
+    int kspace;
+    double dk_shell, kmax_shell;
+    int nchan, ncol;
+    int * chan_col;
+    int * ncol_chan;
+    double * kcol;
+    int nkmax[3];
+    double prd_shell[3];     // box lengths the k-shells were set up for
+    int nkrow;
+    int ** krow;
+    double * rhok;
+
+    // grid/FFT evaluation of rho(k) for the shells
+    int gridflag;
+    int ngx, ngy, ngz, ngridfft;
+    int grid_order;
+    double * gridrho;
+    double ** rho_coeff;
+    double ** winv;
+    kiss_fft_cpx * fftbuf;
+    kiss_fft_cpx * fftwork;
+    kiss_fft_cfg fftcfg[3];
     
     real *strucFac;
 
     void AllocArrays();
+    void SetupChannels();
+    double kcolumn(int);
+    void EvalRhoShell ();
+    void SetupGrid();
+    void compute_rho_coeff();
+    void compute_rho1d(const double *, double [3][7]);
+    void EvalRhoGrid ();
     void EvalSpacetimeCorr ();
-    void add (real * val, int k);
-    void addVACF (real * val, int k, int N);
-    void AccumSpacetimeCorr ();
+    void EvalSelfBlocking (double, int);
+    void EvalSelfHistory (double, int);
+    int GroupList ();
+    void addVACF ();
+    void ReduceSpacetimeCorr ();
+    int size_partial ();
+    void pack_partial (double *);
+    void unpack_partial (double *);
+    void AccumSpacetimeCorr (int reset = 1);
     void ZeroSpacetimeCorr ();
     void ZeroSpacetimeCorrIn ();
     void ZeroSpacetimeCorrIn2 ();
@@ -75,8 +132,20 @@ class FixScatteringBulk : public Fix {
     int N_levels_msd;
     int N_cor;
     int dmin;
-    real ** blocking_sum;
-    real * pos_save;
+
+    // per-atom self part: offsets into peratom[i]
+    double ** peratom;
+    int nperatom;
+    int off_pos;      // last unwrapped position
+    int off_block;    // blocking sums of displacements, 3 x N_blocks*N_levels_msd
+    int off_vshift;   // VACF shift registers, 3 x N_blocks*N_levels
+    int off_vacc;     // VACF accumulators, 3 x N_levels
+    int off_hist;     // x,v,f history, 9 x N_cor (time contiguous)
+
+    int * glist;      // local atoms in the group
+    int maxglist;
+    int * act_level;  // blocking levels and blocks updated at this step
+    int * act_block;
     
     int nrelax;
 
@@ -90,25 +159,16 @@ class FixScatteringBulk : public Fix {
     int * countNGP;
 
     
-    int kmax;
     int t_loc;
     
-    real ** shift;
-    real ** accumulator;
-    int * naccumulator;
-    real ** correlation;
-    int * insertindex;
-    int * countcor;
-    
-    real ** shiftVACF;
-    real ** accumulatorVACF;
-    int * naccumulatorVACF;
+    // coherent part: re/im of every channel, summed into the ncol columns
+    MultiTau<real> * corST;
+
+    // VACF: shift registers are kept per atom, only the schedule is shared
+    MultiTau<real> * corVACF;
     real ** correlationVACF;
-    int * insertindexVACF;
-    int * countcorVACF;
 
-    real ** pos_save2;
-    real ** correlationIn2;
+    real ** correlationIn2;     // [9*m+q][lag]
     int * countIn2;
     int lastindex;
   };
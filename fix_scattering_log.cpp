@@ -11,6 +11,7 @@
    See the README file in the top-level LAMMPS directory.
 ------------------------------------------------------------------------- */
 
+#include "math.h"
 #include "stdlib.h"
 #include "string.h"
 #include "unistd.h"
@@ -28,23 +29,80 @@
 #include "force.h"
 #include "atom.h"
 #include "comm.h"
+#include <sstream>
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
 
+/* ----------------------------------------------------------------------
+   scattering in a slit along z, walls at boxlo[2] and boxlo[2]+channel_w
+   fix ID group scattering/log Nevery N_blocks N_levels nFunCorr nModes channel_w profileBins
+------------------------------------------------------------------------- */
+
 FixScatteringLog::FixScatteringLog(LAMMPS * lmp, int narg, char **arg):
   Fix (lmp, narg, arg)
 {
-  if (narg < 7) error->all(FLERR,"Illegal fix scattering/log command");
+  if (narg < 10) error->all(FLERR,"Illegal fix scattering/log command");
+  nevery = force->inumeric(FLERR,arg[3]);
+  N_blocks = force->inumeric(FLERR,arg[4]);
+  N_levels = force->inumeric(FLERR,arg[5]);
+  nFunCorr = force->inumeric(FLERR,arg[6]);
+  nModes = force->inumeric(FLERR,arg[7]);
+  channel_w = force->numeric(FLERR,arg[8]);
+  profileBins = force->inumeric(FLERR,arg[9]);
 
-  
+  if (nevery <= 0 || N_blocks < 2 || N_levels <= 0 || nFunCorr <= 0 ||
+      nModes <= 0 || channel_w <= 1.0 || profileBins <= 0)
+    error->all(FLERR,"Illegal fix scattering/log command");
+  if (domain->triclinic)
+    error->all(FLERR,"Fix scattering/log requires an orthogonal box");
+  if (domain->xprd != domain->yprd && comm->me == 0)
+    error->warning(FLERR,"Fix scattering/log uses 2 pi/yprd for both in-plane directions");
+
+  MPI_Comm_rank(world,&me);
+
+  restart_global = 1;
+  restart_peratom = 1;
+
+  off_pos = 0;
+  off_block = off_pos + 3;
+  nperatom = off_block + 3*N_blocks*N_levels;
+
+  peratom = NULL;
+  AllocArrays();
+
+  // statistics are kept over successive runs
+
+    profileCount = 0;
+    for (int i=0; i<profileBins; i++) {
+      densityProfile[i]=0.0;
+    }
+    for (int j=0; j<nFunCorr; j++) {
+      for (int n=0; n<(2*nModes-1)*(2*nModes-1); n++) {
+	strucFac[j][n]=0.0;
+      }
+    }
+    
+    t_loc = 0;
+    ZeroSpacetimeCorr ();
+    ZeroSpacetimeCorrIn ();
 }
 
 /* ---------------------------------------------------------------------- */
 
 FixScatteringLog::~FixScatteringLog()
 {
-  
+  atom->delete_callback(id,0);
+  atom->delete_callback(id,1);
+  memory->destroy(peratom);
+
+  free (valST);
+  free (valCh);
+  free (densityProfile);
+  FreeMem2 (strucFac);
+  FreeMem2 (correlationIn);
+  FreeMem2 (countIn);
+  delete corST;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -59,46 +117,215 @@ int FixScatteringLog::setmask()
 /* ---------------------------------------------------------------------- */
 
 void FixScatteringLog::init() {
-    profileCount = 0;
-    AllocArrays();
-    //printf("pb %d\n",profileBins);
-    for (int i=0; i<profileBins; i++) {
-      densityProfile[i]=0.0;
-    }
-    for (int j=0; j<nFunCorr; j++) {
-      for (int n=0; n<(2*nModes-1)*(2*nModes-1); n++) {
-	strucFac[j][n]=0.0;
-      }
-    }
-    
-    t_loc = 0;
-    kmax = 0;
-    ZeroSpacetimeCorr ();
-    ZeroSpacetimeCorrIn ();
+
+  // normalization by all atoms in the group, not only the local ones
+
+  natoms = group->count(igroup);
+  if (natoms == 0) error->all(FLERR,"FixScatteringLog group has no atoms");
 }
 
 /* ---------------------------------------------------------------------- */
   
 void FixScatteringLog::setup(int vflag) {
-  end_of_step();
+
 }
 
 /* ---------------------------------------------------------------------- */
 
 void FixScatteringLog::end_of_step() {
-  // Do every timestep (or every tickerstep)
-  //printf("Ticker, EvalSlit\n");
-  EvalSpacetimeCorr ();
+  // Do every nevery timesteps
+  if (update->ntimestep % nevery == 0)
+    EvalSpacetimeCorr ();
   
-  if (timestep == update->ntimestep) {
+  if (update->ntimestep == update->laststep && profileCount > 0) {
     output();
   }
 }
 
 /* ---------------------------------------------------------------------- */
 
+double FixScatteringLog::memory_usage()
+{
+  double bytes = atom->nmax * nperatom * sizeof(double);
+  bytes += (profileBins + 8*nModes*nFunCorr + nFunCorr*(2*nModes-1)*(2*nModes-1)) * sizeof(real);
+  bytes += 4*nModes*nFunCorr * sizeof(real) + corST->memory_usage();
+  bytes += N_blocks*N_levels * nModes*nFunCorr * (sizeof(real) + sizeof(int));
+  return bytes;
+}
+
+/* ----------------------------------------------------------------------
+   allocate atom-based array
+------------------------------------------------------------------------- */
+
+void FixScatteringLog::grow_arrays(int nmax)
+{
+  memory->grow(peratom,nmax,nperatom,"scattering/log:peratom");
+}
+
+/* ----------------------------------------------------------------------
+   copy values within local atom-based array
+------------------------------------------------------------------------- */
+
+void FixScatteringLog::copy_arrays(int i, int j, int delflag)
+{
+  memcpy(peratom[j],peratom[i],nperatom*sizeof(double));
+}
+
+/* ----------------------------------------------------------------------
+   pack values in local atom-based array for exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixScatteringLog::pack_exchange(int i, double *buf)
+{
+  for (int k = 0; k < nperatom; k++) buf[k] = peratom[i][k];
+  return nperatom;
+}
+
+/* ----------------------------------------------------------------------
+   unpack values in local atom-based array from exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixScatteringLog::unpack_exchange(int nlocal, double *buf)
+{
+  for (int k = 0; k < nperatom; k++) peratom[nlocal][k] = buf[k];
+  return nperatom;
+}
+
+/* ----------------------------------------------------------------------
+   pack values in local atom-based array for restart file
+------------------------------------------------------------------------- */
+
+int FixScatteringLog::pack_restart(int i, double *buf)
+{
+  buf[0] = nperatom+1;
+  for (int k = 0; k < nperatom; k++) buf[k+1] = peratom[i][k];
+  return nperatom+1;
+}
+
+/* ----------------------------------------------------------------------
+   unpack values from atom->extra array to restart the fix
+------------------------------------------------------------------------- */
+
+void FixScatteringLog::unpack_restart(int nlocal, int nth)
+{
+  double **extra = atom->extra;
+
+  // skip to Nth set of extra values
+
+  int m = 0;
+  for (int i = 0; i < nth; i++) m += static_cast<int> (extra[nlocal][m]);
+  m++;
+
+  for (int k = 0; k < nperatom; k++) peratom[nlocal][k] = extra[nlocal][m++];
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixScatteringLog::maxsize_restart()
+{
+  return nperatom+1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixScatteringLog::size_restart(int nlocal)
+{
+  return nperatom+1;
+}
+
+/* ----------------------------------------------------------------------
+   write data into restart file:
+   - settings, step counters, structure factor and the correlator
+   - density profile and self sums, reduced to proc 0
+------------------------------------------------------------------------- */
+
+void FixScatteringLog::write_restart(FILE *fp)
+{
+  int i;
+  int nsf = nFunCorr*(2*nModes-1)*(2*nModes-1);
+  int nself = N_blocks*N_levels*nModes*nFunCorr;
+  int npart = profileBins + 2*nself;
+  int nhead = 8 + nsf + corST->size_restart();
+
+  double *part, *list;
+  memory->create(part,npart,"scattering/log:part");
+  int n = 0;
+  for (i = 0; i < profileBins; i++) part[n++] = densityProfile[i];
+  for (i = 0; i < nself; i++) part[n++] = correlationIn[0][i];
+  for (i = 0; i < nself; i++) part[n++] = countIn[0][i];
+
+  if (me == 0) memory->create(list,nhead+npart,"scattering/log:list");
+  else list = NULL;
+  MPI_Reduce(part,(me == 0) ? &list[nhead] : NULL,npart,MPI_DOUBLE,MPI_SUM,0,world);
+  memory->destroy(part);
+
+  if (me == 0) {
+    n = 0;
+    list[n++] = N_blocks;
+    list[n++] = N_levels;
+    list[n++] = nFunCorr;
+    list[n++] = nModes;
+    list[n++] = profileBins;
+    list[n++] = channel_w;
+    list[n++] = t_loc;
+    list[n++] = profileCount;
+    for (i = 0; i < nsf; i++) list[n++] = strucFac[0][i];
+    n += corST->pack_restart(&list[n]);
+    n += npart;
+
+    int size = n * sizeof(double);
+    fwrite(&size,sizeof(int),1,fp);
+    fwrite(list,sizeof(double),n,fp);
+    memory->destroy(list);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   use state info from restart file to restart the fix
+   density profile and self sums are only kept by proc 0 so that the
+   next reduction does not count them nprocs times
+------------------------------------------------------------------------- */
+
+void FixScatteringLog::restart(char *buf)
+{
+  double *list = (double *) buf;
+  int i, n = 0;
+  int nsf = nFunCorr*(2*nModes-1)*(2*nModes-1);
+  int nself = N_blocks*N_levels*nModes*nFunCorr;
+
+  if (static_cast<int> (list[n++]) != N_blocks ||
+      static_cast<int> (list[n++]) != N_levels ||
+      static_cast<int> (list[n++]) != nFunCorr ||
+      static_cast<int> (list[n++]) != nModes ||
+      static_cast<int> (list[n++]) != profileBins ||
+      list[n++] != channel_w)
+    error->all(FLERR,"Fix scattering/log settings changed since restart");
+
+  t_loc = static_cast<int> (list[n++]);
+  profileCount = static_cast<int> (list[n++]);
+  for (i = 0; i < nsf; i++) strucFac[0][i] = list[n++];
+
+  int m = corST->unpack_restart(&list[n]);
+  if (m < 0) error->all(FLERR,"Fix scattering/log settings changed since restart");
+  n += m;
+
+  if (me != 0) return;
+  for (i = 0; i < profileBins; i++) densityProfile[i] = list[n++];
+  for (i = 0; i < nself; i++) correlationIn[0][i] = list[n++];
+  for (i = 0; i < nself; i++) countIn[0][i] = static_cast<int> (list[n++]);
+}
+
+/* ---------------------------------------------------------------------- */
+
 void FixScatteringLog::output() {
-    long double sysTime = Sim->systemTime/Sim->units.unitTime();
+
+    // partial sums of the procs
+
+    MPI_Allreduce(MPI_IN_PLACE,densityProfile,profileBins,MPI_DOUBLE,MPI_SUM,world);
+    ReduceSpacetimeCorrIn ();
+
+    if (me == 0) {
+    long double sysTime = update->ntimestep*update->dt;
     std::stringstream ss2;
     ss2 << "density_profile_t" << sysTime << ".dat";
     printf("EvalSlit: Density-Profile output written to %s \n",(ss2.str()).c_str());
@@ -115,8 +342,6 @@ void FixScatteringLog::output() {
     PrintStrucFac (out);
     fclose(out);
     
-    profileCount = 0;
-    
     std::string out_string;
     std::stringstream ss;
     ss << "S_t" << sysTime << ".dat";
@@ -124,7 +349,6 @@ void FixScatteringLog::output() {
     printf("EvalSlit: Coherent scattering function output written to %s \n",(ss.str()).c_str());
     out = fopen(out_string.c_str(),"w");
     PrintSpacetimeCorr (out);
-    ZeroSpacetimeCorr ();
     fclose(out);
     
     std::string out_string4;
@@ -134,36 +358,52 @@ void FixScatteringLog::output() {
     printf("EvalSlit: Incoherent scattering function output written to %s \n",(ss4.str()).c_str());
     out = fopen(out_string4.c_str(),"w");
     PrintSpacetimeCorrIn (out);
-    ZeroSpacetimeCorrIn ();
     fclose(out);
+    }
+
+    // the statistics continue in the next run or from a restart file,
+    // proc 0 keeps the reduced partial sums
+
+    if (me != 0) {
+      for (int i=0; i<profileBins; i++) densityProfile[i] = 0.0;
+      for (int kp = 0; kp < N_blocks*N_levels; kp ++)
+	for (int j = 0; j < nModes * nFunCorr; j ++) {
+	  correlationIn[kp][j] = 0.;
+	  countIn[kp][j] = 0;
+	}
+    }
 }
   
   /* Help functions to calculate Structure factor and coherent scattering function */
   void FixScatteringLog::AllocArrays(){
-    int N=0;
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	N++;
-      }
-    }
-    //printf("particles %d\n",N);
-    int nb,k;
+    int k;
     AllocMem (valST, 8 * nModes * nFunCorr, real);
    
     AllocMem (densityProfile, profileBins, real);
     AllocMem2 (strucFac, nFunCorr, (2*nModes-1)*(2*nModes-1), real);
     
-    AllocMem2 (blocking_sum, N_blocks*N_levels, 2*N, real);
-    AllocMem2 (blocking_sumz, N_blocks*N_levels, N, real);
     AllocMem2 (correlationIn, N_blocks*N_levels,nModes * nFunCorr, real);
     AllocMem2 (countIn, N_blocks*N_levels,nModes * nFunCorr, int);
-    AllocMem2 (shift, N_blocks*N_levels, 8 * nModes * nFunCorr, real);
-    AllocMem2 (accumulator, N_levels, 8 * nModes * nFunCorr, real);
-    AllocMem (naccumulator, N_levels, int);
-    AllocMem2 (correlation, N_blocks*N_levels,nModes * nFunCorr, real);
-    AllocMem (countcor, N_blocks*N_levels,int);
-    AllocMem (insertindex, N_levels,int);
-    AllocMem (pos_save, 3*N,real);
+
+    // coherent correlator: channel (n,kp,m) adds re*re + im*im to column m + n*nFunCorr
+    int nch = 2 * nModes * nFunCorr;
+    int *col;
+    AllocMem (valCh, 2 * nch, real);
+    AllocMem (col, 2 * nch, int);
+    for (int n = 0; n < nModes; n ++)
+      for (int kp = 0; kp < 2; kp ++)
+	for (int m = 0; m < nFunCorr; m ++) {
+	  int ic = (n*2 + kp)*nFunCorr + m;
+	  col[2*ic] = col[2*ic+1] = m + n*nFunCorr;
+	}
+    corST = new MultiTau<real>(lmp,N_levels,N_blocks,N_blocks,1,2*nch,nModes*nFunCorr,col);
+    free (col);
+
+    // per-atom self part, migrates with the atoms
+
+    grow_arrays(atom->nmax);
+    atom->add_callback(0);
+    atom->add_callback(1);
   }
   
 /***************************************************************************************/
@@ -171,46 +411,52 @@ void FixScatteringLog::output() {
   void FixScatteringLog::EvalSpacetimeCorr (){
     real b, c, c0, c1, c2, kVal, s, s1, s2;
     real cc, sc, QVal;
-    int j,  k, m, nb,  nv;
-    
-    const double dt = dynamic_cast<const SysTicker&>(*Sim->systems["SystemTicker"]).getPeriod() / Sim->units.unitTime();
+    int i, j,  k, m, n, nv;
     
-    int N=0;
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	N++;
-      }
-    }
-    for (j = 0; j < 8 * nModes * nFunCorr; j ++) valST[j] = 0.;
+    int nlocal = atom->nlocal;
+    int *mask = atom->mask;
+    double **x = atom->x;
+    imageint *image = atom->image;
+    const double zlo = domain->boxlo[2];
+
+    const int nval = 8 * nModes * nFunCorr;
+    real *val = valST;
+    for (j = 0; j < nval; j ++) val[j] = 0.;
     
-    // calculate the density profile
+    // calculate the density profile, local counts are summed at output
     profileCount++;
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	double pos = Sim->particles[p1].getPosition()[2];
+    real *prof = densityProfile;
+    const int nprof = profileBins;
+    #if defined(_OPENMP)
+    #pragma omp parallel for private(i) reduction(+:prof[:nprof])
+    #endif
+    for (i = 0; i < nlocal; i++) {
+      if (mask[i] & groupbit) {
+	double pos = x[i][2] - zlo;
 	pos /= channel_w;
-	if (pos < 1) densityProfile[int(pos*profileBins)]++;
+	if (pos >= 0 && pos < 1) prof[int(pos*nprof)]++;
       }
     }
-    kVal = 2. * M_PI / Sim->primaryCellSize[1];
+    kVal = 2. * M_PI / domain->yprd;
     QVal = 2. * M_PI /(channel_w-1.0);
     
-    //printf("check00\n");
-    
     // calculate FT for coherent scattering fct
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
+    // partial sums of the local atoms, summed over all procs
+    #if defined(_OPENMP)
+    #pragma omp parallel for private(i,j,k,m,n,b,c,c0,c1,c2,s,s1,s2,cc,sc) reduction(+:val[:nval])
+    #endif
+    for (i = 0; i < nlocal; i++) {
+      if (mask[i] & groupbit) {
 	j = 0;
-	//printf("pos %f\n",(Sim->particles[p1].getPosition()[2]-channel_w/2.0));
-	for (int n=0; n<nModes; n++) {
-	  cc = cos (n*QVal*(Sim->particles[p1].getPosition()[2]-channel_w/2.0));
-	  sc = sin (n*QVal*(Sim->particles[p1].getPosition()[2]-channel_w/2.0));
+	const double zc = x[i][2] - zlo - channel_w/2.0;
+	for (n=0; n<nModes; n++) {
+	  cc = cos (n*QVal*zc);
+	  sc = sin (n*QVal*zc);
 
 	  for (k = 0; k < 2; k ++) {
 	    for (m = 0; m < nFunCorr; m ++) {
 	      if (m == 0) {
-		b = kVal * Sim->particles[p1].getPosition()[k];
-		//if (k==0) printf("x coord %f\n",Sim->particles[p1].getPosition()[k]);
+		b = kVal * x[i][k];
 		c = cos (b);
 		s = sin (b);
 		c0 = c;
@@ -227,19 +473,24 @@ void FixScatteringLog::output() {
 		c = 2. * c0 * c1 - c2;
 		s = 2. * c0 * s1 - s2;
 	      }
-	      valST[j ++] += c*cc; //second element of SF -real part
-	      valST[j ++] += c*sc; //imaginary 
-	      valST[j ++] += s*cc; //second element of SF -real part
-	      valST[j ++] += s*sc; //imaginary 
+	      val[j ++] += c*cc; //second element of SF -real part
+	      val[j ++] += c*sc; //imaginary 
+	      val[j ++] += s*cc; //second element of SF -real part
+	      val[j ++] += s*sc; //imaginary 
 	    }
 	  }
 	}
       }
     }
+    MPI_Allreduce(MPI_IN_PLACE,valST,nval,MPI_DOUBLE,MPI_SUM,world);
+
     // acumualte and calculate logarithmic correlation function
-    add(valST,0);
-    
-    //printf("check0\n");
+    // re = c_cc + s_sc, im = s_cc + c_sc of every mode, axis and harmonic
+    for (j = 0; j < 2 * nModes * nFunCorr; j ++) {
+      valCh[2*j] = valST[4*j] - valST[4*j+3];
+      valCh[2*j+1] = valST[4*j+2] + valST[4*j+1];
+    }
+    corST->add(valCh);
     
     // calc structure factor
     for (int n=-nModes+1; n<nModes; n++) {
@@ -265,76 +516,84 @@ void FixScatteringLog::output() {
 	      c_sc2 = - c_sc2;
 	    }
 	    strucFac[m][(n+nModes-1)*(2*nModes-1)+n2+nModes-1] += (c_cc + s_sc)*(c_cc2 + s_sc2) + (s_cc+c_sc)*(s_cc2+c_sc2);
-	    //strucFac[m][n*(2*nModes-1)+n2] += 1.0;
 	  }
 	}
       }
     }
     
-    //printf("check1\n");
-    
     // calculate \Delta r in blocking algorithm for self-intermediate scattering function
-    int i = t_loc;
-    int np=0;
-    int max_levels = (int) (log(i)/log(N_blocks));
+    // the blocking sums are stored per atom: x,y,z of block j0+k*N_blocks
+    int t = t_loc;
+    int max_levels = (t > 0) ? (int) (log(t)/log(N_blocks)) : -1;
     if (max_levels >= N_levels) max_levels = N_levels-1;
-    //printf("max_l %d\n",max_levels);
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	double delx,dely,delz;
+
+#if defined(_OPENMP)
+    const int nblk = N_blocks*N_levels;     // extent of the reductions
+#endif
+    const int ncorr = nModes * nFunCorr;
+    real *cIn = correlationIn[0];
+    int *cntIn = countIn[0];
+    double unwrap[3];
+    #if defined(_OPENMP)
+    #pragma omp parallel for private(i,k,m,n,nv,b,c,c0,c1,c2,s,s1,s2,cc,sc,unwrap) reduction(+:cIn[:nblk*ncorr],cntIn[:nblk*ncorr])
+    #endif
+    for (i = 0; i < nlocal; i++) {
+      if (mask[i] & groupbit) {
+	double del[3];
+	double *pos_save = peratom[i] + off_pos;
+	double *blocking_sum = peratom[i] + off_block;
 	int j0; // = i % N_blocks;
-	//if (np==0) printf("checkin0\n");
-	if (i==0) {
-	  pos_save[3*np] = Sim->particles[p1].getPosition()[0];
-	  pos_save[3*np+1] = Sim->particles[p1].getPosition()[1];
-	  pos_save[3*np+2] = Sim->particles[p1].getPosition()[2];
+	domain->unmap(x[i],image[i],unwrap);
+	if (t==0) {
+	  pos_save[0] = unwrap[0];
+	  pos_save[1] = unwrap[1];
+	  pos_save[2] = unwrap[2];
 	}
-	for (int k=0; k<(max_levels+1); k++) {
+	for (k=0; k<(max_levels+1); k++) {
 	    
 	  if (k==0) {
-	    delx = Sim->particles[p1].getPosition()[0]-pos_save[3*np];
-	    dely = Sim->particles[p1].getPosition()[1]-pos_save[3*np+1];
-	    delz = Sim->particles[p1].getPosition()[2]-pos_save[3*np+2];
-	    pos_save[3*np] = Sim->particles[p1].getPosition()[0];
-	    pos_save[3*np+1] = Sim->particles[p1].getPosition()[1];
-	    pos_save[3*np+2] = Sim->particles[p1].getPosition()[2];
+	    del[0] = unwrap[0]-pos_save[0];
+	    del[1] = unwrap[1]-pos_save[1];
+	    del[2] = unwrap[2]-pos_save[2];
+	    pos_save[0] = unwrap[0];
+	    pos_save[1] = unwrap[1];
+	    pos_save[2] = unwrap[2];
 	  } else {
-	    delx = blocking_sum[N_blocks-1+(k-1)*N_blocks][np];
-	    dely = blocking_sum[N_blocks-1+(k-1)*N_blocks][np+N];
-	    delz = blocking_sumz[N_blocks-1+(k-1)*N_blocks][np];
+	    const double *prev = blocking_sum + 3*(N_blocks-1+(k-1)*N_blocks);
+	    del[0] = prev[0];
+	    del[1] = prev[1];
+	    del[2] = prev[2];
 	  }
 	    
 	  int nblocks_to_k = 1 ; // (int) round(pow(N_blocks,k));
 
 	  for (int kk=0; kk<k; kk++) nblocks_to_k *= N_blocks;
-	  //if (np==0) printf("checkin1\n");
-	  if (i % nblocks_to_k == 0) {
+	  if (t % nblocks_to_k == 0) {
 	      
-	    j0 =  ((i) / nblocks_to_k-1) % N_blocks;  // was -1
+	    j0 =  ((t) / nblocks_to_k-1) % N_blocks;  // was -1
+	    const int jb = j0+k*N_blocks;
+	    double *bs = blocking_sum + 3*jb;
 
 	    if (j0==0) {
-	      blocking_sum[j0+k*N_blocks][np] = delx; //blocking_sum[N_blocks-1][k-1][n] ;
-	      blocking_sum[j0+k*N_blocks][np+N] = dely; //blocking_sum[N_blocks-1][k-1][n] ;
-	      blocking_sumz[j0+k*N_blocks][np] = delz; //blocking_sum[N_blocks-1][k-1][n] ;
+	      bs[0] = del[0];
+	      bs[1] = del[1];
+	      bs[2] = del[2];
 	    }
 	    else {
-	      blocking_sum[j0+k*N_blocks][np] = blocking_sum[j0-1+k*N_blocks][np] + delx; 
-	      blocking_sum[j0+k*N_blocks][np+N] = blocking_sum[j0-1+k*N_blocks][np+N] + dely; 
-	      blocking_sumz[j0+k*N_blocks][np] = blocking_sumz[j0-1+k*N_blocks][np] + delz; 
+	      bs[0] = bs[-3] + del[0];
+	      bs[1] = bs[-2] + del[1];
+	      bs[2] = bs[-1] + del[2];
 	    }
-	    
-	    //if (np==0) printf("checkin2\n");
 
 	    // now calculate incoherent scattering functions
-	    for (int n=0; n<nModes; n++) {
-	      cc = cos (n*QVal*blocking_sumz[j0+k*N_blocks][np]);
-	      sc = sin (n*QVal*blocking_sumz[j0+k*N_blocks][np]);
+	    for (n=0; n<nModes; n++) {
+	      cc = cos (n*QVal*bs[2]);
+	      sc = sin (n*QVal*bs[2]);
 
 	      for (int km = 0; km < 2; km ++) {
 		for (m = 0; m < nFunCorr; m ++) {
 		  if (m == 0) {
-		    b = kVal * blocking_sum[j0+k*N_blocks][km*N+np] ;
-		    //if (k==0) printf("x coord %f\n",Sim->particles[p1].getPosition()[k]);
+		    b = kVal * bs[km];
 		    c = cos (b);
 		    s = sin (b);
 		    c0 = c;
@@ -353,126 +612,46 @@ void FixScatteringLog::output() {
 		  }
 		  
 		  nv = m + n*nFunCorr;
-		  correlationIn[j0+k*N_blocks][nv] += c*cc-s*sc;
-		  countIn[j0+k*N_blocks][nv] += 1;
+		  cIn[jb*ncorr+nv] += c*cc-s*sc;
+		  cntIn[jb*ncorr+nv] += 1;
 		}
 	      }
 	    }
-	    //if (np==0) printf("checkin3\n");
 	  }
 	}
-	np++;
       }
     }
     
-    //printf("check2\n");
-    
     int t_tot = (int) pow(N_blocks,N_levels);
     if (t_loc == t_tot) {
       AccumSpacetimeCorr ();
       t_loc = 0;
-      kmax = 0;
     } else t_loc++;
   }
   
   /***************************************************************************************/
   
-  void FixScatteringLog::add(real * val, int k){
-    // If we exceed the correlator side, the value is discarded
-    if (k == N_levels) return;
-    if (k > kmax) kmax=k;
-
-    // Insert new value in shift array
-    for (int i = 0; i < 8 * nFunCorr * nModes; i ++)
-      shift[k*N_blocks+insertindex[k]][i] = val[i];
-
-    // Add to accumulator and, if needed, add to next correlator
-    for (int i = 0; i < 8 * nFunCorr * nModes; i ++)
-      accumulator[k][i] += val[i];
-    ++naccumulator[k];
-    if (naccumulator[k]==N_blocks) {
-      for (int i = 0; i < 8 * nFunCorr * nModes; i ++) accumulator[k][i] /= N_blocks;
-      add(&accumulator[k][0], k+1);
-      for (int i = 0; i < 8 * nFunCorr * nModes; i ++) accumulator[k][i]=0.0;
-      naccumulator[k]=0;
-    }
+/***************************************************************************************/
 
-    // Calculate correlation function
-    unsigned int ind1=insertindex[k];
-    if (k==0) { // First correlator is different
-      int ind2=ind1;
-      for (int j=0;j<N_blocks;++j) {
-	for (int n=0; n<nModes; n++) {
-	  for (int kp = 0; kp < 2; kp ++) {
-	    for (int m = 0; m < nFunCorr; m ++) {
-	      int nv = m + n*nFunCorr;
-	      int ind_j = n*8*nFunCorr + kp*4*nFunCorr + 4*m;
-	      double c_cc = shift[k*N_blocks+ind2][ind_j];
-	      double c_sc = shift[k*N_blocks+ind2][ind_j+1];
-	      double s_cc = shift[k*N_blocks+ind2][ind_j+2];
-	      double s_sc = -shift[k*N_blocks+ind2][ind_j+3];
-	      double c_cc2 = shift[k*N_blocks+ind1][ind_j];
-	      double c_sc2 = shift[k*N_blocks+ind1][ind_j+1];
-	      double s_cc2 = shift[k*N_blocks+ind1][ind_j+2];
-	      double s_sc2 = -shift[k*N_blocks+ind1][ind_j+3];
-	      //printf("befor calc\n");
-	      if (c_cc > -1e10) {
-		correlation[k*N_blocks+j][nv]  += (c_cc + s_sc)*(c_cc2 + s_sc2) + (s_cc+c_sc)*(s_cc2+c_sc2);
-	      //printf("after calc\n");
-	      //if (n==1) printf("%f \n",tBuf[nb].acfST[nv][tBuf[nb].count]);
-		if (nv==0) ++countcor[k*N_blocks+j];
-	      }
-	    }
-	  }
-	}
-	--ind2;
-	if (ind2<0) ind2+=N_blocks;
-      }
-    } else {
-      int ind2=ind1-1;
-      for (int j=1;j<N_blocks;++j) {
-	if (ind2<0) ind2+=N_blocks;
-	for (int n=0; n<nModes; n++) {
-	  for (int kp = 0; kp < 2; kp ++) {
-	    for (int m = 0; m < nFunCorr; m ++) {
-	      int nv = m + n*nFunCorr;
-	      int ind_j = n*8*nFunCorr + kp*4*nFunCorr + 4*m;
-	      double c_cc = shift[k*N_blocks+ind2][ind_j];
-	      double c_sc = shift[k*N_blocks+ind2][ind_j+1];
-	      double s_cc = shift[k*N_blocks+ind2][ind_j+2];
-	      double s_sc = -shift[k*N_blocks+ind2][ind_j+3];
-	      double c_cc2 = shift[k*N_blocks+ind1][ind_j];
-	      double c_sc2 = shift[k*N_blocks+ind1][ind_j+1];
-	      double s_cc2 = shift[k*N_blocks+ind1][ind_j+2];
-	      double s_sc2 = -shift[k*N_blocks+ind1][ind_j+3];
-	      //printf("befor calc\n");
-	      if (c_cc > -1e10) {
-		correlation[k*N_blocks+j][nv]  += (c_cc + s_sc)*(c_cc2 + s_sc2) + (s_cc+c_sc)*(s_cc2+c_sc2);
-		//printf("after calc\n");
-		//if (n==1) printf("%f \n",tBuf[nb].acfST[nv][tBuf[nb].count]);
-		if (nv==0) ++countcor[k*N_blocks+j];
-	      }
-	    }
-	  }
-	}
-	--ind2;
-      }
-    }
+  void FixScatteringLog::ReduceSpacetimeCorrIn (){
 
-    ++insertindex[k];
-    if (insertindex[k]==N_blocks) insertindex[k]=0;
+    // self part is a partial sum over the local atoms,
+    // the coherent part is computed from reduced values already
 
+    int n = N_blocks*N_levels*nModes*nFunCorr;
+    MPI_Allreduce(MPI_IN_PLACE,correlationIn[0],n,MPI_DOUBLE,MPI_SUM,world);
+    MPI_Allreduce(MPI_IN_PLACE,countIn[0],n,MPI_INT,MPI_SUM,world);
   }
-  
+
 /***************************************************************************************/
 
   void FixScatteringLog::AccumSpacetimeCorr (){
     
-    printf("accum1\n");
+    ReduceSpacetimeCorrIn ();
 
+    if (me == 0) {
     // print coherent
-    long double sysTime = Sim->systemTime/Sim->units.unitTime();
-    //printf("systemTime %Lf\n",sysTime);
+    long double sysTime = update->ntimestep*update->dt;
     std::string out_string;
     std::stringstream ss;
     ss << "S_t" << sysTime << ".dat";
@@ -480,11 +659,8 @@ void FixScatteringLog::output() {
     printf("EvalSlit: Coherent scattering function output written to %s \n",(ss.str()).c_str());
     FILE * out = fopen(out_string.c_str(),"w");
     PrintSpacetimeCorr (out);
-    ZeroSpacetimeCorr ();
     fclose(out);
     
-    printf("accum2\n");
-    
     // incoherent scattering fct
     std::string out_string2;
     std::stringstream ss2;
@@ -493,51 +669,32 @@ void FixScatteringLog::output() {
     printf("EvalSlit: Incoherent scattering function output written to %s \n",(ss2.str()).c_str());
     out = fopen(out_string2.c_str(),"w");
     PrintSpacetimeCorrIn (out);
-    ZeroSpacetimeCorrIn ();
     fclose(out);
-    
-    printf("accum3\n");
+    }
+
+    ZeroSpacetimeCorr ();
+    ZeroSpacetimeCorrIn ();
   }
   
 /***************************************************************************************/
 
   void FixScatteringLog::ZeroSpacetimeCorr () 
   {
-    for (int kp = 0; kp < N_blocks*N_levels; kp ++) {
-      for (int j = 0; j < 8*nModes * nFunCorr; j ++) { 
-	shift[kp][j] = -2E10;
-      }
-      for (int j = 0; j < nModes * nFunCorr; j ++) { 
-	correlation[kp][j] = 0.;
-      }
-      countcor[kp] = 0;
-    }
-    for (int k = 0; k < N_levels; k ++) {
-      for (int j = 0; j < 8*nModes * nFunCorr; j ++) { 
-	accumulator[k][j] = 0.;
-      }
-      naccumulator[k] = 0;
-      insertindex[k] = 0;
-    }
+    corST->zero();
   }
 
 /***************************************************************************************/
   
   void FixScatteringLog::ZeroSpacetimeCorrIn () 
   {
-    int N=0;
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	N++;
+    int nlocal = atom->nlocal;
+    
+    for (int i = 0; i < nlocal; i ++) {
+      for (int j = 0; j < 3*N_blocks*N_levels; j ++) { 
+	peratom[i][off_block+j] = 0.;
       }
     }
-    
     for (int kp = 0; kp < N_blocks*N_levels; kp ++) {
-      for (int i = 0; i < N; i ++) { 
-	blocking_sumz[kp][i] = 0.;
-	blocking_sum[kp][i] = 0.;
-	blocking_sum[kp][i+N] = 0.;
-      }
       for (int j = 0; j < nModes * nFunCorr; j ++) { 
 	correlationIn[kp][j] = 0.;
 	countIn[kp][j] = 0;
@@ -551,19 +708,18 @@ void FixScatteringLog::output() {
   
   void FixScatteringLog::PrintDensityProfile (FILE *fp){
     real binsize = channel_w/((double) profileBins);
-    real vol = Sim->primaryCellSize[0]*Sim->primaryCellSize[1]*binsize;
+    real vol = domain->xprd*domain->yprd*binsize;
   
     double n0 = 0.0;
-    int N=0;
+    double N = 0.0;
     
     for (int i=0; i<profileBins; i++) {
       fprintf(fp,"%f %f\n",i*binsize-channel_w/2.0,densityProfile[i]/((double) profileCount)/vol);
       n0 += densityProfile[i]/((double) profileCount)/vol*binsize;
       N += densityProfile[i];
-      densityProfile[i] = 0;
     }
     
-    printf("EvalSlit: n=%f, n0=%f, N=%d\n",n0,n0*Sim->primaryCellSize[2]/4.0,N/profileCount);
+    printf("EvalSlit: n=%f, N=%f\n",n0,N/profileCount);
   }
   
 /***************************************************************************************/
@@ -580,14 +736,12 @@ void FixScatteringLog::output() {
     fprintf(fp,"\n");
     
     // print structure factor
-    real kval = 2. * M_PI / Sim->primaryCellSize[1];
+    real kval = 2. * M_PI / domain->yprd;
     for (int m = 0; m < nFunCorr; m ++) {
       fprintf(fp,"%f ",(m+1)*kval);
       for (int n=-nModes+1; n<nModes; n++) {
 	for (int n2=-nModes+1; n2<nModes; n2++) {
-	  for (const shared_ptr<Species>& sp1 : Sim->species) {
-	    fprintf(fp,"%f ",strucFac[m][(n+nModes-1)*(2*nModes-1)+n2+nModes-1]/((double) profileCount)/2. / sp1->getCount());
-	  }
+	  fprintf(fp,"%f ",strucFac[m][(n+nModes-1)*(2*nModes-1)+n2+nModes-1]/((double) profileCount)/2. / ((double) natoms));
 	}
       }
       fprintf(fp,"\n");
@@ -597,41 +751,25 @@ void FixScatteringLog::output() {
 /***************************************************************************************/
 
   void FixScatteringLog::PrintSpacetimeCorr (FILE *fp){
-    real tVal;
-    int j, n;
+    int n;
     
-    int N=0;
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	N++;
-      }
-    }
+    double N = natoms;
+    const double dt = nevery*update->dt;
 
     for (n=0; n<nModes; n++) {
       fprintf (fp, "n=%d\n",n);
       
-      const double dt = dynamic_cast<const SysTicker&>(*Sim->systems["SystemTicker"]).getPeriod() / Sim->units.unitTime();
-      
-      for (int j=0;j<N_blocks;++j) {
-	if (countcor[j] > 0) {
-	  double t = j*dt;
-	  fprintf (fp, "%8.4f", t);
-	  for (int m = 0; m < nFunCorr; m ++) {
-	    int nv = m + n*nFunCorr;
-	    fprintf (fp, " %8.4f", correlation[j][nv]/countcor[j]/N);
-	  }
-	  fprintf (fp, "\n");
-	}
-      }
-      
-      for (int k=1;k<=kmax;++k) {
-	for (int j=1;j<N_blocks;++j) {
-	  if (countcor[k*N_blocks+j]>0) {
+      // both in-plane axes add to a column
+      for (int k=0;k<=corST->max_level();++k) {
+	for (int j=corST->first_lag(k);j<N_blocks;++j) {
+	  bigint nc = 2*corST->count(k,j);
+	  if (nc>0) {
+	    const real *corr = corST->correlation(k,j);
 	    double t = j * pow((double)N_blocks, k)*dt;
 	    fprintf (fp, "%8.4f", t);
 	    for (int m = 0; m < nFunCorr; m ++) {
 	      int nv = m + n*nFunCorr;
-	      fprintf (fp, " %8.4f", correlation[k*N_blocks+j][nv]/countcor[k*N_blocks+j]/N);
+	      fprintf (fp, " %8.4f", corr[nv]/nc/N);
 	    }
 	    fprintf (fp, "\n");
 	  }
@@ -645,14 +783,12 @@ void FixScatteringLog::output() {
 /***************************************************************************************/
 
   void FixScatteringLog::PrintSpacetimeCorrIn (FILE *fp){
-    real tVal;
-    int j, n;
+    int n;
+    const double dt = nevery*update->dt;
 
     for (n=0; n<nModes; n++) {
       fprintf (fp, "n=%d\n",n);
       
-      const double dt = dynamic_cast<const SysTicker&>(*Sim->systems["SystemTicker"]).getPeriod() / Sim->units.unitTime();
-    
       for (int k=0; k<N_levels; k++)
 	for (int j=0; j<N_blocks; j++) {
 	  double time_here = (j+1) * (pow(N_blocks,k))*dt;
@@ -667,5 +803,3 @@ void FixScatteringLog::output() {
       fprintf (fp, "\n\n");
     }
   }
- 
-}
\ No newline at end of file
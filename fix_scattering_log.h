@@ -21,6 +21,7 @@ FixStyle(scattering/log,FixScatteringLog)
 #define LMP_FIX_SCATTERING_LOG_H
 
 #include "fix.h"
+#include "multi_tau.h"
 #include <vector>
 
 
@@ -30,6 +31,8 @@ FixStyle(scattering/log,FixScatteringLog)
 	  AllocMem (a, n1, t *);\
 	  AllocMem (a[0], n1 * n2, t);\
 	  for (k = 1; k < n1; k ++) a[k] = a[k - 1] + n2;
+
+#define FreeMem2(a) free (a[0]); free (a)
 	  
 #define Sqr(x) ((x) * (x))
 
@@ -47,11 +50,27 @@ class FixScatteringLog : public Fix {
     void init();
     void setup(int);
     void end_of_step();
-    
+    double memory_usage();
+
+    void grow_arrays(int);
+    void copy_arrays(int, int, int);
+    int pack_exchange(int, double *);
+    int unpack_exchange(int, double *);
+
+    void write_restart(FILE *);
+    void restart(char *);
+    int pack_restart(int, double *);
+    void unpack_restart(int, int);
+    int size_restart(int);
+    int maxsize_restart();
 
   protected:
 
+    int me;
+    bigint natoms;
+
     real *valST;
+    real *valCh;      // valST combined into re/im of the (n,axis,m) channels
     int nFunCorr;
     int nModes;
     real channel_w;
@@ -64,10 +83,10 @@ class FixScatteringLog : public Fix {
 
     void AllocArrays();
     void EvalSpacetimeCorr ();
-    void add (real * val, int k);
     void AccumSpacetimeCorr ();
     void ZeroSpacetimeCorr ();
     void ZeroSpacetimeCorrIn ();
+    void ReduceSpacetimeCorrIn ();
     void PrintSpacetimeCorr (FILE *fp);
     void PrintSpacetimeCorrIn (FILE *fp);
     void PrintDensityProfile (FILE *fp);
@@ -76,21 +95,20 @@ class FixScatteringLog : public Fix {
     
     int N_blocks;
     int N_levels;
-    real ** blocking_sum;
-    real * pos_save;
-    real ** blocking_sumz;
+
+    // per-atom self part: last unwrapped position and the blocking sums
+    // of the in-plane (x,y) and normal (z) displacements
+    double ** peratom;
+    int nperatom;
+    int off_pos;
+    int off_block;    // 3 x N_blocks*N_levels
+
     real ** correlationIn;
     int ** countIn;
-    int * insertindex;
     
-    int kmax;
     int t_loc;
     
-    real ** shift;
-    real ** accumulator;
-    int * naccumulator;
-    real ** correlation;
-    int * countcor;
+    MultiTau<real> * corST;
 
   };
 }
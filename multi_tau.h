@@ -0,0 +1,391 @@
+/* -*- c++ -*- ----------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* ----------------------------------------------------------------------
+   Multi-tau (logarithmic blocking) correlator
+   see J. Ramirez et al., J. Chem. Phys. 133, 154103 (2010)
+
+   nlevel correlators with p points each, level k+1 is fed with the
+   average of m consecutive values of level k, lags j < dmin are skipped
+   on the levels k > 0 since they are already covered by level k-1
+
+   a sample is a batch of nchan channels A (and B for cross-correlations),
+   every lag accumulates corr[col[i]] += A_i(t) B_i(t-tau) with B = A for
+   autocorrelations, col = identity if no column map is given
+
+   push() only advances the schedule, so that callers which keep the
+   shift registers themselves (e.g. per atom) share the same indexing
+------------------------------------------------------------------------- */
+
+#ifndef LMP_MULTI_TAU_H
+#define LMP_MULTI_TAU_H
+
+#include "pointers.h"
+#include "memory.h"
+#include "string.h"
+
+namespace LAMMPS_NS {
+
+template <class T>
+class MultiTau : protected Pointers {
+ public:
+  enum{CROSS=1,VARIANCE=2};
+
+  MultiTau(class LAMMPS *, int, int, int, int, int, int = 0,
+           const int * = NULL, int = 0);
+  ~MultiTau();
+
+  void zero();
+  int push();
+  void add(const T *, const T * = NULL);
+
+  int size_restart();
+  int pack_restart(double *);
+  int unpack_restart(double *);
+  double memory_usage();
+
+  // schedule of the latest sample
+
+  int flushed() const { return nflush; }
+  int slot(int k) const { return cur[k]; }
+  int past(int k, int j) const { return (cur[k] - j + p) % p; }
+  int first_lag(int k) const { return (k == 0) ? 0 : dmin; }
+  int last_lag(int k) const { return nfill[k]; }
+
+  // results
+
+  int levels() const { return nlevel; }
+  int points() const { return p; }
+  int average() const { return m; }
+  int lag_min() const { return dmin; }
+  int max_level() const { return kmax; }
+  int columns() const { return ncol; }
+  bigint count(int k, int j) const { return ncount[k*p+j]; }
+  const T *correlation(int k, int j) const { return corr + (bigint) (k*p+j)*ncol; }
+  const T *variance(int k, int j) const { return dcorr + (bigint) (k*p+j)*ncol; }
+
+ private:
+  int nlevel,p,m,dmin;
+  int nchan,nstore,ncol;
+  int crossflag,varflag;
+  int *col;
+
+  int kmax;
+  int nflush;
+  int *cur,*next,*nfill,*nacc;
+  bigint *ncount;
+
+  T *shift;      // nlevel x p x nstore, B channels follow the A channels
+  T *acc;        // nlevel x nstore
+  T *corr;       // nlevel x p x ncol
+  T *dcorr;      // nlevel x p x ncol, sum of squared products
+
+  void correlate(int);
+};
+
+/* ---------------------------------------------------------------------- */
+
+template <class T>
+MultiTau<T>::MultiTau(LAMMPS *lmp, int nlevel_in, int p_in, int m_in,
+                      int dmin_in, int nchan_in, int ncol_in,
+                      const int *col_in, int flags) : Pointers(lmp)
+{
+  nlevel = nlevel_in;
+  p = p_in;
+  m = m_in;
+  dmin = dmin_in;
+  nchan = nchan_in;
+  crossflag = flags & CROSS;
+  varflag = flags & VARIANCE;
+  nstore = crossflag ? 2*nchan : nchan;
+  ncol = col_in ? ncol_in : nchan;
+
+  col = NULL;
+  if (col_in) {
+    memory->create(col,nchan,"multi_tau:col");
+    memcpy(col,col_in,nchan*sizeof(int));
+  }
+
+  memory->create(cur,nlevel,"multi_tau:cur");
+  memory->create(next,nlevel,"multi_tau:next");
+  memory->create(nfill,nlevel,"multi_tau:nfill");
+  memory->create(nacc,nlevel,"multi_tau:nacc");
+  memory->create(ncount,nlevel*p,"multi_tau:ncount");
+
+  shift = acc = corr = dcorr = NULL;
+  if (nstore > 0) {
+    memory->create(shift,(bigint) nlevel*p*nstore,"multi_tau:shift");
+    memory->create(acc,(bigint) nlevel*nstore,"multi_tau:acc");
+  }
+  if (ncol > 0) {
+    memory->create(corr,(bigint) nlevel*p*ncol,"multi_tau:corr");
+    if (varflag) memory->create(dcorr,(bigint) nlevel*p*ncol,"multi_tau:dcorr");
+  }
+
+  zero();
+}
+
+/* ---------------------------------------------------------------------- */
+
+template <class T>
+MultiTau<T>::~MultiTau()
+{
+  memory->destroy(col);
+  memory->destroy(cur);
+  memory->destroy(next);
+  memory->destroy(nfill);
+  memory->destroy(nacc);
+  memory->destroy(ncount);
+  memory->destroy(shift);
+  memory->destroy(acc);
+  memory->destroy(corr);
+  memory->destroy(dcorr);
+}
+
+/* ----------------------------------------------------------------------
+   forget all samples and results
+------------------------------------------------------------------------- */
+
+template <class T>
+void MultiTau<T>::zero()
+{
+  kmax = 0;
+  nflush = 0;
+  for (int k = 0; k < nlevel; k++) {
+    cur[k] = next[k] = nfill[k] = nacc[k] = 0;
+    for (int j = 0; j < p; j++) ncount[k*p+j] = 0;
+  }
+  bigint n = (bigint) nlevel*p*nstore;
+  for (bigint i = 0; i < n; i++) shift[i] = 0.0;
+  n = (bigint) nlevel*nstore;
+  for (bigint i = 0; i < n; i++) acc[i] = 0.0;
+  n = (bigint) nlevel*p*ncol;
+  for (bigint i = 0; i < n; i++) corr[i] = 0.0;
+  if (varflag)
+    for (bigint i = 0; i < n; i++) dcorr[i] = 0.0;
+}
+
+/* ----------------------------------------------------------------------
+   advance the schedule by one sample on level 0
+   levels 0..nflush-1 complete their average of m values with it,
+   returns the number of levels which receive a new value
+------------------------------------------------------------------------- */
+
+template <class T>
+int MultiTau<T>::push()
+{
+  int k;
+
+  nflush = 0;
+  for (k = 0; k < nlevel; k++) {
+    if (++nacc[k] < m) break;
+    nacc[k] = 0;
+    nflush++;
+  }
+  int ntouch = (nflush < nlevel) ? nflush+1 : nlevel;
+  if (ntouch-1 > kmax) kmax = ntouch-1;
+
+  for (k = 0; k < ntouch; k++) {
+    cur[k] = next[k];
+    if (++next[k] == p) next[k] = 0;
+    if (nfill[k] < p) nfill[k]++;
+    for (int j = first_lag(k); j < nfill[k]; j++) ncount[k*p+j]++;
+  }
+  return ntouch;
+}
+
+/* ----------------------------------------------------------------------
+   insert a batch of nchan values a (and b for cross-correlations)
+   and accumulate the correlations of all levels which got a new value
+------------------------------------------------------------------------- */
+
+template <class T>
+void MultiTau<T>::add(const T *a, const T *b)
+{
+  int ntouch = push();
+  const T invm = 1.0/m;
+
+  for (int k = 0; k < ntouch; k++) {
+    T *s = shift + (bigint) (k*p+cur[k])*nstore;
+    T *ak = acc + (bigint) k*nstore;
+    if (k == 0) {
+      memcpy(s,a,nchan*sizeof(T));
+      if (crossflag) memcpy(s+nchan,b,nchan*sizeof(T));
+    } else {
+      T *aprev = acc + (bigint) (k-1)*nstore;
+      #if defined(_OPENMP)
+      #pragma omp simd
+      #endif
+      for (int i = 0; i < nstore; i++) {
+        s[i] = aprev[i];
+        aprev[i] = 0.0;
+      }
+    }
+
+    #if defined(_OPENMP)
+    #pragma omp simd
+    #endif
+    for (int i = 0; i < nstore; i++) ak[i] += s[i];
+    if (k < nflush) {
+      #if defined(_OPENMP)
+      #pragma omp simd
+      #endif
+      for (int i = 0; i < nstore; i++) ak[i] *= invm;
+    }
+
+    correlate(k);
+  }
+
+  // average of the last level has nowhere to go
+
+  if (nflush == nlevel) {
+    T *ak = acc + (bigint) (nlevel-1)*nstore;
+    for (int i = 0; i < nstore; i++) ak[i] = 0.0;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   products of the newest value of level k with all valid lags
+   lags write separate rows, so they are split over threads for
+   large batches
+------------------------------------------------------------------------- */
+
+template <class T>
+void MultiTau<T>::correlate(int k)
+{
+  const int jlo = first_lag(k);
+  const int jhi = nfill[k];
+  const T *s1 = shift + (bigint) (k*p+cur[k])*nstore;
+  const int boff = crossflag ? nchan : 0;
+
+  #if defined(_OPENMP)
+  #pragma omp parallel for if ((jhi-jlo)*nchan > 4096) schedule(static)
+  #endif
+  for (int j = jlo; j < jhi; j++) {
+    const T *s0 = shift + (bigint) (k*p+past(k,j))*nstore + boff;
+    T *c = corr + (bigint) (k*p+j)*ncol;
+    if (col) {
+      for (int i = 0; i < nchan; i++) c[col[i]] += s1[i]*s0[i];
+      if (varflag) {
+        T *dc = dcorr + (bigint) (k*p+j)*ncol;
+        for (int i = 0; i < nchan; i++) dc[col[i]] += s1[i]*s0[i]*s1[i]*s0[i];
+      }
+    } else if (varflag) {
+      T *dc = dcorr + (bigint) (k*p+j)*ncol;
+      #if defined(_OPENMP)
+      #pragma omp simd
+      #endif
+      for (int i = 0; i < nchan; i++) {
+        T prod = s1[i]*s0[i];
+        c[i] += prod;
+        dc[i] += prod*prod;
+      }
+    } else {
+      #if defined(_OPENMP)
+      #pragma omp simd
+      #endif
+      for (int i = 0; i < nchan; i++) c[i] += s1[i]*s0[i];
+    }
+  }
+}
+
+/* ----------------------------------------------------------------------
+   restart data: dimensions, schedule, registers and running sums
+------------------------------------------------------------------------- */
+
+template <class T>
+int MultiTau<T>::size_restart()
+{
+  return 7 + nlevel*(4+p) + nlevel*(p+1)*nstore +
+    (varflag ? 2 : 1)*nlevel*p*ncol;
+}
+
+/* ---------------------------------------------------------------------- */
+
+template <class T>
+int MultiTau<T>::pack_restart(double *buf)
+{
+  int n = 0;
+  buf[n++] = nlevel;
+  buf[n++] = p;
+  buf[n++] = m;
+  buf[n++] = nstore;
+  buf[n++] = ncol;
+  buf[n++] = varflag;
+  buf[n++] = kmax;
+  for (int k = 0; k < nlevel; k++) {
+    buf[n++] = cur[k];
+    buf[n++] = next[k];
+    buf[n++] = nfill[k];
+    buf[n++] = nacc[k];
+    for (int j = 0; j < p; j++) buf[n++] = ncount[k*p+j];
+  }
+  bigint nn = (bigint) nlevel*p*nstore;
+  for (bigint i = 0; i < nn; i++) buf[n++] = shift[i];
+  nn = (bigint) nlevel*nstore;
+  for (bigint i = 0; i < nn; i++) buf[n++] = acc[i];
+  nn = (bigint) nlevel*p*ncol;
+  for (bigint i = 0; i < nn; i++) buf[n++] = corr[i];
+  if (varflag)
+    for (bigint i = 0; i < nn; i++) buf[n++] = dcorr[i];
+  return n;
+}
+
+/* ----------------------------------------------------------------------
+   returns the number of values read, -1 if the dimensions differ
+------------------------------------------------------------------------- */
+
+template <class T>
+int MultiTau<T>::unpack_restart(double *buf)
+{
+  int n = 0;
+  if (static_cast<int> (buf[0]) != nlevel || static_cast<int> (buf[1]) != p ||
+      static_cast<int> (buf[2]) != m || static_cast<int> (buf[3]) != nstore ||
+      static_cast<int> (buf[4]) != ncol || static_cast<int> (buf[5]) != varflag)
+    return -1;
+  n = 6;
+  kmax = static_cast<int> (buf[n++]);
+  for (int k = 0; k < nlevel; k++) {
+    cur[k] = static_cast<int> (buf[n++]);
+    next[k] = static_cast<int> (buf[n++]);
+    nfill[k] = static_cast<int> (buf[n++]);
+    nacc[k] = static_cast<int> (buf[n++]);
+    for (int j = 0; j < p; j++) ncount[k*p+j] = static_cast<bigint> (buf[n++]);
+  }
+  bigint nn = (bigint) nlevel*p*nstore;
+  for (bigint i = 0; i < nn; i++) shift[i] = buf[n++];
+  nn = (bigint) nlevel*nstore;
+  for (bigint i = 0; i < nn; i++) acc[i] = buf[n++];
+  nn = (bigint) nlevel*p*ncol;
+  for (bigint i = 0; i < nn; i++) corr[i] = buf[n++];
+  if (varflag)
+    for (bigint i = 0; i < nn; i++) dcorr[i] = buf[n++];
+  nflush = 0;
+  return n;
+}
+
+/* ---------------------------------------------------------------------- */
+
+template <class T>
+double MultiTau<T>::memory_usage()
+{
+  double bytes = (double) nlevel*(p+1)*nstore * sizeof(T);
+  bytes += (double) (varflag ? 2 : 1)*nlevel*p*ncol * sizeof(T);
+  bytes += (double) nlevel*p * sizeof(bigint);
+  bytes += (double) (4*nlevel + (col ? nchan : 0)) * sizeof(int);
+  return bytes;
+}
+
+}
+
+#endif
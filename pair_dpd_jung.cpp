@@ -0,0 +1,768 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* ----------------------------------------------------------------------
+   Contributing authors: Kurt Smith (U Pittsburgh), Gerhard Jung (Uni Mainz)
+------------------------------------------------------------------------- */
+
+/* DPD with an implicit dissipative force. The conservative and random
+ * pair forces are the usual DPD ones, the random forces are correlated
+ * through the pairwise structure of the noise. The dissipative force
+ * uses the half-step velocity v* from
+ *   (M + dt/2 Gamma) v* = M v + dt/2 (Fc + Fr),   Fd = -Gamma v*
+ * which is solved matrix-free with the Lanczos method, the sparse
+ * matrix-vector product runs over the neighbor list and the small
+ * tridiagonal problem is diagonalized with tqli, as in fix gle/pair. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pair_dpd_jung.h"
+#include "atom.h"
+#include "comm.h"
+#include "update.h"
+#include "force.h"
+#include "neighbor.h"
+#include "neigh_list.h"
+#include "random_mars.h"
+#include "memory.h"
+#include "error.h"
+#include "eigenvalues_tridiagonal.h"
+
+using namespace LAMMPS_NS;
+
+#define EPSILON 1.0e-10
+
+enum{EX,EY,EZ,RIJ,FCR,GIJ,FDPD,NPAIRDATA};
+
+/* ---------------------------------------------------------------------- */
+
+PairDPDJung::PairDPDJung(LAMMPS *lmp) : Pair(lmp)
+{
+  writedata = 1;
+  random = NULL;
+  comm_forward = 3;
+  comm_reverse = 3;
+
+  npair = maxpair = 0;
+  pairij = NULL;
+  pairdata = NULL;
+
+  nmax = 0;
+  fcr = rhs = vstar = work = NULL;
+  krylov = NULL;
+  comm_vec = NULL;
+
+  mLanczos = 50;
+  tolLanczos = 1.0e-7;
+  alpha = beta = dtri = etri = ytri = NULL;
+  ztri = NULL;
+  warn_flag = 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+PairDPDJung::~PairDPDJung()
+{
+  if (allocated) {
+    memory->destroy(setflag);
+    memory->destroy(cutsq);
+
+    memory->destroy(cut);
+    memory->destroy(a0);
+    memory->destroy(gamma);
+    memory->destroy(sigma);
+  }
+
+  if (random) delete random;
+
+  memory->destroy(pairij);
+  memory->destroy(pairdata);
+  memory->destroy(fcr);
+  memory->destroy(rhs);
+  memory->destroy(vstar);
+  memory->destroy(work);
+  memory->destroy(krylov);
+  memory->destroy(alpha);
+  memory->destroy(beta);
+  memory->destroy(dtri);
+  memory->destroy(etri);
+  memory->destroy(ytri);
+  memory->destroy(ztri);
+}
+
+/* ---------------------------------------------------------------------- */
+
+void PairDPDJung::compute(int eflag, int vflag)
+{
+  int i,j,ii,jj,inum,jnum,itype,jtype,p;
+  double xtmp,ytmp,ztmp,delx,dely,delz,evdwl,fpair;
+  double rsq,r,rinv,wd,randnum,factor_dpd,dot;
+  int *ilist,*jlist,*numneigh,**firstneigh;
+
+  evdwl = 0.0;
+  if (eflag || vflag) ev_setup(eflag,vflag);
+  else evflag = vflag_fdotr = 0;
+
+  double **x = atom->x;
+  double **v = atom->v;
+  double **f = atom->f;
+  int *type = atom->type;
+  double *mass = atom->mass;
+  double *rmass = atom->rmass;
+  int nlocal = atom->nlocal;
+  int nall = nlocal + atom->nghost;
+  double *special_lj = force->special_lj;
+  int newton_pair = force->newton_pair;
+  double dtinvsqrt = 1.0/sqrt(update->dt);
+  double dthalf = 0.5*update->dt*force->ftm2v;
+
+  if (atom->nmax > nmax) grow_vectors();
+
+  inum = list->inum;
+  ilist = list->ilist;
+  numneigh = list->numneigh;
+  firstneigh = list->firstneigh;
+
+  // conservative and random pair forces, store the pairs for the solver
+
+  memset(fcr,0,3*nall*sizeof(double));
+  npair = 0;
+
+  for (ii = 0; ii < inum; ii++) {
+    i = ilist[ii];
+    xtmp = x[i][0];
+    ytmp = x[i][1];
+    ztmp = x[i][2];
+    itype = type[i];
+    jlist = firstneigh[i];
+    jnum = numneigh[i];
+
+    if (npair + jnum > maxpair) {
+      maxpair = npair + jnum + 1024;
+      memory->grow(pairij,maxpair,2,"pair:pairij");
+      memory->grow(pairdata,maxpair,NPAIRDATA,"pair:pairdata");
+    }
+
+    for (jj = 0; jj < jnum; jj++) {
+      j = jlist[jj];
+      factor_dpd = special_lj[sbmask(j)];
+      j &= NEIGHMASK;
+
+      delx = xtmp - x[j][0];
+      dely = ytmp - x[j][1];
+      delz = ztmp - x[j][2];
+      rsq = delx*delx + dely*dely + delz*delz;
+      jtype = type[j];
+
+      if (rsq < cutsq[itype][jtype]) {
+        r = sqrt(rsq);
+        if (r < EPSILON) continue;     // r can be 0.0 in DPD systems
+        rinv = 1.0/r;
+        wd = 1.0 - r/cut[itype][jtype];
+        randnum = random->gaussian();
+
+        // conservative force = a0 * wd
+        // random force = sigma * wd * rnd * dtinvsqrt
+        // drag force = -gamma * wd^2 * (e dot v*), applied after the solve
+
+        double *pd = pairdata[npair];
+        pairij[npair][0] = i;
+        pairij[npair][1] = j;
+        pd[EX] = delx*rinv;
+        pd[EY] = dely*rinv;
+        pd[EZ] = delz*rinv;
+        pd[RIJ] = r;
+        pd[FCR] = factor_dpd*wd*(a0[itype][jtype] +
+                                 sigma[itype][jtype]*randnum*dtinvsqrt);
+        pd[GIJ] = factor_dpd*gamma[itype][jtype]*wd*wd;
+        pd[FDPD] = factor_dpd;
+        npair++;
+
+        fcr[3*i] += pd[FCR]*pd[EX];
+        fcr[3*i+1] += pd[FCR]*pd[EY];
+        fcr[3*i+2] += pd[FCR]*pd[EZ];
+        if (newton_pair || j < nlocal) {
+          fcr[3*j] -= pd[FCR]*pd[EX];
+          fcr[3*j+1] -= pd[FCR]*pd[EY];
+          fcr[3*j+2] -= pd[FCR]*pd[EZ];
+        }
+      }
+    }
+  }
+
+  if (newton_pair) {
+    comm_vec = fcr;
+    comm->reverse_comm_pair(this);
+  }
+
+  // right-hand side and implicit solve for the half-step velocity
+
+  for (i = 0; i < nlocal; i++) {
+    double mi = rmass ? rmass[i] : mass[type[i]];
+    rhs[3*i] = mi*v[i][0] + dthalf*fcr[3*i];
+    rhs[3*i+1] = mi*v[i][1] + dthalf*fcr[3*i+1];
+    rhs[3*i+2] = mi*v[i][2] + dthalf*fcr[3*i+2];
+  }
+
+  compute_inverse(rhs,vstar);
+
+  comm_vec = vstar;
+  comm->forward_comm_pair(this);
+
+  // total pair forces
+
+  for (p = 0; p < npair; p++) {
+    i = pairij[p][0];
+    j = pairij[p][1];
+    double *pd = pairdata[p];
+
+    dot = pd[EX]*(vstar[3*i]-vstar[3*j]) + pd[EY]*(vstar[3*i+1]-vstar[3*j+1]) +
+      pd[EZ]*(vstar[3*i+2]-vstar[3*j+2]);
+    r = pd[RIJ];
+    fpair = (pd[FCR] - pd[GIJ]*dot)/r;
+    delx = pd[EX]*r;
+    dely = pd[EY]*r;
+    delz = pd[EZ]*r;
+
+    f[i][0] += delx*fpair;
+    f[i][1] += dely*fpair;
+    f[i][2] += delz*fpair;
+    if (newton_pair || j < nlocal) {
+      f[j][0] -= delx*fpair;
+      f[j][1] -= dely*fpair;
+      f[j][2] -= delz*fpair;
+    }
+
+    if (eflag) {
+      // eng shifted to 0.0 at cutoff
+      itype = type[i];
+      jtype = type[j];
+      wd = 1.0 - r/cut[itype][jtype];
+      evdwl = 0.5*a0[itype][jtype]*cut[itype][jtype] * wd*wd;
+      evdwl *= pd[FDPD];
+    }
+
+    if (evflag) ev_tally(i,j,nlocal,newton_pair,
+                         evdwl,0.0,fpair,delx,dely,delz);
+  }
+
+  if (vflag_fdotr) virial_fdotr_compute();
+}
+
+/* ----------------------------------------------------------------------
+   multiplies an input vector with M + dt/2 Gamma (using the pair list)
+   input ghosts are filled by forward comm, output ghosts reverse summed
+------------------------------------------------------------------------- */
+
+void PairDPDJung::compute_step(double *input, double *output)
+{
+  int i,j,p;
+  int *type = atom->type;
+  double *mass = atom->mass;
+  double *rmass = atom->rmass;
+  int nlocal = atom->nlocal;
+  int nall = nlocal + atom->nghost;
+  int newton_pair = force->newton_pair;
+  double dthalf = 0.5*update->dt*force->ftm2v;
+
+  comm_vec = input;
+  comm->forward_comm_pair(this);
+
+  for (i = 0; i < nlocal; i++) {
+    double mi = rmass ? rmass[i] : mass[type[i]];
+    output[3*i] = mi*input[3*i];
+    output[3*i+1] = mi*input[3*i+1];
+    output[3*i+2] = mi*input[3*i+2];
+  }
+  if (newton_pair) memset(&output[3*nlocal],0,3*(nall-nlocal)*sizeof(double));
+
+  for (p = 0; p < npair; p++) {
+    i = pairij[p][0];
+    j = pairij[p][1];
+    const double *pd = pairdata[p];
+    double dot = pd[EX]*(input[3*i]-input[3*j]) +
+      pd[EY]*(input[3*i+1]-input[3*j+1]) + pd[EZ]*(input[3*i+2]-input[3*j+2]);
+    dot *= dthalf*pd[GIJ];
+
+    output[3*i] += dot*pd[EX];
+    output[3*i+1] += dot*pd[EY];
+    output[3*i+2] += dot*pd[EZ];
+    if (newton_pair || j < nlocal) {
+      output[3*j] -= dot*pd[EX];
+      output[3*j+1] -= dot*pd[EY];
+      output[3*j+2] -= dot*pd[EZ];
+    }
+  }
+
+  if (newton_pair) {
+    comm_vec = output;
+    comm->reverse_comm_pair(this);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   solves (M + dt/2 Gamma) output = input with the Lanczos method
+   x_k = |b| V_k T_k^-1 e1, T_k^-1 from the eigenvectors of the
+   tridiagonal matrix, converged once the residual |b| beta_k |y_k|
+   drops below tolLanczos |b|, returns the number of iterations
+------------------------------------------------------------------------- */
+
+int PairDPDJung::compute_inverse(double *input, double *output)
+{
+  int i,k,l,a;
+  int n3 = 3*atom->nlocal;
+
+  memset(output,0,n3*sizeof(double));
+  double norm = sqrt(dot(input,input));
+  if (norm == 0.0) return 0;
+
+  double normi = 1.0/norm;
+  for (i = 0; i < n3; i++) krylov[0][i] = input[i]*normi;
+
+  for (k = 1; k <= mLanczos; k++) {
+    double *vk = krylov[k-1];
+    compute_step(vk,work);
+    if (k > 1) {
+      double *vkm = krylov[k-2];
+      for (i = 0; i < n3; i++) work[i] -= beta[k-1]*vkm[i];
+    }
+    alpha[k] = dot(vk,work);
+    for (i = 0; i < n3; i++) work[i] -= alpha[k]*vk[i];
+    beta[k] = sqrt(dot(work,work));
+
+    // y = T_k^-1 e1 via eigenvalue decomposition of the tridiagonal matrix
+
+    for (l = 1; l <= k; l++) {
+      dtri[l] = alpha[l];
+      etri[l] = beta[l];
+      for (a = 1; a <= k; a++) ztri[l][a] = (l == a) ? 1.0 : 0.0;
+    }
+    tqli(dtri,etri,k,ztri);
+    for (a = 1; a <= k; a++) {
+      ytri[a] = 0.0;
+      for (l = 1; l <= k; l++) ytri[a] += ztri[a][l]*ztri[1][l]/dtri[l];
+    }
+
+    int done = (beta[k]*fabs(ytri[k]) < tolLanczos) || beta[k] == 0.0;
+    if (done || k == mLanczos) {
+      for (a = 1; a <= k; a++) {
+        double *va = krylov[a-1];
+        double ya = norm*ytri[a];
+        for (i = 0; i < n3; i++) output[i] += ya*va[i];
+      }
+      if (!done && !warn_flag) {
+        if (comm->me == 0)
+          error->warning(FLERR,"Pair dpd/jung Lanczos solver did not converge");
+        warn_flag = 1;
+      }
+      return k;
+    }
+
+    double betai = 1.0/beta[k];
+    double *vkp = krylov[k];
+    for (i = 0; i < n3; i++) vkp[i] = work[i]*betai;
+  }
+
+  return mLanczos;
+}
+
+/* ----------------------------------------------------------------------
+   global dot product of two per-atom vectors
+------------------------------------------------------------------------- */
+
+double PairDPDJung::dot(double *a, double *b)
+{
+  int n3 = 3*atom->nlocal;
+  double one = 0.0;
+  for (int i = 0; i < n3; i++) one += a[i]*b[i];
+
+  double all;
+  MPI_Allreduce(&one,&all,1,MPI_DOUBLE,MPI_SUM,world);
+  return all;
+}
+
+/* ----------------------------------------------------------------------
+   (re)allocate per-atom vectors and the Krylov basis to atom->nmax
+------------------------------------------------------------------------- */
+
+void PairDPDJung::grow_vectors()
+{
+  nmax = atom->nmax;
+  memory->destroy(fcr);
+  memory->destroy(rhs);
+  memory->destroy(vstar);
+  memory->destroy(work);
+  memory->destroy(krylov);
+  memory->create(fcr,3*nmax,"pair:fcr");
+  memory->create(rhs,3*nmax,"pair:rhs");
+  memory->create(vstar,3*nmax,"pair:vstar");
+  memory->create(work,3*nmax,"pair:work");
+  memory->create(krylov,mLanczos+1,3*nmax,"pair:krylov");
+}
+
+/* ----------------------------------------------------------------------
+   allocate all arrays
+------------------------------------------------------------------------- */
+
+void PairDPDJung::allocate()
+{
+  int i,j;
+  allocated = 1;
+  int n = atom->ntypes;
+
+  memory->create(setflag,n+1,n+1,"pair:setflag");
+  for (i = 1; i <= n; i++)
+    for (j = i; j <= n; j++)
+      setflag[i][j] = 0;
+
+  memory->create(cutsq,n+1,n+1,"pair:cutsq");
+
+  memory->create(cut,n+1,n+1,"pair:cut");
+  memory->create(a0,n+1,n+1,"pair:a0");
+  memory->create(gamma,n+1,n+1,"pair:gamma");
+  memory->create(sigma,n+1,n+1,"pair:sigma");
+  for (i = 0; i <= atom->ntypes; i++)
+    for (j = 0; j <= atom->ntypes; j++)
+      sigma[i][j] = gamma[i][j] = 0.0;
+}
+
+/* ----------------------------------------------------------------------
+   global settings
+------------------------------------------------------------------------- */
+
+void PairDPDJung::settings(int narg, char **arg)
+{
+  if (narg != 3 && narg != 5) error->all(FLERR,"Illegal pair_style command");
+
+  temperature = force->numeric(FLERR,arg[0]);
+  cut_global = force->numeric(FLERR,arg[1]);
+  seed = force->inumeric(FLERR,arg[2]);
+
+  // optional maximum number of Lanczos iterations and tolerance
+
+  if (narg == 5) {
+    mLanczos = force->inumeric(FLERR,arg[3]);
+    tolLanczos = force->numeric(FLERR,arg[4]);
+    if (mLanczos <= 0 || tolLanczos <= 0.0)
+      error->all(FLERR,"Illegal pair_style command");
+  }
+
+  // initialize Marsaglia RNG with processor-unique seed
+
+  if (seed <= 0) error->all(FLERR,"Illegal pair_style command");
+  delete random;
+  random = new RanMars(lmp,seed + comm->me);
+
+  // reset cutoffs that have been explicitly set
+
+  if (allocated) {
+    int i,j;
+    for (i = 1; i <= atom->ntypes; i++)
+      for (j = i; j <= atom->ntypes; j++)
+        if (setflag[i][j]) cut[i][j] = cut_global;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   set coeffs for one or more type pairs
+------------------------------------------------------------------------- */
+
+void PairDPDJung::coeff(int narg, char **arg)
+{
+  if (narg < 4 || narg > 5)
+    error->all(FLERR,"Incorrect args for pair coefficients");
+  if (!allocated) allocate();
+
+  int ilo,ihi,jlo,jhi;
+  force->bounds(FLERR,arg[0],atom->ntypes,ilo,ihi);
+  force->bounds(FLERR,arg[1],atom->ntypes,jlo,jhi);
+
+  double a0_one = force->numeric(FLERR,arg[2]);
+  double gamma_one = force->numeric(FLERR,arg[3]);
+
+  double cut_one = cut_global;
+  if (narg == 5) cut_one = force->numeric(FLERR,arg[4]);
+
+  int count = 0;
+  for (int i = ilo; i <= ihi; i++) {
+    for (int j = MAX(jlo,i); j <= jhi; j++) {
+      a0[i][j] = a0_one;
+      gamma[i][j] = gamma_one;
+      cut[i][j] = cut_one;
+      setflag[i][j] = 1;
+      count++;
+    }
+  }
+
+  if (count == 0) error->all(FLERR,"Incorrect args for pair coefficients");
+}
+
+/* ----------------------------------------------------------------------
+   init specific to this pair style
+------------------------------------------------------------------------- */
+
+void PairDPDJung::init_style()
+{
+  // if newton off, forces between atoms ij will be double computed
+  // using different random numbers
+
+  if (force->newton_pair == 0 && comm->me == 0) error->warning(FLERR,
+      "Pair dpd needs newton pair on for momentum conservation");
+
+  neighbor->request(this,instance_me);
+
+  // Lanczos workspace, Krylov basis follows atom->nmax
+
+  memory->destroy(alpha);
+  memory->destroy(beta);
+  memory->destroy(dtri);
+  memory->destroy(etri);
+  memory->destroy(ytri);
+  memory->destroy(ztri);
+  memory->create(alpha,mLanczos+2,"pair:alpha");
+  memory->create(beta,mLanczos+2,"pair:beta");
+  memory->create(dtri,mLanczos+2,"pair:dtri");
+  memory->create(etri,mLanczos+2,"pair:etri");
+  memory->create(ytri,mLanczos+2,"pair:ytri");
+  memory->create(ztri,mLanczos+2,mLanczos+2,"pair:ztri");
+  nmax = 0;
+  warn_flag = 0;
+}
+
+/* ----------------------------------------------------------------------
+   init for one type pair i,j and corresponding j,i
+------------------------------------------------------------------------- */
+
+double PairDPDJung::init_one(int i, int j)
+{
+  if (setflag[i][j] == 0) error->all(FLERR,"All pair coeffs are not set");
+
+  sigma[i][j] = sqrt(2.0*force->boltz*temperature*gamma[i][j]);
+
+  cut[j][i] = cut[i][j];
+  a0[j][i] = a0[i][j];
+  gamma[j][i] = gamma[i][j];
+  sigma[j][i] = sigma[i][j];
+
+  return cut[i][j];
+}
+
+/* ----------------------------------------------------------------------
+   proc 0 writes to restart file
+------------------------------------------------------------------------- */
+
+void PairDPDJung::write_restart(FILE *fp)
+{
+  write_restart_settings(fp);
+
+  int i,j;
+  for (i = 1; i <= atom->ntypes; i++)
+    for (j = i; j <= atom->ntypes; j++) {
+      fwrite(&setflag[i][j],sizeof(int),1,fp);
+      if (setflag[i][j]) {
+        fwrite(&a0[i][j],sizeof(double),1,fp);
+        fwrite(&gamma[i][j],sizeof(double),1,fp);
+        fwrite(&cut[i][j],sizeof(double),1,fp);
+      }
+    }
+}
+
+/* ----------------------------------------------------------------------
+   proc 0 reads from restart file, bcasts
+------------------------------------------------------------------------- */
+
+void PairDPDJung::read_restart(FILE *fp)
+{
+  read_restart_settings(fp);
+
+  allocate();
+
+  int i,j;
+  int me = comm->me;
+  for (i = 1; i <= atom->ntypes; i++)
+    for (j = i; j <= atom->ntypes; j++) {
+      if (me == 0) fread(&setflag[i][j],sizeof(int),1,fp);
+      MPI_Bcast(&setflag[i][j],1,MPI_INT,0,world);
+      if (setflag[i][j]) {
+        if (me == 0) {
+          fread(&a0[i][j],sizeof(double),1,fp);
+          fread(&gamma[i][j],sizeof(double),1,fp);
+          fread(&cut[i][j],sizeof(double),1,fp);
+        }
+        MPI_Bcast(&a0[i][j],1,MPI_DOUBLE,0,world);
+        MPI_Bcast(&gamma[i][j],1,MPI_DOUBLE,0,world);
+        MPI_Bcast(&cut[i][j],1,MPI_DOUBLE,0,world);
+      }
+    }
+}
+
+/* ----------------------------------------------------------------------
+   proc 0 writes to restart file
+------------------------------------------------------------------------- */
+
+void PairDPDJung::write_restart_settings(FILE *fp)
+{
+  fwrite(&temperature,sizeof(double),1,fp);
+  fwrite(&cut_global,sizeof(double),1,fp);
+  fwrite(&seed,sizeof(int),1,fp);
+  fwrite(&mix_flag,sizeof(int),1,fp);
+  fwrite(&mLanczos,sizeof(int),1,fp);
+  fwrite(&tolLanczos,sizeof(double),1,fp);
+}
+
+/* ----------------------------------------------------------------------
+   proc 0 reads from restart file, bcasts
+------------------------------------------------------------------------- */
+
+void PairDPDJung::read_restart_settings(FILE *fp)
+{
+  if (comm->me == 0) {
+    fread(&temperature,sizeof(double),1,fp);
+    fread(&cut_global,sizeof(double),1,fp);
+    fread(&seed,sizeof(int),1,fp);
+    fread(&mix_flag,sizeof(int),1,fp);
+    fread(&mLanczos,sizeof(int),1,fp);
+    fread(&tolLanczos,sizeof(double),1,fp);
+  }
+  MPI_Bcast(&temperature,1,MPI_DOUBLE,0,world);
+  MPI_Bcast(&cut_global,1,MPI_DOUBLE,0,world);
+  MPI_Bcast(&seed,1,MPI_INT,0,world);
+  MPI_Bcast(&mix_flag,1,MPI_INT,0,world);
+  MPI_Bcast(&mLanczos,1,MPI_INT,0,world);
+  MPI_Bcast(&tolLanczos,1,MPI_DOUBLE,0,world);
+
+  // initialize Marsaglia RNG with processor-unique seed
+  // same seed that pair_style command initially specified
+
+  if (random) delete random;
+  random = new RanMars(lmp,seed + comm->me);
+}
+
+/* ----------------------------------------------------------------------
+   proc 0 writes to data file
+------------------------------------------------------------------------- */
+
+void PairDPDJung::write_data(FILE *fp)
+{
+  for (int i = 1; i <= atom->ntypes; i++)
+    fprintf(fp,"%d %g %g\n",i,a0[i][i],gamma[i][i]);
+}
+
+/* ----------------------------------------------------------------------
+   proc 0 writes all pairs to data file
+------------------------------------------------------------------------- */
+
+void PairDPDJung::write_data_all(FILE *fp)
+{
+  for (int i = 1; i <= atom->ntypes; i++)
+    for (int j = i; j <= atom->ntypes; j++)
+      fprintf(fp,"%d %d %g %g %g\n",i,j,a0[i][j],gamma[i][j],cut[i][j]);
+}
+
+/* ---------------------------------------------------------------------- */
+
+double PairDPDJung::single(int i, int j, int itype, int jtype, double rsq,
+                       double factor_coul, double factor_dpd, double &fforce)
+{
+  double r,rinv,wd,phi;
+
+  r = sqrt(rsq);
+  if (r < EPSILON) {
+    fforce = 0.0;
+    return 0.0;
+  }
+
+  rinv = 1.0/r;
+  wd = 1.0 - r/cut[itype][jtype];
+  fforce = a0[itype][jtype]*wd * factor_dpd*rinv;
+
+  phi = 0.5*a0[itype][jtype]*cut[itype][jtype] * wd*wd;
+  return factor_dpd*phi;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int PairDPDJung::pack_forward_comm(int n, int *list, double *buf,
+                                   int pbc_flag, int *pbc)
+{
+  int i,j,m;
+
+  m = 0;
+  for (i = 0; i < n; i++) {
+    j = list[i];
+    buf[m++] = comm_vec[3*j];
+    buf[m++] = comm_vec[3*j+1];
+    buf[m++] = comm_vec[3*j+2];
+  }
+  return m;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void PairDPDJung::unpack_forward_comm(int n, int first, double *buf)
+{
+  int i,m,last;
+
+  m = 0;
+  last = first + n;
+  for (i = first; i < last; i++) {
+    comm_vec[3*i] = buf[m++];
+    comm_vec[3*i+1] = buf[m++];
+    comm_vec[3*i+2] = buf[m++];
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+int PairDPDJung::pack_reverse_comm(int n, int first, double *buf)
+{
+  int i,m,last;
+
+  m = 0;
+  last = first + n;
+  for (i = first; i < last; i++) {
+    buf[m++] = comm_vec[3*i];
+    buf[m++] = comm_vec[3*i+1];
+    buf[m++] = comm_vec[3*i+2];
+  }
+  return m;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void PairDPDJung::unpack_reverse_comm(int n, int *list, double *buf)
+{
+  int i,j,m;
+
+  m = 0;
+  for (i = 0; i < n; i++) {
+    j = list[i];
+    comm_vec[3*j] += buf[m++];
+    comm_vec[3*j+1] += buf[m++];
+    comm_vec[3*j+2] += buf[m++];
+  }
+}
+
+/* ----------------------------------------------------------------------
+   memory usage of pair list, per-atom vectors and Krylov basis
+------------------------------------------------------------------------- */
+
+double PairDPDJung::memory_usage()
+{
+  double bytes = Pair::memory_usage();
+  bytes += (double)maxpair * (2*sizeof(int) + NPAIRDATA*sizeof(double));
+  bytes += (double)(4 + mLanczos+1) * 3*nmax * sizeof(double);
+  return bytes;
+}
@@ -0,0 +1,119 @@
+/* -*- c++ -*- ----------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+#ifdef PAIR_CLASS
+
+PairStyle(dpd/jung,PairDPDJung)
+
+#else
+
+#ifndef LMP_PAIR_DPD_JUNG_H
+#define LMP_PAIR_DPD_JUNG_H
+
+#include "pair.h"
+
+namespace LAMMPS_NS {
+
+class PairDPDJung : public Pair {
+ public:
+  PairDPDJung(class LAMMPS *);
+  virtual ~PairDPDJung();
+  virtual void compute(int, int);
+  virtual void settings(int, char **);
+  virtual void coeff(int, char **);
+  void init_style();
+  double init_one(int, int);
+  virtual void write_restart(FILE *);
+  virtual void read_restart(FILE *);
+  virtual void write_restart_settings(FILE *);
+  virtual void read_restart_settings(FILE *);
+  virtual void write_data(FILE *);
+  virtual void write_data_all(FILE *);
+  double single(int, int, int, int, double, double, double, double &);
+
+  int pack_forward_comm(int, int *, double *, int, int *);
+  void unpack_forward_comm(int, int, double *);
+  int pack_reverse_comm(int, int, double *);
+  void unpack_reverse_comm(int, int *, double *);
+  double memory_usage();
+
+ protected:
+  double cut_global,temperature;
+  int seed;
+  double **cut;
+  double **a0,**gamma;
+  double **sigma;
+  class RanMars *random;
+
+  // pairs within the cutoff, with unit vector, distance,
+  // conservative + random force, dissipative prefactor and special factor
+  int npair,maxpair;
+  int **pairij;
+  double **pairdata;
+
+  // per-atom vectors of length 3*nmax, ghosts used for communication
+  int nmax;
+  double *fcr;              // conservative + random force
+  double *rhs;              // M v + dt/2 fcr
+  double *vstar;            // implicit half-step velocity
+  double *work;
+  double **krylov;          // Lanczos basis
+  double *comm_vec;         // vector currently communicated
+
+  // Lanczos solver
+  int mLanczos;
+  double tolLanczos;
+  double *alpha,*beta,*dtri,*etri,*ytri;
+  double **ztri;
+  int warn_flag;
+
+  void allocate();
+  void grow_vectors();
+  void compute_step(double *, double *);
+  int compute_inverse(double *, double *);
+  double dot(double *, double *);
+};
+
+}
+
+#endif
+#endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal ... command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.  You can use -echo screen as a
+command-line option when running LAMMPS to see the offending line.
+
+E: Incorrect args for pair coefficients
+
+Self-explanatory.  Check the input script or data file.
+
+W: Pair dpd needs newton pair on for momentum conservation
+
+Self-explanatory.
+
+E: All pair coeffs are not set
+
+All pair coefficients must be set in the data file or by the
+pair_coeff command before running a simulation.
+
+W: Pair dpd/jung Lanczos solver did not converge
+
+The implicit dissipative step was not solved to the requested tolerance
+within the maximum number of Lanczos iterations.  Increase the number
+of iterations or the tolerance in the pair_style command.
+
+*/
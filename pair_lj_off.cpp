@@ -35,11 +35,16 @@
 using namespace LAMMPS_NS;
 using namespace MathConst;
 
+#define TABLE_NMIN 64
+#define TABLE_NMAX 1048576
+
 /* ---------------------------------------------------------------------- */
 
 PairLJOff::PairLJOff(LAMMPS *lmp) : Pair(lmp)
 {
   writedata = 1;
+  tabstyle = NOTABLE;
+  tabtol = 0.0;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -59,6 +64,17 @@ PairLJOff::~PairLJOff()
     memory->destroy(lj3);
     memory->destroy(lj4);
     memory->destroy(offset);
+
+    for (int i = 1; i <= atom->ntypes; i++)
+      for (int j = i; j <= atom->ntypes; j++) {
+        memory->destroy(ftab[i][j]);
+        memory->destroy(etab[i][j]);
+      }
+    memory->destroy(ftab);
+    memory->destroy(etab);
+    memory->destroy(ntab);
+    memory->destroy(tab_rsqin);
+    memory->destroy(tab_delinv);
   }
 }
 
@@ -70,6 +86,7 @@ void PairLJOff::compute(int eflag, int vflag)
   double xtmp,ytmp,ztmp,delx,dely,delz,evdwl,fpair;
   double rsq,r,rinv,rinv_norm,r2inv,r6inv,forcelj,factor_lj;
   int *ilist,*jlist,*numneigh,**firstneigh;
+  int overlap = 0;
 
   evdwl = 0.0;
   if (eflag || vflag) ev_setup(eflag,vflag);
@@ -110,20 +127,30 @@ void PairLJOff::compute(int eflag, int vflag)
       jtype = type[j];
 
       if (rsq < cutsq[itype][jtype]) {
+	// sqrt- and division-free lookup outside the steep core
+	if (rsq > tab_rsqin[itype][jtype]) {
+	  double t = (rsq - tab_rsqin[itype][jtype]) * tab_delinv[itype][jtype];
+	  int k = static_cast<int> (t);
+	  if (k >= ntab[itype][jtype]) k = ntab[itype][jtype]-1;
+	  t -= k;
+	  fpair = factor_lj*lookup(&ftab[itype][jtype][4*k],t);
+	  if (eflag) evdwl = factor_lj*lookup(&etab[itype][jtype][4*k],t);
+	} else {
 	r = sqrt(rsq);
-	
-
-	
 	rinv_norm = 1.0/r;
 	rinv = 1.0/(r-r_offset[itype][jtype]);
         r2inv = rinv*rinv;
         r6inv = r2inv*r2inv*r2inv;
         forcelj = r6inv * (lj1[itype][jtype]*r6inv - lj2[itype][jtype]);
         fpair = factor_lj*forcelj*rinv*rinv_norm;
-//	printf("dist = %f, eff.dist = %f, fpair = %f\n",r,r-r_offset[itype][jtype],fpair);
-	if (!eflag) if(r<r_offset[itype][jtype]){
-	  printf("distance = %f < offset = %f !\n",r,r_offset[itype][jtype]);
-	  error->all(FLERR,"Distance between particles too small");
+	// overlapping cores, reported once after the loop
+	if (r <= r_offset[itype][jtype]) overlap = 1;
+
+        if (eflag) {
+          evdwl = r6inv*(lj3[itype][jtype]*r6inv-lj4[itype][jtype]) -
+            offset[itype][jtype];
+          evdwl *= factor_lj;
+        }
 	}
 	
         f[i][0] += delx*fpair;
@@ -138,12 +165,6 @@ void PairLJOff::compute(int eflag, int vflag)
           f[j][2] -= delz*fpair;
         }
 
-        if (eflag) {
-          evdwl = r6inv*(lj3[itype][jtype]*r6inv-lj4[itype][jtype]) -
-            offset[itype][jtype];
-          evdwl *= factor_lj;
-        }
-
         if (evflag) ev_tally(i,j,nlocal,newton_pair,
                              evdwl,0.0,fpair,delx,dely,delz);
 	
@@ -152,6 +173,8 @@ void PairLJOff::compute(int eflag, int vflag)
     }
   }
 
+  if (overlap) error->one(FLERR,"Distance between particles too small");
+
   if (vflag_fdotr) virial_fdotr_compute();
 }
 
@@ -180,6 +203,17 @@ void PairLJOff::allocate()
   memory->create(lj3,n+1,n+1,"pair:lj3");
   memory->create(lj4,n+1,n+1,"pair:lj4");
   memory->create(offset,n+1,n+1,"pair:offset");
+
+  memory->create(ntab,n+1,n+1,"pair:ntab");
+  memory->create(tab_rsqin,n+1,n+1,"pair:tab_rsqin");
+  memory->create(tab_delinv,n+1,n+1,"pair:tab_delinv");
+  memory->create(ftab,n+1,n+1,"pair:ftab");
+  memory->create(etab,n+1,n+1,"pair:etab");
+  for (int i = 0; i <= n; i++)
+    for (int j = 0; j <= n; j++) {
+      ftab[i][j] = etab[i][j] = NULL;
+      ntab[i][j] = 0;
+    }
 }
 
 /* ----------------------------------------------------------------------
@@ -188,10 +222,23 @@ void PairLJOff::allocate()
 
 void PairLJOff::settings(int narg, char **arg)
 {
-  if (narg != 1) error->all(FLERR,"Illegal pair_style command");
+  if (narg != 1 && narg != 4) error->all(FLERR,"Illegal pair_style command");
 
   cut_global = force->numeric(FLERR,arg[0]);
 
+  // optional table linear|spline tolerance
+
+  tabstyle = NOTABLE;
+  if (narg == 4) {
+    if (strcmp(arg[1],"table") != 0) error->all(FLERR,"Illegal pair_style command");
+    if (strcmp(arg[2],"linear") == 0) tabstyle = LINEAR;
+    else if (strcmp(arg[2],"spline") == 0) tabstyle = SPLINE;
+    else error->all(FLERR,"Illegal pair_style command");
+    tabtol = force->numeric(FLERR,arg[3]);
+    if (tabtol <= 0.0)
+      error->all(FLERR,"Illegal pair_style lj/off table tolerance");
+  }
+
   // reset cutoffs that have been explicitly set
 
   if (allocated) {
@@ -270,9 +317,138 @@ double PairLJOff::init_one(int i, int j)
   r_offset[j][i] = r_offset[i][j];
   offset[j][i] = offset[i][j];
 
+  build_table(i,j);
+
   return cut[i][j];
 }
 
+/* ----------------------------------------------------------------------
+   exact fpair and energy of type pair i,j without special factor
+------------------------------------------------------------------------- */
+
+void PairLJOff::eval_exact(int i, int j, double rsq, double &fpair, double &evdwl)
+{
+  double r = sqrt(rsq);
+  double rinv = 1.0/(r-r_offset[i][j]);
+  double r2inv = rinv*rinv;
+  double r6inv = r2inv*r2inv*r2inv;
+  fpair = r6inv * (lj1[i][j]*r6inv - lj2[i][j]) * rinv/r;
+  evdwl = r6inv*(lj3[i][j]*r6inv-lj4[i][j]) - offset[i][j];
+}
+
+/* ----------------------------------------------------------------------
+   table of type pair i,j on a uniform rsq grid from an effective distance
+   of sigma/2 to the cutoff, closer pairs are computed exactly
+   the number of intervals is doubled until the error at the interval
+   midpoints relative to |value| + eps/sigma^2 (eps) is below tabtol
+------------------------------------------------------------------------- */
+
+
+void PairLJOff::build_table(int i, int j)
+{
+  memory->destroy(ftab[i][j]);
+  memory->destroy(etab[i][j]);
+  ftab[i][j] = etab[i][j] = NULL;
+  ftab[j][i] = etab[j][i] = NULL;
+
+  double cutsqone = cut[i][j]*cut[i][j];
+  double rin = r_offset[i][j] + 0.5*sigma[i][j];
+  if (tabstyle == NOTABLE || rin*rin >= cutsqone) {
+    tab_rsqin[i][j] = tab_rsqin[j][i] = cutsqone;
+    ntab[i][j] = ntab[j][i] = 0;
+    return;
+  }
+
+  double rsqin = rin*rin;
+  double fscale = epsilon[i][j]/(sigma[i][j]*sigma[i][j]);
+  double escale = epsilon[i][j];
+  double *yf = NULL, *ye = NULL, *y2f = NULL, *y2e = NULL, *u = NULL;
+  double *cf = NULL, *ce = NULL;
+  double err = 0.0;
+  int n,k;
+
+  for (n = TABLE_NMIN; n <= TABLE_NMAX; n *= 2) {
+    double h = (cutsqone - rsqin)/n;
+
+    memory->destroy(cf);
+    memory->destroy(ce);
+    memory->create(cf,4*n,"pair:ftab");
+    memory->create(ce,4*n,"pair:etab");
+    memory->grow(yf,n+1,"pair:yf");
+    memory->grow(ye,n+1,"pair:ye");
+    for (k = 0; k <= n; k++) eval_exact(i,j,rsqin+k*h,yf[k],ye[k]);
+
+    if (tabstyle == LINEAR) {
+      for (k = 0; k < n; k++) {
+        cf[4*k] = yf[k];
+        cf[4*k+1] = yf[k+1]-yf[k];
+        ce[4*k] = ye[k];
+        ce[4*k+1] = ye[k+1]-ye[k];
+        cf[4*k+2] = cf[4*k+3] = ce[4*k+2] = ce[4*k+3] = 0.0;
+      }
+    } else {
+      // natural cubic spline on the uniform grid, tridiagonal solve
+      memory->grow(y2f,n+1,"pair:y2f");
+      memory->grow(y2e,n+1,"pair:y2e");
+      memory->grow(u,2*(n+1),"pair:u");
+      double *uf = u, *ue = u+n+1;
+      y2f[0] = y2e[0] = uf[0] = ue[0] = 0.0;
+      for (k = 1; k < n; k++) {
+        double p = 0.5*y2f[k-1] + 2.0;
+        y2f[k] = -0.5/p;
+        uf[k] = (6.0*(yf[k+1]-2.0*yf[k]+yf[k-1])/(2.0*h*h) - 0.5*uf[k-1])/p;
+        p = 0.5*y2e[k-1] + 2.0;
+        y2e[k] = -0.5/p;
+        ue[k] = (6.0*(ye[k+1]-2.0*ye[k]+ye[k-1])/(2.0*h*h) - 0.5*ue[k-1])/p;
+      }
+      y2f[n] = y2e[n] = 0.0;
+      for (k = n-1; k >= 0; k--) {
+        y2f[k] = y2f[k]*y2f[k+1] + uf[k];
+        y2e[k] = y2e[k]*y2e[k+1] + ue[k];
+      }
+
+      // y(t) = y0 + t(y1-y0) + h^2/6 [y2_0 (3t^2-t^3-2t) + y2_1 (t^3-t)]
+      double h26 = h*h/6.0;
+      for (k = 0; k < n; k++) {
+        cf[4*k] = yf[k];
+        cf[4*k+1] = yf[k+1]-yf[k] - h26*(2.0*y2f[k]+y2f[k+1]);
+        cf[4*k+2] = 3.0*h26*y2f[k];
+        cf[4*k+3] = h26*(y2f[k+1]-y2f[k]);
+        ce[4*k] = ye[k];
+        ce[4*k+1] = ye[k+1]-ye[k] - h26*(2.0*y2e[k]+y2e[k+1]);
+        ce[4*k+2] = 3.0*h26*y2e[k];
+        ce[4*k+3] = h26*(y2e[k+1]-y2e[k]);
+      }
+    }
+
+    err = 0.0;
+    for (k = 0; k < n; k++) {
+      double fexact,eexact;
+      eval_exact(i,j,rsqin+(k+0.5)*h,fexact,eexact);
+      err = MAX(err,fabs(lookup(&cf[4*k],0.5)-fexact)/(fabs(fexact)+fscale));
+      err = MAX(err,fabs(lookup(&ce[4*k],0.5)-eexact)/(fabs(eexact)+escale));
+    }
+    if (err <= tabtol) break;
+  }
+  if (n > TABLE_NMAX) {
+    n = TABLE_NMAX;
+    if (comm->me == 0)
+      error->warning(FLERR,"Pair lj/off table did not reach the tolerance");
+  }
+
+  memory->destroy(yf);
+  memory->destroy(ye);
+  memory->destroy(y2f);
+  memory->destroy(y2e);
+  memory->destroy(u);
+
+  ftab[i][j] = ftab[j][i] = cf;
+  etab[i][j] = etab[j][i] = ce;
+  ntab[i][j] = ntab[j][i] = n;
+  tab_rsqin[i][j] = tab_rsqin[j][i] = rsqin;
+  tab_delinv[i][j] = tab_delinv[j][i] = n/(cutsqone - rsqin);
+}
+
 /* ----------------------------------------------------------------------
    proc 0 writes to restart file
 ------------------------------------------------------------------------- */
@@ -333,6 +509,8 @@ void PairLJOff::write_restart_settings(FILE *fp)
   fwrite(&cut_global,sizeof(double),1,fp);
   fwrite(&offset_flag,sizeof(int),1,fp);
   fwrite(&mix_flag,sizeof(int),1,fp);
+  fwrite(&tabstyle,sizeof(int),1,fp);
+  fwrite(&tabtol,sizeof(double),1,fp);
 }
 
 /* ----------------------------------------------------------------------
@@ -346,10 +524,14 @@ void PairLJOff::read_restart_settings(FILE *fp)
     fread(&cut_global,sizeof(double),1,fp);
     fread(&offset_flag,sizeof(int),1,fp);
     fread(&mix_flag,sizeof(int),1,fp);
+    fread(&tabstyle,sizeof(int),1,fp);
+    fread(&tabtol,sizeof(double),1,fp);
   }
   MPI_Bcast(&cut_global,1,MPI_DOUBLE,0,world);
   MPI_Bcast(&offset_flag,1,MPI_INT,0,world);
   MPI_Bcast(&mix_flag,1,MPI_INT,0,world);
+  MPI_Bcast(&tabstyle,1,MPI_INT,0,world);
+  MPI_Bcast(&tabtol,1,MPI_DOUBLE,0,world);
 }
 
 /* ----------------------------------------------------------------------
@@ -48,7 +48,22 @@ class PairLJOff : public Pair {
   double **epsilon,**sigma,**r_offset;
   double **lj1,**lj2,**lj3,**lj4,**offset;
 
+  // optional tables of fpair and energy on an rsq grid per type pair,
+  // 4 polynomial coefficients per interval, used beyond tab_rsqin
+  enum{NOTABLE,LINEAR,SPLINE};
+  int tabstyle;
+  double tabtol;
+  int **ntab;
+  double **tab_rsqin,**tab_delinv;
+  double ***ftab,***etab;
+
   virtual void allocate();
+  void build_table(int, int);
+  void eval_exact(int, int, double, double &, double &);
+
+  inline double lookup(const double *c, double t) const {
+    return c[0] + t*(c[1] + t*(c[2] + t*c[3]));
+  }
 };
 
 }
@@ -68,4 +83,18 @@ E: Incorrect args for pair coefficients
 
 Self-explanatory.  Check the input script or data file.
 
+E: Illegal pair_style lj/off table tolerance
+
+The tolerance must be positive.
+
+W: Pair lj/off table did not reach the tolerance
+
+The table of one type pair still exceeds the tolerance with the maximum
+number of points, it is used anyway.  Use a larger tolerance.
+
+E: Distance between particles too small
+
+Two particles are closer than the offset distance r_offset of their
+types, the shifted LJ interaction is undefined there.
+
 */
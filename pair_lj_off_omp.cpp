@@ -0,0 +1,197 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* ----------------------------------------------------------------------
+   OpenMP version of pair lj/off, following pair lj/cut/omp
+------------------------------------------------------------------------- */
+
+#include <math.h>
+#include "pair_lj_off_omp.h"
+#include "atom.h"
+#include "comm.h"
+#include "force.h"
+#include "neighbor.h"
+#include "neigh_list.h"
+#include "error.h"
+
+#include "suffix.h"
+using namespace LAMMPS_NS;
+
+/* ---------------------------------------------------------------------- */
+
+PairLJOffOMP::PairLJOffOMP(LAMMPS *lmp) :
+  PairLJOff(lmp), ThrOMP(lmp, THR_PAIR)
+{
+  suffix_flag |= Suffix::OMP;
+  respa_enable = 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void PairLJOffOMP::compute(int eflag, int vflag)
+{
+  if (eflag || vflag) {
+    ev_setup(eflag,vflag);
+  } else evflag = vflag_fdotr = 0;
+
+  const int nall = atom->nlocal + atom->nghost;
+  const int nthreads = comm->nthreads;
+  const int inum = list->inum;
+  int overlap = 0;
+
+#if defined(_OPENMP)
+#pragma omp parallel default(none) shared(eflag,vflag) reduction(+:overlap)
+#endif
+  {
+    int ifrom, ito, tid;
+
+    loop_setup_thr(ifrom, ito, tid, inum, nthreads);
+    ThrData *thr = fix->get_thr(tid);
+    thr->timer(Timer::START);
+    ev_setup_thr(eflag, vflag, nall, eatom, vatom, thr);
+
+    if (evflag) {
+      if (eflag) {
+        if (force->newton_pair) overlap += eval<1,1,1>(ifrom, ito, thr);
+        else overlap += eval<1,1,0>(ifrom, ito, thr);
+      } else {
+        if (force->newton_pair) overlap += eval<1,0,1>(ifrom, ito, thr);
+        else overlap += eval<1,0,0>(ifrom, ito, thr);
+      }
+    } else {
+      if (force->newton_pair) overlap += eval<0,0,1>(ifrom, ito, thr);
+      else overlap += eval<0,0,0>(ifrom, ito, thr);
+    }
+    thr->timer(Timer::PAIR);
+    reduce_thr(this, eflag, vflag, thr);
+  } // end of omp parallel region
+
+  // overlapping cores, reported once for all threads
+  if (overlap) error->one(FLERR,"Distance between particles too small");
+}
+
+/* ----------------------------------------------------------------------
+   forces of neighbors ifrom to ito into the thread-private force array,
+   returns the number of overlapping pairs
+------------------------------------------------------------------------- */
+
+template <int EVFLAG, int EFLAG, int NEWTON_PAIR>
+int PairLJOffOMP::eval(int iifrom, int iito, ThrData * const thr)
+{
+  int i,j,ii,jj,jnum,itype,jtype;
+  double xtmp,ytmp,ztmp,delx,dely,delz,evdwl,fpair;
+  double rsq,r,rinv,rinv_norm,r2inv,r6inv,forcelj,factor_lj;
+  int *ilist,*jlist,*numneigh,**firstneigh;
+  int overlap = 0;
+
+  evdwl = 0.0;
+
+  const dbl3_t * _noalias const x = (dbl3_t *) atom->x[0];
+  dbl3_t * _noalias const f = (dbl3_t *) thr->get_f()[0];
+  const int * _noalias const type = atom->type;
+  const int nlocal = atom->nlocal;
+  const double * _noalias const special_lj = force->special_lj;
+  double fxtmp,fytmp,fztmp;
+
+  ilist = list->ilist;
+  numneigh = list->numneigh;
+  firstneigh = list->firstneigh;
+
+  // loop over neighbors of my atoms
+
+  for (ii = iifrom; ii < iito; ++ii) {
+
+    i = ilist[ii];
+    xtmp = x[i].x;
+    ytmp = x[i].y;
+    ztmp = x[i].z;
+    itype = type[i];
+    jlist = firstneigh[i];
+    jnum = numneigh[i];
+    fxtmp=fytmp=fztmp=0.0;
+
+    const double * _noalias const cutsqi = cutsq[itype];
+    const double * _noalias const r_offseti = r_offset[itype];
+    const double * _noalias const lj1i = lj1[itype];
+    const double * _noalias const lj2i = lj2[itype];
+    const double * _noalias const lj3i = lj3[itype];
+    const double * _noalias const lj4i = lj4[itype];
+    const double * _noalias const offseti = offset[itype];
+    const double * _noalias const tab_rsqini = tab_rsqin[itype];
+    const double * _noalias const tab_delinvi = tab_delinv[itype];
+    const int * _noalias const ntabi = ntab[itype];
+
+    for (jj = 0; jj < jnum; jj++) {
+      j = jlist[jj];
+      factor_lj = special_lj[sbmask(j)];
+      j &= NEIGHMASK;
+
+      delx = xtmp - x[j].x;
+      dely = ytmp - x[j].y;
+      delz = ztmp - x[j].z;
+      rsq = delx*delx + dely*dely + delz*delz;
+      jtype = type[j];
+
+      if (rsq < cutsqi[jtype]) {
+        if (rsq > tab_rsqini[jtype]) {
+          double t = (rsq - tab_rsqini[jtype]) * tab_delinvi[jtype];
+          int k = static_cast<int> (t);
+          if (k >= ntabi[jtype]) k = ntabi[jtype]-1;
+          t -= k;
+          fpair = factor_lj*lookup(&ftab[itype][jtype][4*k],t);
+          if (EFLAG) evdwl = factor_lj*lookup(&etab[itype][jtype][4*k],t);
+        } else {
+        r = sqrt(rsq);
+        overlap += (r <= r_offseti[jtype]);
+        rinv_norm = 1.0/r;
+        rinv = 1.0/(r-r_offseti[jtype]);
+        r2inv = rinv*rinv;
+        r6inv = r2inv*r2inv*r2inv;
+        forcelj = r6inv * (lj1i[jtype]*r6inv - lj2i[jtype]);
+        fpair = factor_lj*forcelj*rinv*rinv_norm;
+        if (EFLAG) {
+          evdwl = r6inv*(lj3i[jtype]*r6inv-lj4i[jtype]) - offseti[jtype];
+          evdwl *= factor_lj;
+        }
+        }
+
+        fxtmp += delx*fpair;
+        fytmp += dely*fpair;
+        fztmp += delz*fpair;
+        if (NEWTON_PAIR || j < nlocal) {
+          f[j].x -= delx*fpair;
+          f[j].y -= dely*fpair;
+          f[j].z -= delz*fpair;
+        }
+
+        if (EVFLAG) ev_tally_thr(this,i,j,nlocal,NEWTON_PAIR,
+                                 evdwl,0.0,fpair,delx,dely,delz,thr);
+      }
+    }
+    f[i].x += fxtmp;
+    f[i].y += fytmp;
+    f[i].z += fztmp;
+  }
+
+  return overlap;
+}
+
+/* ---------------------------------------------------------------------- */
+
+double PairLJOffOMP::memory_usage()
+{
+  double bytes = memory_usage_thr();
+  bytes += PairLJOff::memory_usage();
+
+  return bytes;
+}
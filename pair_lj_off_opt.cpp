@@ -0,0 +1,237 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* ----------------------------------------------------------------------
+   Optimized version of pair lj/off, following pair lj/cut/opt
+------------------------------------------------------------------------- */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pair_lj_off_opt.h"
+#include "atom.h"
+#include "force.h"
+#include "neigh_list.h"
+#include "error.h"
+
+using namespace LAMMPS_NS;
+
+/* ---------------------------------------------------------------------- */
+
+PairLJOffOpt::PairLJOffOpt(LAMMPS *lmp) : PairLJOff(lmp) {}
+
+/* ---------------------------------------------------------------------- */
+
+void PairLJOffOpt::compute(int eflag, int vflag)
+{
+  if (eflag || vflag) ev_setup(eflag,vflag);
+  else evflag = vflag_fdotr = 0;
+
+  if (evflag) {
+    if (eflag) {
+      if (force->newton_pair) return eval<1,1,1>();
+      else return eval<1,1,0>();
+    } else {
+      if (force->newton_pair) return eval<1,0,1>();
+      else return eval<1,0,0>();
+    }
+  } else {
+    if (force->newton_pair) return eval<0,0,1>();
+    else return eval<0,0,0>();
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+template < int EVFLAG, int EFLAG, int NEWTON_PAIR >
+void PairLJOffOpt::eval()
+{
+  typedef struct { double x,y,z; } vec3_t;
+
+  typedef struct {
+    double cutsq,lj1,lj2,lj3,lj4,offset,r_offset;
+    double tab_rsqin,tab_delinv;
+    double *ftab,*etab;
+    int ntab,_pad[1];
+  } fast_alpha_t;
+
+  int i,j,ii,jj,inum,jnum,itype,jtype,sbindex;
+  double factor_lj;
+  double evdwl = 0.0;
+  int overlap = 0;
+
+  double** _noalias x = atom->x;
+  double** _noalias f = atom->f;
+  int* _noalias type = atom->type;
+  int nlocal = atom->nlocal;
+  double* _noalias special_lj = force->special_lj;
+
+  inum = list->inum;
+  int* _noalias ilist = list->ilist;
+  int** _noalias firstneigh = list->firstneigh;
+  int* _noalias numneigh = list->numneigh;
+
+  vec3_t* _noalias xx = (vec3_t*)x[0];
+  vec3_t* _noalias ff = (vec3_t*)f[0];
+
+  int ntypes = atom->ntypes;
+  int ntypes2 = ntypes*ntypes;
+
+  fast_alpha_t* _noalias fast_alpha =
+    (fast_alpha_t*) malloc(ntypes2*sizeof(fast_alpha_t));
+  for (i = 0; i < ntypes; i++) for (j = 0; j < ntypes; j++) {
+      fast_alpha_t& a = fast_alpha[i*ntypes+j];
+      memset(&a,0,sizeof(fast_alpha_t));
+      if (cutsq[i+1][j+1] > 1e-6) {
+        a.cutsq = cutsq[i+1][j+1];
+        a.lj1 = lj1[i+1][j+1];
+        a.lj2 = lj2[i+1][j+1];
+        a.lj3 = lj3[i+1][j+1];
+        a.lj4 = lj4[i+1][j+1];
+        a.offset = offset[i+1][j+1];
+        a.r_offset = r_offset[i+1][j+1];
+        a.tab_rsqin = tab_rsqin[i+1][j+1];
+        a.tab_delinv = tab_delinv[i+1][j+1];
+        a.ftab = ftab[i+1][j+1];
+        a.etab = etab[i+1][j+1];
+        a.ntab = ntab[i+1][j+1];
+      }
+    }
+  fast_alpha_t* _noalias tabsix = fast_alpha;
+
+  // loop over neighbors of my atoms
+
+  for (ii = 0; ii < inum; ii++) {
+    i = ilist[ii];
+    double xtmp = xx[i].x;
+    double ytmp = xx[i].y;
+    double ztmp = xx[i].z;
+    itype = type[i] - 1;
+    int* _noalias jlist = firstneigh[i];
+    jnum = numneigh[i];
+
+    double tmpfx = 0.0;
+    double tmpfy = 0.0;
+    double tmpfz = 0.0;
+
+    fast_alpha_t* _noalias tabsixi = (fast_alpha_t*)&tabsix[itype*ntypes];
+
+    for (jj = 0; jj < jnum; jj++) {
+      j = jlist[jj];
+      sbindex = sbmask(j);
+
+      if (sbindex == 0) {
+        double delx = xtmp - xx[j].x;
+        double dely = ytmp - xx[j].y;
+        double delz = ztmp - xx[j].z;
+        double rsq = delx*delx + dely*dely + delz*delz;
+
+        jtype = type[j] - 1;
+
+        fast_alpha_t& a = tabsixi[jtype];
+
+        if (rsq < a.cutsq) {
+          double fpair;
+          if (rsq > a.tab_rsqin) {
+            double t = (rsq - a.tab_rsqin) * a.tab_delinv;
+            int k = static_cast<int> (t);
+            if (k >= a.ntab) k = a.ntab-1;
+            t -= k;
+            fpair = lookup(&a.ftab[4*k],t);
+            if (EFLAG) evdwl = lookup(&a.etab[4*k],t);
+          } else {
+            double r = sqrt(rsq);
+            overlap += (r <= a.r_offset);
+            double rinv = 1.0/(r - a.r_offset);
+            double r2inv = rinv*rinv;
+            double r6inv = r2inv*r2inv*r2inv;
+            double forcelj = r6inv * (a.lj1*r6inv - a.lj2);
+            fpair = forcelj*rinv/r;
+            if (EFLAG) evdwl = r6inv*(a.lj3*r6inv-a.lj4) - a.offset;
+          }
+
+          tmpfx += delx*fpair;
+          tmpfy += dely*fpair;
+          tmpfz += delz*fpair;
+          if (NEWTON_PAIR || j < nlocal) {
+            ff[j].x -= delx*fpair;
+            ff[j].y -= dely*fpair;
+            ff[j].z -= delz*fpair;
+          }
+
+          if (EVFLAG) ev_tally(i,j,nlocal,NEWTON_PAIR,
+                               evdwl,0.0,fpair,delx,dely,delz);
+        }
+      } else {
+        factor_lj = special_lj[sbindex];
+        j &= NEIGHMASK;
+
+        double delx = xtmp - xx[j].x;
+        double dely = ytmp - xx[j].y;
+        double delz = ztmp - xx[j].z;
+        double rsq = delx*delx + dely*dely + delz*delz;
+
+        int jtype1 = type[j];
+        jtype = jtype1 - 1;
+
+        fast_alpha_t& a = tabsixi[jtype];
+        if (rsq < a.cutsq) {
+          double fpair;
+          if (rsq > a.tab_rsqin) {
+            double t = (rsq - a.tab_rsqin) * a.tab_delinv;
+            int k = static_cast<int> (t);
+            if (k >= a.ntab) k = a.ntab-1;
+            t -= k;
+            fpair = factor_lj*lookup(&a.ftab[4*k],t);
+            if (EFLAG) evdwl = factor_lj*lookup(&a.etab[4*k],t);
+          } else {
+            double r = sqrt(rsq);
+            overlap += (r <= a.r_offset);
+            double rinv = 1.0/(r - a.r_offset);
+            double r2inv = rinv*rinv;
+            double r6inv = r2inv*r2inv*r2inv;
+            double forcelj = r6inv * (a.lj1*r6inv - a.lj2);
+            fpair = factor_lj*forcelj*rinv/r;
+            if (EFLAG) {
+              evdwl = r6inv*(a.lj3*r6inv-a.lj4) - a.offset;
+              evdwl *= factor_lj;
+            }
+          }
+
+          tmpfx += delx*fpair;
+          tmpfy += dely*fpair;
+          tmpfz += delz*fpair;
+          if (NEWTON_PAIR || j < nlocal) {
+            ff[j].x -= delx*fpair;
+            ff[j].y -= dely*fpair;
+            ff[j].z -= delz*fpair;
+          }
+
+          if (EVFLAG) ev_tally(i,j,nlocal,NEWTON_PAIR,
+                               evdwl,0.0,fpair,delx,dely,delz);
+        }
+      }
+    }
+
+    ff[i].x += tmpfx;
+    ff[i].y += tmpfy;
+    ff[i].z += tmpfz;
+  }
+
+  free(fast_alpha); fast_alpha = 0;
+
+  // overlapping cores, reported once after the loop
+  if (overlap) error->one(FLERR,"Distance between particles too small");
+
+  if (vflag_fdotr) virial_fdotr_compute();
+}
@@ -0,0 +1,222 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* ----------------------------------------------------------------------
+   Vectorized version of pair lj/off on a full neighbor list
+   neighbors of each atom are gathered into SoA blocks padded to a
+   multiple of the SIMD width, the cutoff test is a mask inside the
+   vector loop and the force on i is a single reduction per block,
+   no scatter to f[j] is needed since every pair is visited twice
+   the kernel is vectorized through "omp simd" and needs -fopenmp plus
+   the target ISA, e.g. -mavx2 -mfma or -mavx512f (or -march=native),
+   without -fopenmp it compiles to the same loop in scalar form
+------------------------------------------------------------------------- */
+
+#include <math.h>
+#include "pair_lj_off_simd.h"
+#include "atom.h"
+#include "comm.h"
+#include "force.h"
+#include "neighbor.h"
+#include "neigh_list.h"
+#include "neigh_request.h"
+#include "error.h"
+
+using namespace LAMMPS_NS;
+
+#define BLOCK 128        // neighbors gathered per SoA block
+#define SIMD_WIDTH 8     // pad blocks to a multiple of this (AVX-512 doubles)
+#define BIG 1.0e300
+
+/* ---------------------------------------------------------------------- */
+
+PairLJOffSIMD::PairLJOffSIMD(LAMMPS *lmp) : PairLJOff(lmp)
+{
+  respa_enable = 0;
+
+  // both atoms of a pair are visited, the virial is tallied per pair
+  no_virial_fdotr_compute = 1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void PairLJOffSIMD::compute(int eflag, int vflag)
+{
+  if (eflag || vflag) ev_setup(eflag,vflag);
+  else evflag = vflag_fdotr = 0;
+
+  if (evflag) {
+    if (eflag) eval<1,1>();
+    else eval<1,0>();
+  } else eval<0,0>();
+}
+
+/* ----------------------------------------------------------------------
+   init specific to this pair style, request a full neighbor list
+------------------------------------------------------------------------- */
+
+void PairLJOffSIMD::init_style()
+{
+  if (tabstyle != NOTABLE && comm->me == 0)
+    error->warning(FLERR,"Pair lj/off/simd ignores the table option");
+
+  int irequest = neighbor->request(this,instance_me);
+  neighbor->requests[irequest]->half = 0;
+  neighbor->requests[irequest]->full = 1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+template < int EVFLAG, int EFLAG >
+void PairLJOffSIMD::eval()
+{
+  int i,j,ii,jj,jb,inum,jnum,itype;
+  int *ilist,*jlist,*numneigh,**firstneigh;
+  int overlap = 0;
+
+  double bdx[BLOCK],bdy[BLOCK],bdz[BLOCK],brsq[BLOCK],bfactor[BLOCK];
+  double bfpair[BLOCK],bevdwl[BLOCK];
+  int btype[BLOCK];
+
+  double **x = atom->x;
+  double **f = atom->f;
+  int *type = atom->type;
+  double *special_lj = force->special_lj;
+  const int peratom = eflag_atom || vflag_atom;
+
+  // global energy and virial, each pair is counted twice
+
+  double esum = 0.0;
+  double v0 = 0.0, v1 = 0.0, v2 = 0.0, v3 = 0.0, v4 = 0.0, v5 = 0.0;
+
+  inum = list->inum;
+  ilist = list->ilist;
+  numneigh = list->numneigh;
+  firstneigh = list->firstneigh;
+
+  for (ii = 0; ii < inum; ii++) {
+    i = ilist[ii];
+    const double xtmp = x[i][0];
+    const double ytmp = x[i][1];
+    const double ztmp = x[i][2];
+    itype = type[i];
+    jlist = firstneigh[i];
+    jnum = numneigh[i];
+
+    const double * const cutsqi = cutsq[itype];
+    const double * const r_offseti = r_offset[itype];
+    const double * const lj1i = lj1[itype];
+    const double * const lj2i = lj2[itype];
+    const double * const lj3i = lj3[itype];
+    const double * const lj4i = lj4[itype];
+    const double * const offseti = offset[itype];
+
+    double fxtmp = 0.0, fytmp = 0.0, fztmp = 0.0;
+
+    for (jb = 0; jb < jnum; jb += BLOCK) {
+      const int n = (jnum-jb < BLOCK) ? jnum-jb : BLOCK;
+
+      // gather the block into SoA arrays
+
+      for (jj = 0; jj < n; jj++) {
+        j = jlist[jb+jj];
+        bfactor[jj] = special_lj[sbmask(j)];
+        j &= NEIGHMASK;
+        bdx[jj] = xtmp - x[j][0];
+        bdy[jj] = ytmp - x[j][1];
+        bdz[jj] = ztmp - x[j][2];
+        brsq[jj] = bdx[jj]*bdx[jj] + bdy[jj]*bdy[jj] + bdz[jj]*bdz[jj];
+        btype[jj] = type[j];
+      }
+
+      // pad with entries that fail the cutoff test
+
+      int npad = n;
+      while (npad % SIMD_WIDTH && npad < BLOCK) {
+        bdx[npad] = bdy[npad] = bdz[npad] = 0.0;
+        brsq[npad] = BIG;
+        bfactor[npad] = 0.0;
+        btype[npad] = itype;
+        npad++;
+      }
+
+      // masked kernel, out-of-range lanes are evaluated at the cutoff
+      // with a zero prefactor so that sqrt and division stay finite
+
+      #if defined(_OPENMP)
+      #pragma omp simd reduction(+:fxtmp,fytmp,fztmp,overlap,esum,v0,v1,v2,v3,v4,v5)
+      #endif
+      for (jj = 0; jj < npad; jj++) {
+        const int jtype = btype[jj];
+        const int inside = brsq[jj] < cutsqi[jtype];
+        const double rsq = inside ? brsq[jj] : cutsqi[jtype];
+        const double fac = inside ? bfactor[jj] : 0.0;
+        const double r = sqrt(rsq);
+        overlap += inside & (r <= r_offseti[jtype]);
+        const double rinv = 1.0/(r - r_offseti[jtype]);
+        const double r2inv = rinv*rinv;
+        const double r6inv = r2inv*r2inv*r2inv;
+        const double forcelj = r6inv * (lj1i[jtype]*r6inv - lj2i[jtype]);
+        const double fpair = fac*forcelj*rinv/r;
+
+        fxtmp += bdx[jj]*fpair;
+        fytmp += bdy[jj]*fpair;
+        fztmp += bdz[jj]*fpair;
+
+        if (EVFLAG) {
+          bfpair[jj] = fpair;
+          double evdwl = 0.0;
+          if (EFLAG) {
+            evdwl = fac*(r6inv*(lj3i[jtype]*r6inv-lj4i[jtype]) - offseti[jtype]);
+            bevdwl[jj] = evdwl;
+          }
+          esum += evdwl;
+          v0 += bdx[jj]*bdx[jj]*fpair;
+          v1 += bdy[jj]*bdy[jj]*fpair;
+          v2 += bdz[jj]*bdz[jj]*fpair;
+          v3 += bdx[jj]*bdy[jj]*fpair;
+          v4 += bdx[jj]*bdz[jj]*fpair;
+          v5 += bdy[jj]*bdz[jj]*fpair;
+        }
+      }
+
+      // per-atom tallies, which also take care of the global ones
+
+      if (EVFLAG && peratom) {
+        for (jj = 0; jj < n; jj++)
+          if (brsq[jj] < cutsqi[btype[jj]])
+            ev_tally_full(i,EFLAG ? bevdwl[jj] : 0.0,0.0,bfpair[jj],
+                          bdx[jj],bdy[jj],bdz[jj]);
+      }
+    }
+
+    f[i][0] += fxtmp;
+    f[i][1] += fytmp;
+    f[i][2] += fztmp;
+  }
+
+  if (EVFLAG && !peratom) {
+    if (eflag_global) eng_vdwl += 0.5*esum;
+    if (vflag_global) {
+      virial[0] += 0.5*v0;
+      virial[1] += 0.5*v1;
+      virial[2] += 0.5*v2;
+      virial[3] += 0.5*v3;
+      virial[4] += 0.5*v4;
+      virial[5] += 0.5*v5;
+    }
+  }
+
+  // overlapping cores, reported once after the loop
+  if (overlap) error->one(FLERR,"Distance between particles too small");
+}
@@ -0,0 +1,53 @@
+/* -*- c++ -*- ----------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+#ifdef PAIR_CLASS
+
+PairStyle(lj/off/simd,PairLJOffSIMD)
+
+#else
+
+#ifndef LMP_PAIR_LJ_OFF_SIMD_H
+#define LMP_PAIR_LJ_OFF_SIMD_H
+
+#include "pair_lj_off.h"
+
+namespace LAMMPS_NS {
+
+class PairLJOffSIMD : public PairLJOff {
+ public:
+  PairLJOffSIMD(class LAMMPS *);
+  void compute(int, int);
+  void init_style();
+
+ private:
+  template < int EVFLAG, int EFLAG > void eval();
+};
+
+}
+
+#endif
+#endif
+
+/* ERROR/WARNING messages:
+
+W: Pair lj/off/simd ignores the table option
+
+The vectorized kernel always evaluates the interaction analytically.
+
+E: Distance between particles too small
+
+Two particles are closer than the offset distance r_offset of their
+types, the shifted LJ interaction is undefined there.
+
+*/
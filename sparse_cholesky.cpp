@@ -0,0 +1,358 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+// Sparse Cholesky factorization with rank-1 update/downdate and row
+// replacement, replaces the Eigen based LLT_Addon of the archived fixes.
+// The factorization is up-looking along the elimination tree, the
+// update/downdate only touches the columns on one path of the tree,
+// see T. A. Davis, Direct Methods for Sparse Linear Systems (2006)
+
+#include <math.h>
+#include <string.h>
+#include "sparse_cholesky.h"
+#include "memory.h"
+#include "error.h"
+
+using namespace LAMMPS_NS;
+
+/* ---------------------------------------------------------------------- */
+
+SparseCholesky::SparseCholesky(LAMMPS *lmp) : Pointers(lmp)
+{
+  n = nnz = 0;
+  parent = Lp = Li = NULL;
+  Lx = NULL;
+  Ap = Ai = NULL;
+  stack = flag = next = NULL;
+  x = y = wold = wnew = NULL;
+}
+
+/* ---------------------------------------------------------------------- */
+
+SparseCholesky::~SparseCholesky()
+{
+  deallocate();
+}
+
+/* ---------------------------------------------------------------------- */
+
+void SparseCholesky::deallocate()
+{
+  memory->destroy(parent);
+  memory->destroy(Lp);
+  memory->destroy(Li);
+  memory->destroy(Lx);
+  memory->destroy(Ap);
+  memory->destroy(Ai);
+  memory->destroy(stack);
+  memory->destroy(flag);
+  memory->destroy(next);
+  memory->destroy(x);
+  memory->destroy(y);
+  memory->destroy(wold);
+  memory->destroy(wnew);
+  parent = Lp = Li = NULL;
+  Lx = NULL;
+  Ap = Ai = NULL;
+  stack = flag = next = NULL;
+  x = y = wold = wnew = NULL;
+}
+
+/* ----------------------------------------------------------------------
+   elimination tree and pattern of L, row i of A holds the columns
+   colind[rowptr[i]..rowptr[i+1]-1], all <= i and including i
+------------------------------------------------------------------------- */
+
+void SparseCholesky::analyze(int nrow, const int *rowptr, const int *colind)
+{
+  int i,j,k,p,top;
+
+  deallocate();
+  n = nrow;
+
+  memory->create(Ap,n+1,"cholesky:Ap");
+  memory->create(Ai,rowptr[n],"cholesky:Ai");
+  memcpy(Ap,rowptr,(n+1)*sizeof(int));
+  memcpy(Ai,colind,rowptr[n]*sizeof(int));
+
+  memory->create(parent,n,"cholesky:parent");
+  memory->create(Lp,n+1,"cholesky:Lp");
+  memory->create(stack,n,"cholesky:stack");
+  memory->create(flag,n,"cholesky:flag");
+  memory->create(next,n,"cholesky:next");
+  memory->create(x,n,"cholesky:x");
+  memory->create(y,n,"cholesky:y");
+  memory->create(wold,n,"cholesky:wold");
+  memory->create(wnew,n,"cholesky:wnew");
+
+  // elimination tree, next[] holds the ancestors (path compression)
+
+  for (i = 0; i < n; i++) {
+    parent[i] = next[i] = -1;
+    int diag = 0;
+    for (p = Ap[i]; p < Ap[i+1]; p++) {
+      k = Ai[p];
+      if (k == i) diag = 1;
+      for (; k != -1 && k < i; k = j) {
+        j = next[k];
+        next[k] = i;
+        if (j == -1) parent[k] = i;
+      }
+    }
+    if (!diag) error->one(FLERR,"Sparse Cholesky pattern needs the diagonal");
+  }
+
+  // column counts from the row patterns of L
+
+  for (i = 0; i < n; i++) {
+    flag[i] = -1;
+    x[i] = y[i] = wold[i] = wnew[i] = 0.0;
+    next[i] = 1;
+  }
+  for (i = 0; i < n; i++) {
+    top = ereach(i);
+    for (p = top; p < n; p++) next[stack[p]]++;
+  }
+  Lp[0] = 0;
+  for (i = 0; i < n; i++) Lp[i+1] = Lp[i] + next[i];
+  nnz = Lp[n];
+
+  memory->create(Li,nnz,"cholesky:Li");
+  memory->create(Lx,nnz,"cholesky:Lx");
+
+  // row indices, ascending within each column with the diagonal first
+
+  for (i = 0; i < n; i++) next[i] = Lp[i];
+  for (i = 0; i < n; i++) {
+    top = ereach(i);
+    for (p = top; p < n; p++) Li[next[stack[p]]++] = i;
+    Li[next[i]++] = i;
+  }
+  for (i = 0; i < nnz; i++) Lx[i] = 0.0;
+}
+
+/* ----------------------------------------------------------------------
+   nonzero pattern of row k of L in stack[top..n-1], topological order
+------------------------------------------------------------------------- */
+
+int SparseCholesky::ereach(int k)
+{
+  int p,j,len;
+  int top = n;
+
+  flag[k] = k;
+  for (p = Ap[k]; p < Ap[k+1]; p++) {
+    j = Ai[p];
+    if (j > k) continue;
+    for (len = 0; flag[j] != k; j = parent[j]) {
+      stack[len++] = j;
+      flag[j] = k;
+    }
+    while (len > 0) stack[--top] = stack[--len];
+  }
+
+  for (p = top; p < n; p++) flag[stack[p]] = -1;
+  flag[k] = -1;
+  return top;
+}
+
+/* ----------------------------------------------------------------------
+   up-looking numeric factorization, values are ordered as colind
+------------------------------------------------------------------------- */
+
+int SparseCholesky::factorize(const double *values)
+{
+  int j,k,p,t,top;
+  double d,lkj;
+
+  if (Ap == NULL) error->one(FLERR,"Sparse Cholesky factor is not analyzed");
+
+  for (j = 0; j < n; j++) next[j] = Lp[j];
+
+  for (k = 0; k < n; k++) {
+    top = ereach(k);
+    for (p = Ap[k]; p < Ap[k+1]; p++)
+      if (Ai[p] <= k) x[Ai[p]] += values[p];
+    d = x[k];
+    x[k] = 0.0;
+
+    for (t = top; t < n; t++) {
+      j = stack[t];
+      lkj = x[j]/Lx[Lp[j]];
+      x[j] = 0.0;
+      for (p = Lp[j]+1; p < next[j]; p++) x[Li[p]] -= Lx[p]*lkj;
+      d -= lkj*lkj;
+      p = next[j]++;
+      Li[p] = k;
+      Lx[p] = lkj;
+    }
+
+    if (d <= 0.0) return k+1;
+    p = next[k]++;
+    Li[p] = k;
+    Lx[p] = sqrt(d);
+  }
+
+  return 0;
+}
+
+/* ----------------------------------------------------------------------
+   L L^T + sigma w w^T along the path of the elimination tree from f,
+   the nonzeros of w must be on this path, w is zeroed on return
+------------------------------------------------------------------------- */
+
+int SparseCholesky::updown(double *w, int sigma, int f)
+{
+  int j,p;
+  double alpha,beta,beta2,delta,gamma,w1,w2;
+  int fail = 0;
+
+  beta = 1.0;
+  for (j = f; j != -1; j = parent[j]) {
+    p = Lp[j];
+    alpha = w[j]/Lx[p];
+    beta2 = beta*beta + sigma*alpha*alpha;
+    if (beta2 <= 0.0) {
+      fail = 1;
+      break;
+    }
+    beta2 = sqrt(beta2);
+    delta = (sigma > 0) ? beta/beta2 : beta2/beta;
+    gamma = sigma*alpha/(beta2*beta);
+    Lx[p] = delta*Lx[p] + ((sigma > 0) ? gamma*w[j] : 0.0);
+    beta = beta2;
+    for (p++; p < Lp[j+1]; p++) {
+      w1 = w[Li[p]];
+      w[Li[p]] = w2 = w1 - alpha*Lx[p];
+      Lx[p] = delta*Lx[p] + gamma*((sigma > 0) ? w1 : w2);
+    }
+  }
+
+  for (j = f; j != -1; j = parent[j]) w[j] = 0.0;
+  return fail;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int SparseCholesky::update(double *w, int sign)
+{
+  int f;
+  for (f = 0; f < n; f++)
+    if (w[f] != 0.0) break;
+  if (f == n) return 0;
+  return updown(w,sign > 0 ? 1 : -1,f);
+}
+
+/* ----------------------------------------------------------------------
+   rank-k update or downdate, one column of W at a time
+------------------------------------------------------------------------- */
+
+int SparseCholesky::update(int k, double **w, int sign)
+{
+  for (int m = 0; m < k; m++)
+    if (update(w[m],sign)) return 1;
+  return 0;
+}
+
+/* ----------------------------------------------------------------------
+   replace row/column i of A by the dense symmetric row arow
+   [l21 l22 0; L31 l32 L33] with L11, L31 fixed: l21 from a triangular
+   solve, l32 = (a32 - L31 l21^T)/l22, and L33 L33^T gets the rank-1
+   update with the old l32 and the downdate with the new one
+------------------------------------------------------------------------- */
+
+int SparseCholesky::update_row(int i, const double *arow)
+{
+  int j,p,r,t,top;
+  double d,lij;
+
+  top = ereach(i);
+  for (p = Ap[i]; p < Ap[i+1]; p++)
+    if (Ai[p] < i) x[Ai[p]] = arow[Ai[p]];
+  for (p = Lp[i]+1; p < Lp[i+1]; p++) y[Li[p]] = arow[Li[p]];
+  d = arow[i];
+
+  for (t = top; t < n; t++) {
+    j = stack[t];
+    lij = x[j]/Lx[Lp[j]];
+    x[j] = 0.0;
+    for (p = Lp[j]+1; p < Lp[j+1]; p++) {
+      r = Li[p];
+      if (r < i) x[r] -= Lx[p]*lij;
+      else if (r == i) Lx[p] = lij;
+      else y[r] -= Lx[p]*lij;
+    }
+    d -= lij*lij;
+  }
+
+  int fail = (d <= 0.0);
+  if (!fail) Lx[Lp[i]] = sqrt(d);
+  for (p = Lp[i]+1; p < Lp[i+1]; p++) {
+    r = Li[p];
+    wold[r] = Lx[p];
+    if (!fail) Lx[p] = wnew[r] = y[r]/Lx[Lp[i]];
+    y[r] = 0.0;
+  }
+  if (Lp[i+1] == Lp[i]+1) return fail;
+
+  if (fail) {
+    for (p = Lp[i]+1; p < Lp[i+1]; p++) wold[Li[p]] = 0.0;
+    return fail;
+  }
+  if (updown(wold,1,parent[i])) {
+    for (p = Lp[i]+1; p < Lp[i+1]; p++) wnew[Li[p]] = 0.0;
+    return 1;
+  }
+  return updown(wnew,-1,parent[i]);
+}
+
+/* ----------------------------------------------------------------------
+   b <- (L L^T)^-1 b
+------------------------------------------------------------------------- */
+
+void SparseCholesky::solve(double *b)
+{
+  int j,p;
+
+  for (j = 0; j < n; j++) {
+    b[j] /= Lx[Lp[j]];
+    for (p = Lp[j]+1; p < Lp[j+1]; p++) b[Li[p]] -= Lx[p]*b[j];
+  }
+  for (j = n-1; j >= 0; j--) {
+    for (p = Lp[j]+1; p < Lp[j+1]; p++) b[j] -= Lx[p]*b[Li[p]];
+    b[j] /= Lx[Lp[j]];
+  }
+}
+
+/* ----------------------------------------------------------------------
+   out = L in, e.g. correlated noise from uncorrelated random numbers
+------------------------------------------------------------------------- */
+
+void SparseCholesky::multiply(const double *in, double *out)
+{
+  int j,p;
+
+  for (j = 0; j < n; j++) out[j] = 0.0;
+  for (j = 0; j < n; j++)
+    for (p = Lp[j]; p < Lp[j+1]; p++) out[Li[p]] += Lx[p]*in[j];
+}
+
+/* ---------------------------------------------------------------------- */
+
+double SparseCholesky::memory_usage()
+{
+  double bytes = (double)nnz * (sizeof(int) + sizeof(double));
+  if (Ap) bytes += (double)Ap[n] * sizeof(int);
+  bytes += (double)n * (6*sizeof(int) + 4*sizeof(double));
+  return bytes;
+}
@@ -0,0 +1,76 @@
+/* -*- c++ -*- ----------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+#ifndef LMP_SPARSE_CHOLESKY_H
+#define LMP_SPARSE_CHOLESKY_H
+
+#include "pointers.h"
+
+namespace LAMMPS_NS {
+
+class SparseCholesky : protected Pointers {
+ public:
+  SparseCholesky(class LAMMPS *);
+  ~SparseCholesky();
+
+  // symbolic analysis of the lower triangle of A in compressed rows,
+  // row i holds the columns k <= i, the pattern is kept fixed afterwards
+  void analyze(int, const int *, const int *);
+
+  // numeric factorization A = L L^T with values in the analyzed layout,
+  // returns 0 or 1 + index of the first non-positive pivot
+  int factorize(const double *);
+
+  // L L^T + sign w w^T for dense w, whose nonzeros must lie in the pattern
+  // of column f of L, f = first nonzero of w; returns 0 or 1 on failure
+  int update(double *, int);
+  int update(int, double **, int);
+
+  // replace row and column i of A, the new values are given as a
+  // dense symmetric row in the analyzed pattern; returns 0 or 1
+  int update_row(int, const double *);
+
+  void solve(double *);                   // b <- A^-1 b
+  void multiply(const double *, double *); // out = L in
+  double memory_usage();
+
+  int n,nnz;                  // size and nonzeros of L
+  int *parent;                // elimination tree
+  int *Lp,*Li;                // L in compressed columns, diagonal first
+  double *Lx;
+
+ private:
+  int *Ap,*Ai;                // pattern of the lower triangle of A, by rows
+  int *stack,*flag,*next;
+  double *x,*y,*wold,*wnew;
+
+  void deallocate();
+  int ereach(int);
+  int updown(double *, int, int);
+};
+
+}
+
+#endif
+
+/* ERROR/WARNING messages:
+
+E: Sparse Cholesky factor is not analyzed
+
+The symbolic analysis has to be done before a numeric factorization.
+
+E: Sparse Cholesky pattern needs the diagonal
+
+Every row of the lower triangle must contain its diagonal entry.
+
+*/